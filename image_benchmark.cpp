@@ -0,0 +1,369 @@
+//
+// Created by Aleksey Timin on 4/22/20.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "image_filter.h"
+
+/**
+ * Benchmark of the filters: every filter type x image size x padding x element type x number of channels.
+ * Each case is warmed up, then timed by steady_clock several times; the median is reported
+ * in megapixels per second and nanoseconds per pixel. The results can be written to CSV and JSON
+ * to compare builds on the same machine.
+ *
+ * Usage:
+ *
+ * image_benchmark                                   # the whole sweep (8K needs a few GB of RAM)
+ * image_benchmark --sizes VGA,FHD --types uint8 --csv results.csv
+ * image_benchmark --filters GAUSSIAN,SOBEL --pad-types CONST --pad-directions BOTH --json results.json
+ */
+
+using namespace metric;
+using namespace metric::image_processing_details;
+using namespace std::chrono;
+
+namespace {
+	struct Size {
+		std::string name;
+		size_t rows;
+		size_t columns;
+	};
+
+	const std::vector<Size> allSizes{
+			{"VGA", 480,  640},
+			{"HD",  720,  1280},
+			{"FHD", 1080, 1920},
+			{"4K",  2160, 3840},
+			{"8K",  4320, 7680}};
+
+	const std::vector<std::pair<std::string, PadDirection>> allPadDirections{
+			{"POST", PadDirection::POST},
+			{"PRE",  PadDirection::PRE},
+			{"BOTH", PadDirection::BOTH}};
+
+	const std::vector<std::pair<std::string, PadType>> allPadTypes{
+			{"CONST",     PadType::CONST},
+			{"REPLICATE", PadType::REPLICATE},
+			{"SYMMETRIC", PadType::SYMMETRIC},
+			{"CIRCULAR",  PadType::CIRCULAR}};
+
+	struct Options {
+		std::vector<std::string> filters;
+		std::vector<std::string> sizes;
+		std::vector<std::string> types{"uint8", "float", "double"};
+		std::vector<std::string> padDirections;
+		std::vector<std::string> padTypes;
+		std::vector<size_t> channels{1, 3};
+		size_t warmup = 1;
+		size_t repetitions = 5;
+		size_t threads = 0;
+		std::string csv;
+		std::string json;
+	};
+
+	struct Result {
+		std::string filter;
+		std::string type;
+		size_t channels;
+		std::string size;
+		size_t rows;
+		size_t columns;
+		std::string padDirection;
+		std::string padType;
+		size_t repetitions;
+		/** seconds */
+		double median;
+		double best;
+
+		double megapixelsPerSecond() const {
+			return rows * columns / median / 1e6;
+		}
+
+		double nanosecondsPerPixel() const {
+			return median * 1e9 / (rows * columns);
+		}
+	};
+
+	/**
+	 * Checks if the name is selected, an empty selection means all names
+	 */
+	bool selected(const std::vector<std::string> &selection, const std::string &name) {
+		return selection.empty() || std::find(selection.begin(), selection.end(), name) != selection.end();
+	}
+
+	std::vector<std::string> split(const std::string &list) {
+		std::vector<std::string> items;
+		std::stringstream stream(list);
+		for (std::string item; std::getline(stream, item, ',');) {
+			if (!item.empty()) {
+				items.push_back(item);
+			}
+		}
+
+		return items;
+	}
+
+	/**
+	 * Calls visit(name, filter) for each filter type
+	 */
+	template<typename Visit>
+	void forEachFilter(const Options &options, Visit visit) {
+		using Binomial = FilterType::STATIC<5, 5, 256,
+				1, 4, 6, 4, 1,
+				4, 16, 24, 16, 4,
+				6, 24, 36, 24, 6,
+				4, 16, 24, 16, 4,
+				1, 4, 6, 4, 1>;
+
+		auto run = [&](const std::string &name, const auto &impl) {
+			if (selected(options.filters, name)) {
+				visit(name, impl);
+			}
+		};
+
+		run("AVERAGE", FilterType::AVERAGE(5, 5));
+		run("DISK", FilterType::DISK(3));
+		run("GAUSSIAN", FilterType::GAUSSIAN(5, 5, 1.0));
+		run("RECURSIVE_GAUSSIAN", FilterType::RECURSIVE_GAUSSIAN(20));
+		run("LAPLACIAN", FilterType::LAPLACIAN(0.2));
+		run("LOG", FilterType::LOG(5, 5, 0.5));
+		run("MEDIAN", FilterType::MEDIAN(5, 5));
+		run("OPEN", FilterType::OPEN(51, 51));
+		run("BILATERAL", FilterType::BILATERAL(8.0, 20.0));
+		run("MOTION", FilterType::MOTION(9, 45));
+		run("PREWITT", FilterType::PREWITT());
+		run("SOBEL", FilterType::SOBEL());
+		run("UNSHARP", FilterType::UNSHARP(0.5));
+		run("STATIC", Binomial());
+		run("CHAIN", FilterType::CHAIN(FilterType::GAUSSIAN(5, 5, 1.0), FilterType::SOBEL()));
+	}
+
+	template<typename T>
+	Channel<T> randomChannel(size_t rows, size_t columns, std::mt19937 &generator) {
+		std::uniform_int_distribution<int> distribution(0, 255);
+		Channel<T> channel(rows, columns);
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				channel(i, j) = static_cast<T>(distribution(generator));
+			}
+		}
+
+		return channel;
+	}
+
+	template<typename T, size_t N>
+	struct Frame {
+		using Type = Image<T, N>;
+
+		static Type random(size_t rows, size_t columns, std::mt19937 &generator) {
+			Type image;
+			for (size_t ch = 0; ch < N; ++ch) {
+				image[ch] = randomChannel<T>(rows, columns, generator);
+			}
+
+			return image;
+		}
+	};
+
+	template<typename T>
+	struct Frame<T, 1> {
+		using Type = Channel<T>;
+
+		static Type random(size_t rows, size_t columns, std::mt19937 &generator) {
+			return randomChannel<T>(rows, columns, generator);
+		}
+	};
+
+	/**
+	 * Times one case: warmup runs, then the repetitions one by one
+	 * @return the median and the best time in seconds
+	 */
+	template<typename T, size_t N, typename Filter>
+	std::pair<double, double> measure(const typename Frame<T, N>::Type &input, const Filter &impl,
+									  const PadModel<T> &padmodel, const Options &options) {
+		ConvolutionSettings settings;
+		settings.threads = options.threads;
+
+		// The plan and the buffers are made by the warmup, as in a video pipeline
+		FilterWorkspace<T> workspace;
+		typename Frame<T, N>::Type output;
+		for (size_t k = 0; k < options.warmup; ++k) {
+			filter(input, output, impl, padmodel, FilterShape::FULL, settings, &workspace);
+		}
+
+		std::vector<double> times;
+		for (size_t k = 0; k < options.repetitions; ++k) {
+			auto start = steady_clock::now();
+			filter(input, output, impl, padmodel, FilterShape::FULL, settings, &workspace);
+			times.push_back(duration<double>(steady_clock::now() - start).count());
+		}
+
+		std::sort(times.begin(), times.end());
+		return {times[times.size() / 2], times.front()};
+	}
+
+	template<typename T, size_t N>
+	void sweep(const std::string &type, const Size &size, const Options &options, std::vector<Result> &results) {
+		if (std::find(options.channels.begin(), options.channels.end(), N) == options.channels.end()) {
+			return;
+		}
+
+		std::mt19937 generator(42);
+		auto input = Frame<T, N>::random(size.rows, size.columns, generator);
+
+		forEachFilter(options, [&](const std::string &name, const auto &impl) {
+			for (auto &[directionName, direction] : allPadDirections) {
+				if (!selected(options.padDirections, directionName)) {
+					continue;
+				}
+
+				for (auto &[padTypeName, padType] : allPadTypes) {
+					if (!selected(options.padTypes, padTypeName)) {
+						continue;
+					}
+
+					PadModel<T> padmodel(direction, padType, 0);
+					auto[median, best] = measure<T, N>(input, impl, padmodel, options);
+
+					Result result{name, type, N, size.name, size.rows, size.columns, directionName, padTypeName,
+								  options.repetitions, median, best};
+					results.push_back(result);
+
+					std::cout << std::left << std::setw(19) << name << std::setw(8) << type << std::setw(3) << N
+							  << std::setw(5) << size.name << std::setw(6) << directionName << std::setw(11)
+							  << padTypeName << std::right << std::fixed << std::setprecision(1) << std::setw(10)
+							  << result.megapixelsPerSecond() << " MP/s" << std::setprecision(2) << std::setw(10)
+							  << result.nanosecondsPerPixel() << " ns/px" << std::endl;
+				}
+			}
+		});
+	}
+
+	template<typename T>
+	void sweep(const std::string &type, const Size &size, const Options &options, std::vector<Result> &results) {
+		if (selected(options.types, type)) {
+			sweep<T, 1>(type, size, options, results);
+			sweep<T, 3>(type, size, options, results);
+		}
+	}
+
+	void writeCsv(const std::string &path, const std::vector<Result> &results) {
+		std::ofstream out(path);
+		out << "filter,type,channels,size,rows,columns,pad_direction,pad_type,repetitions,"
+			   "median_s,best_s,megapixels_per_s,ns_per_pixel\n";
+		out << std::setprecision(9);
+		for (auto &r : results) {
+			out << r.filter << ',' << r.type << ',' << r.channels << ',' << r.size << ',' << r.rows << ','
+				<< r.columns << ',' << r.padDirection << ',' << r.padType << ',' << r.repetitions << ','
+				<< r.median << ',' << r.best << ',' << r.megapixelsPerSecond() << ',' << r.nanosecondsPerPixel()
+				<< '\n';
+		}
+	}
+
+	void writeJson(const std::string &path, const std::vector<Result> &results, const Options &options) {
+		std::ofstream out(path);
+		out << std::setprecision(9);
+		out << "{\n  \"threads\": " << ThreadPool::shared(options.threads).size()
+			<< ",\n  \"warmup\": " << options.warmup << ",\n  \"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			auto &r = results[i];
+			out << (i ? ",\n" : "\n") << "    {\"filter\": \"" << r.filter << "\", \"type\": \"" << r.type
+				<< "\", \"channels\": " << r.channels << ", \"size\": \"" << r.size << "\", \"rows\": " << r.rows
+				<< ", \"columns\": " << r.columns << ", \"pad_direction\": \"" << r.padDirection
+				<< "\", \"pad_type\": \"" << r.padType << "\", \"repetitions\": " << r.repetitions
+				<< ", \"median_s\": " << r.median << ", \"best_s\": " << r.best
+				<< ", \"megapixels_per_s\": " << r.megapixelsPerSecond()
+				<< ", \"ns_per_pixel\": " << r.nanosecondsPerPixel() << "}";
+		}
+
+		out << "\n  ]\n}\n";
+	}
+
+	void usage() {
+		std::cerr << "usage: image_benchmark [options]\n"
+					 "  --filters LIST         AVERAGE,DISK,GAUSSIAN,RECURSIVE_GAUSSIAN,LAPLACIAN,LOG,MEDIAN,OPEN,\n"
+					 "                         BILATERAL,MOTION,PREWITT,SOBEL,UNSHARP,STATIC,CHAIN (all by default)\n"
+					 "  --sizes LIST           VGA,HD,FHD,4K,8K (all by default)\n"
+					 "  --types LIST           uint8,float,double (all by default)\n"
+					 "  --channels LIST        1,3 (both by default)\n"
+					 "  --pad-directions LIST  POST,PRE,BOTH (all by default)\n"
+					 "  --pad-types LIST       CONST,REPLICATE,SYMMETRIC,CIRCULAR (all by default)\n"
+					 "  --warmup N             runs before the timing (1)\n"
+					 "  --repetitions N        timed runs, the median is reported (5)\n"
+					 "  --threads N            threads of the filters, 0 means all hardware threads (0)\n"
+					 "  --csv PATH             writes the results as CSV\n"
+					 "  --json PATH            writes the results as JSON\n";
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		std::string value = argv[++i];
+		if (arg == "--filters") {
+			options.filters = split(value);
+		} else if (arg == "--sizes") {
+			options.sizes = split(value);
+		} else if (arg == "--types") {
+			options.types = split(value);
+		} else if (arg == "--channels") {
+			options.channels.clear();
+			for (auto &item : split(value)) {
+				options.channels.push_back(std::stoul(item));
+			}
+		} else if (arg == "--pad-directions") {
+			options.padDirections = split(value);
+		} else if (arg == "--pad-types") {
+			options.padTypes = split(value);
+		} else if (arg == "--warmup") {
+			options.warmup = std::stoul(value);
+		} else if (arg == "--repetitions") {
+			options.repetitions = std::max<size_t>(1, std::stoul(value));
+		} else if (arg == "--threads") {
+			options.threads = std::stoul(value);
+		} else if (arg == "--csv") {
+			options.csv = value;
+		} else if (arg == "--json") {
+			options.json = value;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	std::vector<Result> results;
+	for (auto &size : allSizes) {
+		if (!selected(options.sizes, size.name)) {
+			continue;
+		}
+
+		sweep<uint8_t>("uint8", size, options, results);
+		sweep<float>("float", size, options, results);
+		sweep<double>("double", size, options, results);
+	}
+
+	if (!options.csv.empty()) {
+		writeCsv(options.csv, results);
+	}
+
+	if (!options.json.empty()) {
+		writeJson(options.json, results, options);
+	}
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+//
+// Created by Aleksey Timin on 4/21/20.
+//
+
+#include "image_cache.h"
+
+namespace metric {
+	namespace image_processing_details {
+		template<typename Key, typename Value, typename Hash>
+		template<typename Make>
+		std::shared_ptr<const Value> LruCache<Key, Value, Hash>::get(const Key &key, Make make) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _index.find(key);
+				if (found != _index.end()) {
+					_entries.splice(_entries.begin(), _entries, found->second);
+					++_hits;
+					return found->second->second;
+				}
+
+				++_misses;
+			}
+
+			// Kernels can take a while to make, the other threads shouldn't wait for it
+			auto value = std::make_shared<const Value>(make());
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto found = _index.find(key);
+			if (found != _index.end()) {
+				return found->second->second;
+			}
+
+			if (_capacity > 0) {
+				_entries.emplace_front(key, value);
+				_index.emplace(key, _entries.begin());
+				trim();
+			}
+
+			return value;
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		size_t LruCache<Key, Value, Hash>::hits() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _hits;
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		size_t LruCache<Key, Value, Hash>::misses() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _misses;
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		size_t LruCache<Key, Value, Hash>::size() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _entries.size();
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		size_t LruCache<Key, Value, Hash>::capacity() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _capacity;
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		void LruCache<Key, Value, Hash>::setCapacity(size_t capacity) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_capacity = capacity;
+			trim();
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		void LruCache<Key, Value, Hash>::clear() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_index.clear();
+			_entries.clear();
+			_hits = 0;
+			_misses = 0;
+		}
+
+		template<typename Key, typename Value, typename Hash>
+		void LruCache<Key, Value, Hash>::trim() {
+			while (_entries.size() > _capacity) {
+				_index.erase(_entries.back().first);
+				_entries.pop_back();
+			}
+		}
+
+		template<typename T>
+		void hashCombine(size_t &seed, const T &value) {
+			seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6u) + (seed >> 2u);
+		}
+	}
+}
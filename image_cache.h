@@ -0,0 +1,104 @@
+//
+// Created by Aleksey Timin on 4/21/20.
+//
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace metric {
+	namespace image_processing_details {
+		/**
+		 * Thread-safe cache which keeps at most capacity() values and drops the least recently used one
+		 *
+		 * The values are immutable and shared, so a dropped value stays valid while somebody holds it.
+		 * A missing value is made without the lock: two threads can make the same value at the same time,
+		 * the first one which is stored is kept.
+		 *
+		 * Usage:
+		 *
+		 * LruCache<std::string, Kernel> cache(64);
+		 * std::shared_ptr<const Kernel> kernel = cache.get("gaussian 5x5", [] { return makeKernel(); });
+		 *
+		 * @tparam Key type of the key
+		 * @tparam Value type of the value
+		 * @tparam Hash hash of the key
+		 */
+		template<typename Key, typename Value, typename Hash = std::hash<Key>>
+		class LruCache {
+		public:
+			/**
+			 * @param capacity max number of values (0 turns the cache off)
+			 */
+			explicit LruCache(size_t capacity) : _capacity(capacity) {}
+
+			LruCache(const LruCache &) = delete;
+			LruCache &operator=(const LruCache &) = delete;
+
+			/**
+			 * Returns the value of the key, makes and stores it if the cache doesn't have it
+			 * @param key the key
+			 * @param make function which returns the value
+			 * @return the value
+			 */
+			template<typename Make>
+			std::shared_ptr<const Value> get(const Key &key, Make make);
+
+			/**
+			 * Returns number of calls of get() which found the value
+			 */
+			size_t hits() const;
+
+			/**
+			 * Returns number of calls of get() which made the value
+			 */
+			size_t misses() const;
+
+			/**
+			 * Returns number of the stored values
+			 */
+			size_t size() const;
+
+			size_t capacity() const;
+
+			/**
+			 * Changes the max number of values and drops the least recently used ones above it
+			 */
+			void setCapacity(size_t capacity);
+
+			/**
+			 * Drops all the values and resets the counters
+			 */
+			void clear();
+
+		private:
+			using Entry = std::pair<Key, std::shared_ptr<const Value>>;
+
+			void trim();
+
+			mutable std::mutex _mutex;
+			/** the most recently used value is the first */
+			std::list<Entry> _entries;
+			std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> _index;
+			size_t _capacity;
+			size_t _hits = 0;
+			size_t _misses = 0;
+		};
+
+		/**
+		 * Mixes the hash of a value into seed (the combination of boost::hash_combine)
+		 */
+		template<typename T>
+		void hashCombine(size_t &seed, const T &value);
+	}
+}
+
+#include "image_cache.cpp"
+#endif //IMAGECACHE_H
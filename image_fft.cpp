@@ -0,0 +1,172 @@
+//
+// Created by Aleksey Timin on 4/12/20.
+//
+
+#include "image_fft.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace metric {
+	namespace image_processing_details {
+
+		FFT::FFT(size_t size) : _size(size), _twiddles(size), _buffer(size * 2) {
+			size_t n = size;
+			for (size_t radix : {4, 2, 3, 5}) {
+				while (n > 1 && n % radix == 0) {
+					_factors.push_back(radix);
+					n /= radix;
+				}
+			}
+
+			for (size_t radix = 7; n > 1; radix += 2) {
+				while (n % radix == 0) {
+					_factors.push_back(radix);
+					n /= radix;
+				}
+			}
+
+			for (size_t i = 0; i < size; ++i) {
+				_twiddles[i] = std::polar(1.0, -2 * M_PI * i / size);
+			}
+
+			// Buffer of the generic butterflies, so the transforms don't allocate
+			_scratch.resize(_factors.empty() ? 0 : *std::max_element(_factors.begin(), _factors.end()));
+		}
+
+		void FFT::forward(std::complex<double> *data, size_t stride) const {
+			if (_size <= 1) {
+				return;
+			}
+
+			auto in = _buffer.data();
+			auto out = _buffer.data() + _size;
+			for (size_t k = 0; k < _size; ++k) {
+				in[k] = data[k * stride];
+			}
+
+			transform(out, in, 1, 0);
+
+			for (size_t k = 0; k < _size; ++k) {
+				data[k * stride] = out[k];
+			}
+		}
+
+		void FFT::inverse(std::complex<double> *data, size_t stride) const {
+			for (size_t k = 0; k < _size; ++k) {
+				data[k * stride] = std::conj(data[k * stride]);
+			}
+
+			forward(data, stride);
+
+			double scale = 1.0 / _size;
+			for (size_t k = 0; k < _size; ++k) {
+				data[k * stride] = std::conj(data[k * stride]) * scale;
+			}
+		}
+
+		void FFT::transform(std::complex<double> *out, const std::complex<double> *in, size_t stride,
+							size_t factor) const {
+			size_t radix = _factors[factor];
+			size_t m = _size / stride / radix;
+
+			// Decimation in time: transform the radix interleaved subsequences
+			if (m == 1) {
+				for (size_t q = 0; q < radix; ++q) {
+					out[q] = in[q * stride];
+				}
+			} else {
+				for (size_t q = 0; q < radix; ++q) {
+					transform(out + q * m, in + q * stride, stride * radix, factor + 1);
+				}
+			}
+
+			// Butterflies
+			switch (radix) {
+				case 2:
+					for (size_t u = 0; u < m; ++u) {
+						auto t = out[u + m] * _twiddles[u * stride];
+						out[u + m] = out[u] - t;
+						out[u] += t;
+					}
+					break;
+
+				case 4:
+					for (size_t u = 0; u < m; ++u) {
+						auto s0 = out[u];
+						auto s1 = out[u + m] * _twiddles[u * stride];
+						auto s2 = out[u + 2 * m] * _twiddles[2 * u * stride];
+						auto s3 = out[u + 3 * m] * _twiddles[3 * u * stride];
+
+						auto a = s0 + s2;
+						auto b = s0 - s2;
+						auto c = s1 + s3;
+						auto d = s1 - s3;
+						// d * (-i)
+						std::complex<double> dj(d.imag(), -d.real());
+
+						out[u] = a + c;
+						out[u + m] = b + dj;
+						out[u + 2 * m] = a - c;
+						out[u + 3 * m] = b - dj;
+					}
+					break;
+
+				default: {
+					auto &scratch = _scratch;
+					for (size_t u = 0; u < m; ++u) {
+						for (size_t q = 0; q < radix; ++q) {
+							scratch[q] = out[q * m + u];
+						}
+
+						for (size_t q1 = 0; q1 < radix; ++q1) {
+							size_t k = q1 * m + u;
+							auto sum = scratch[0];
+							for (size_t q = 1; q < radix; ++q) {
+								sum += scratch[q] * _twiddles[(q * k * stride) % _size];
+							}
+
+							out[k] = sum;
+						}
+					}
+					break;
+				}
+			}
+		}
+
+		size_t FFT::goodSize(size_t n) {
+			for (size_t size = std::max<size_t>(n, 1);; ++size) {
+				size_t rest = size;
+				for (size_t radix : {2, 3, 5}) {
+					while (rest % radix == 0) {
+						rest /= radix;
+					}
+				}
+
+				if (rest == 1) {
+					return size;
+				}
+			}
+		}
+
+		void FFT2::forward(std::complex<double> *data) const {
+			for (size_t i = 0; i < rows(); ++i) {
+				_rowFFT.forward(data + i * columns());
+			}
+
+			for (size_t j = 0; j < columns(); ++j) {
+				_columnFFT.forward(data + j, columns());
+			}
+		}
+
+		void FFT2::inverse(std::complex<double> *data) const {
+			for (size_t i = 0; i < rows(); ++i) {
+				_rowFFT.inverse(data + i * columns());
+			}
+
+			for (size_t j = 0; j < columns(); ++j) {
+				_columnFFT.inverse(data + j, columns());
+			}
+		}
+	}
+}
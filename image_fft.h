@@ -0,0 +1,106 @@
+//
+// Created by Aleksey Timin on 4/12/20.
+//
+
+#ifndef IMAGEFFT_H
+#define IMAGEFFT_H
+
+#include <complex>
+#include <vector>
+
+namespace metric {
+	namespace image_processing_details {
+		/**
+		 * Mixed-radix (4, 2, 3, 5 and generic) Cooley-Tukey FFT of a fixed size
+		 *
+		 * Usage:
+		 *
+		 * FFT fft(FFT::goodSize(1000));
+		 * std::vector<std::complex<double>> data(fft.size());
+		 * fft.forward(data.data());
+		 * fft.inverse(data.data());
+		 */
+		class FFT {
+		public:
+			/**
+			 * Prepares the factors and twiddles of the transform
+			 * @param size length of the transform
+			 */
+			explicit FFT(size_t size);
+
+			size_t size() const {
+				return _size;
+			}
+
+			/**
+			 * Forward transform in place
+			 * @param data the sequence
+			 * @param stride distance between the elements of the sequence
+			 */
+			void forward(std::complex<double> *data, size_t stride = 1) const;
+
+			/**
+			 * Inverse transform in place, the result is scaled by 1/size
+			 * @param data the spectrum
+			 * @param stride distance between the elements of the spectrum
+			 */
+			void inverse(std::complex<double> *data, size_t stride = 1) const;
+
+			/**
+			 * Returns the smallest length >= n which has only 2, 3 and 5 as factors
+			 * @param n the min length
+			 * @return
+			 */
+			static size_t goodSize(size_t n);
+
+		private:
+			void transform(std::complex<double> *out, const std::complex<double> *in, size_t stride,
+						   size_t factor) const;
+
+			size_t _size;
+			std::vector<size_t> _factors;
+			std::vector<std::complex<double>> _twiddles;
+			mutable std::vector<std::complex<double>> _buffer;
+			mutable std::vector<std::complex<double>> _scratch;
+		};
+
+		/**
+		 * Two-dimensional FFT over a row-major complex matrix
+		 */
+		class FFT2 {
+		public:
+			/**
+			 * @param rows number of rows of the transform
+			 * @param columns number of columns of the transform
+			 */
+			FFT2(size_t rows, size_t columns) : _rowFFT(columns), _columnFFT(rows) {}
+
+			size_t rows() const {
+				return _columnFFT.size();
+			}
+
+			size_t columns() const {
+				return _rowFFT.size();
+			}
+
+			/**
+			 * Forward transform in place
+			 * @param data rows() * columns() elements in row-major order
+			 */
+			void forward(std::complex<double> *data) const;
+
+			/**
+			 * Inverse transform in place, the result is scaled by 1/(rows * columns)
+			 * @param data rows() * columns() elements in row-major order
+			 */
+			void inverse(std::complex<double> *data) const;
+
+		private:
+			FFT _rowFFT;
+			FFT _columnFFT;
+		};
+	}
+}
+
+#include "image_fft.cpp"
+#endif //IMAGEFFT_H
@@ -12,100 +12,212 @@ namespace metric {
 		return Image<T, N>(blaze::DynamicMatrix<T>(rows, columns, initValue));
 	}
 
+	template<typename T, size_t N>
+	InterleavedImage<T, N>::InterleavedImage(Channel<T> data) : _data(std::move(data)) {
+		if (_data.columns() % N != 0) {
+			throw std::invalid_argument("the number of columns must be a multiple of the number of channels");
+		}
+	}
+
+	template<typename T, size_t N>
+	InterleavedImage<T, N> interleave(const Image<T, N> &img) {
+		InterleavedImage<T, N> result(img[0].rows(), img[0].columns());
+		for (size_t i = 0; i < result.rows(); ++i) {
+			T *row = result.data(i);
+			for (size_t j = 0; j < result.columns(); ++j) {
+				for (size_t ch = 0; ch < N; ++ch) {
+					row[j * N + ch] = img[ch](i, j);
+				}
+			}
+		}
+
+		return result;
+	}
+
+	template<typename T, size_t N>
+	Image<T, N> deinterleave(const InterleavedImage<T, N> &img) {
+		auto result = iminit<T, N>(img.rows(), img.columns());
+		for (size_t i = 0; i < img.rows(); ++i) {
+			const T *row = img.data(i);
+			for (size_t j = 0; j < img.columns(); ++j) {
+				for (size_t ch = 0; ch < N; ++ch) {
+					result[ch](i, j) = row[j * N + ch];
+				}
+			}
+		}
+
+		return result;
+	}
+
 	template<typename T>
 	std::pair<blaze::DynamicMatrix<T>, Shape>
 	PadModel<T>::pad(const Shape &shape, const blaze::DynamicMatrix<T> &src) const {
-		using namespace blaze;
-		size_t padRow = shape[0];
-		size_t padCol = shape[1];
-
-		// Init padded matrix
-		DynamicMatrix<T> dst;
-		switch (_padDirection) {
-			case PadDirection::PRE:
-			case PadDirection::POST:
-				dst = blaze::DynamicMatrix<T>(src.rows() + padRow, src.columns() + padCol, _initValue);
-				break;
-			case PadDirection::BOTH:
-				dst = blaze::DynamicMatrix<T>(src.rows() + padRow * 2, src.columns() + padCol * 2, _initValue);
-				break;
-		}
-
-		// Fill the padded matrix
-		if (_padDirection == PadDirection::POST) {
-			padRow = 0;
-			padCol = 0;
-		}
-
-		blaze::submatrix(dst, padRow, padCol, src.rows(), src.columns()) = src;
-		// Padding
-		for (size_t i = 0; i<dst.rows(); ++i) {
-			for (size_t j = 0; j < dst.columns(); ++j) {
-				int si = i - padRow;
-				int sj = j - padCol;
+		auto rowMap = indexMap(shape[0], src.rows());
+		auto colMap = indexMap(shape[1], src.columns());
 
-				bool inside = si >= 0 && si < src.rows()
-							  && sj >= 0 && sj < src.columns();
-				if (inside) {
-					j += src.columns();    //work only in pad area
-				} else {
-					switch (_padType) {
-						case PadType::CONST:
-							break;
+		blaze::DynamicMatrix<T> dst(rowMap.size(), colMap.size());
+		for (size_t i = 0; i < dst.rows(); ++i) {
+			for (size_t j = 0; j < dst.columns(); ++j) {
+				bool filled = rowMap[i] < 0 || colMap[j] < 0;
+				dst(i, j) = filled ? _initValue : src(rowMap[i], colMap[j]);
+			}
+		}
 
-						case PadType::REPLICATE:
-							si = std::max<int>(0, si);
-							si = std::min<int>(src.rows() - 1, si);
+		return std::make_pair(dst, Shape{padBefore(shape[0]), padBefore(shape[1])});
+	}
 
-							sj = std::max<int>(0, sj);
-							sj = std::min<int>(src.columns() - 1, sj);
-							dst(i, j) = src(si, sj);
-							break;
+	template<typename T>
+	std::vector<long> PadModel<T>::indexMap(size_t padSize, size_t size) const {
+		long pad = padBefore(padSize);
+		long n = size;
+		std::vector<long> map(paddedSize(padSize, size));
+		for (long i = 0; i < static_cast<long>(map.size()); ++i) {
+			long si = i - pad;
+			bool inside = si >= 0 && si < n;
+			if (inside) {
+				map[i] = si;
+				continue;
+			}
 
-						case PadType::CIRCULAR:
-							si = (i + padRow + 1) % src.rows();
-							sj = (j + padCol + 1) % src.columns();
-							dst(i, j) = src(si, sj);
-							break;
+			switch (_padType) {
+				case PadType::CONST:
+					map[i] = -1;
+					break;
 
-						case PadType::SYMMETRIC: {
-							int distX = padRow - i;
-							int distY = padCol - j;
+				case PadType::REPLICATE:
+					map[i] = std::min<long>(n - 1, std::max<long>(0, si));
+					break;
 
-							int xN = std::ceil((float) distX / src.rows());
-							int yN = std::ceil((float) distY / src.columns());
-							int cordMx = padRow - xN * src.rows();
-							int cordMy = padCol - yN * src.columns();
-							int xi = (i - cordMx) % src.rows();
-							int xj = (j - cordMy) % src.columns();
+				case PadType::CIRCULAR:
+					map[i] = ((si % n) + n) % n;
+					break;
 
-							si = xN % 2 == 0 ? xi : src.rows() - xi - 1;
-							sj = yN % 2 == 0 ? xj : src.columns() - xj - 1;
-							dst(i, j) = src(si, sj);
-							break;
-						}
-					}
+				case PadType::SYMMETRIC: {
+					long dist = pad - i;
+					long xN = std::ceil((float) dist / n);
+					long cord = pad - xN * n;
+					long xi = (i - cord) % n;
+					map[i] = xN % 2 == 0 ? xi : n - xi - 1;
+					break;
 				}
 			}
 		}
 
-		return std::make_pair(dst, Shape{padRow, padCol});
+		return map;
+	}
+
+	StructuringElement::StructuringElement(size_t rows, size_t columns, int diagonal)
+			: _rows(rows), _columns(columns), _diagonal(diagonal) {
+		if (rows == 0 || columns == 0) {
+			throw std::invalid_argument("a structuring element must have pixels");
+		}
+	}
+
+	StructuringElement StructuringElement::rectangle(size_t rows, size_t columns) {
+		return StructuringElement(rows, columns, 0);
+	}
+
+	StructuringElement StructuringElement::line(size_t length, double angle) {
+		double turns = angle / 45;
+		if (std::abs(turns - std::round(turns)) > 1e-9) {
+			throw std::invalid_argument("the angle of a line element must be a multiple of 45 degrees");
+		}
+
+		// 0: horizontal, 1: 45 degrees (up to the right), 2: vertical, 3: 135 degrees (up to the left)
+		long direction = ((std::lround(turns) % 4) + 4) % 4;
+		if (direction == 0) {
+			return StructuringElement(1, length, 0);
+		}
+
+		if (direction == 2) {
+			return StructuringElement(length, 1, 0);
+		}
+
+		return StructuringElement(length, length, direction == 1 ? -1 : 1);
+	}
+
+	FilterKernel StructuringElement::mask() const {
+		if (_diagonal == 0) {
+			return FilterKernel(_rows, _columns, 1.0);
+		}
+
+		FilterKernel mask(_rows, _columns, 0.0);
+		for (size_t i = 0; i < _rows; ++i) {
+			mask(i, _diagonal > 0 ? i : _columns - 1 - i) = 1;
+		}
+
+		return mask;
 	}
 
 //	template <typename ImgT, typename Filter, PadDirection PadDir, PadType PadType>
 //	ImgT imfilter<ImgT, Filter, PadDir, PadType>::operator()(const ImgT& input) {
 //		return ::metric::image_processing_details::filter(input, _filter, _padModel);
 //	}
-	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType>
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
 	Channel<ChannelType>
-	imfilter<ChannelType, N, Filter, PadDir, PadType>::operator()(const Channel<ChannelType>& input) {
-		return ::metric::image_processing_details::filter(input, _filter, _padModel);
+	imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const Channel<ChannelType>& input) {
+		return ::metric::image_processing_details::filter(input, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const Channel<ChannelType>& input, Channel<ChannelType>& output) {
+		::metric::image_processing_details::filter(input, output, _filter, _padModel, _shape, _settings, &_workspace);
 	}
 
-	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType>
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
 	Image<ChannelType, N>
-	imfilter<ChannelType, N, Filter, PadDir, PadType>::operator()(const Image<ChannelType, N>& input) {
-		return ::metric::image_processing_details::filter(input, _filter, _padModel);
+	imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const Image<ChannelType, N>& input) {
+		return ::metric::image_processing_details::filter(input, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const Image<ChannelType, N>& input, Image<ChannelType, N>& output) {
+		::metric::image_processing_details::filter(input, output, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	InterleavedImage<ChannelType, N>
+	imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const InterleavedImage<ChannelType, N>& input) {
+		return ::metric::image_processing_details::filter(input, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const InterleavedImage<ChannelType, N>& input, InterleavedImage<ChannelType, N>& output) {
+		::metric::image_processing_details::filter(input, output, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const ImageView<const ChannelType>& input,
+																					const ImageView<ChannelType>& output) {
+		::metric::image_processing_details::filter(input, output, _filter, _padModel, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const std::vector<Channel<ChannelType>>& inputs,
+																					std::vector<Channel<ChannelType>>& outputs) {
+		::metric::image_processing_details::filter(inputs, outputs, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(const std::vector<Image<ChannelType, N>>& inputs,
+																					std::vector<Image<ChannelType, N>>& outputs) {
+		::metric::image_processing_details::filter(inputs, outputs, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::operator()(
+			const std::vector<InterleavedImage<ChannelType, N>>& inputs,
+			std::vector<InterleavedImage<ChannelType, N>>& outputs) {
+		::metric::image_processing_details::filter(inputs, outputs, _filter, _padModel, _shape, _settings, &_workspace);
+	}
+
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType, typename Accumulator>
+	void imfilter<ChannelType, N, Filter, PadDir, PadType, Accumulator>::stream(size_t rows, size_t columns,
+																				const RowReader<ChannelType>& reader,
+																				const RowWriter<ChannelType>& writer,
+																				size_t bandRows, FilterShape shape) {
+		::metric::image_processing_details::filterStream(rows, columns, N, reader, writer, _filter, _padModel,
+														 bandRows, shape, _settings, &_workspace);
 	}
 
 	FilterType::AVERAGE::AVERAGE(size_t rows, size_t columns) {
@@ -113,26 +225,43 @@ namespace metric {
 		_kernel = f / blaze::prod(Shape{rows, columns});
 	}
 
-	FilterType::GAUSSIAN::GAUSSIAN(size_t rows, size_t columns, double sigma) {
+	std::pair<FilterKernel, FilterKernel> FilterType::GAUSSIAN::grid(size_t rows, size_t columns) {
 		Shape shape{rows, columns};
 		auto halfShape =
 				(static_cast<blaze::StaticVector<FilterKernel::ElementType, 2>>(shape) - 1) / 2;
 
 		auto xrange = range<FilterKernel::ElementType, blaze::rowVector>(-halfShape[1], halfShape[1]);
 		auto yrange = range<FilterKernel::ElementType, blaze::columnVector>(-halfShape[0], halfShape[0]);
-		auto[xMat, yMat] = meshgrid(xrange, yrange);
+		return meshgrid(xrange, yrange);
+	}
+
+	FilterType::GAUSSIAN::GAUSSIAN(size_t rows, size_t columns, double sigma) {
+		image_processing_details::KernelKey key{"GAUSSIAN", {double(rows), double(columns), sigma}};
+		_kernel = image_processing_details::kernelCache().get(key, [&] {
+			auto[xMat, yMat] = grid(rows, columns);
+
+			auto arg = -(xMat % xMat + yMat % yMat) / (2 * sigma * sigma);
+			FilterKernel kernel = blaze::exp(arg);
 
-		auto arg = -(xMat % xMat + yMat % yMat) / (2 * sigma * sigma);
-		_kernel = blaze::exp(arg);
+			auto sumh = blaze::sum(kernel);
+			if (sumh != 0) {
+				kernel = kernel / sumh;
+
+			}
 
-		auto sumh = blaze::sum(_kernel);
-		if (sumh != 0) {
-			_kernel = _kernel / sumh;
+			return kernel;
+		});
+	}
 
+	FilterType::RECURSIVE_GAUSSIAN::RECURSIVE_GAUSSIAN(double sigma) : _sigma(sigma) {
+		if (!(sigma >= 0.5)) {
+			throw std::invalid_argument("the sigma of the recursive Gaussian must be at least 0.5");
 		}
+	}
 
-		_xMat = xMat;
-		_yMat = yMat;
+	FilterKernel FilterType::RECURSIVE_GAUSSIAN::operator()() const {
+		auto size = static_cast<size_t>(2 * std::ceil(3 * _sigma) + 1);
+		return GAUSSIAN(size, size, _sigma)();
 	}
 
 	FilterType::LAPLACIAN::LAPLACIAN(double alpha) {
@@ -147,69 +276,77 @@ namespace metric {
 	}
 
 	FilterType::LOG::LOG(size_t rows, size_t columns, double sigma) {
-		Shape shape{rows, columns};
-		auto std2 = sigma * sigma;
-		GAUSSIAN gausFilter(rows, columns, sigma);
+		image_processing_details::KernelKey key{"LOG", {double(rows), double(columns), sigma}};
+		_kernel = image_processing_details::kernelCache().get(key, [&] {
+			Shape shape{rows, columns};
+			auto std2 = sigma * sigma;
+			auto[xMat, yMat] = GAUSSIAN::grid(rows, columns);
 
-		auto h = gausFilter();
-		_kernel = h % (gausFilter._xMat % gausFilter._xMat + gausFilter._yMat % gausFilter._yMat - 2 * std2)
-				  / (std2 * std2);
-		_kernel -= blaze::sum(_kernel) / blaze::prod(shape);
+			auto h = GAUSSIAN(rows, columns, sigma)();
+			FilterKernel kernel = h % (xMat % xMat + yMat % yMat - 2 * std2) / (std2 * std2);
+			kernel -= blaze::sum(kernel) / blaze::prod(shape);
+			return kernel;
+		});
 	}
 
 	FilterType::MOTION::MOTION(double len, int theta) {
 		len = std::max<double>(1, len);
-		auto half = (len - 1) / 2;
-		auto phi = static_cast<double>(theta % 180) / 180 * M_PI;
+		image_processing_details::KernelKey key{"MOTION", {len, double(theta)}};
+		_kernel = image_processing_details::kernelCache().get(key, [&] {
+			auto half = (len - 1) / 2;
+			auto phi = static_cast<double>(theta % 180) / 180 * M_PI;
 
 
-		double cosphi = std::cos(phi);
-		double sinphi = std::sin(phi);
-		int xsign = cosphi > 0 ? 1 : -1;
-		double linewdt = 1;
+			double cosphi = std::cos(phi);
+			double sinphi = std::sin(phi);
+			int xsign = cosphi > 0 ? 1 : -1;
+			double linewdt = 1;
 
-		auto eps = std::numeric_limits<double>::epsilon();
-		auto sx = std::trunc(half * cosphi + linewdt * xsign - len * eps);
-		auto sy = std::trunc(half * sinphi + linewdt - len * eps);
+			auto eps = std::numeric_limits<double>::epsilon();
+			auto sx = std::trunc(half * cosphi + linewdt * xsign - len * eps);
+			auto sy = std::trunc(half * sinphi + linewdt - len * eps);
 
-		auto xrange =
-				range<FilterKernel::ElementType, blaze::rowVector>(0, sx, xsign);
-		auto yrange = range<FilterKernel::ElementType, blaze::columnVector>(0, sy);
-		auto[xMat, yMat] = meshgrid(xrange, yrange);
+			auto xrange =
+					range<FilterKernel::ElementType, blaze::rowVector>(0, sx, xsign);
+			auto yrange = range<FilterKernel::ElementType, blaze::columnVector>(0, sy);
+			auto[xMat, yMat] = meshgrid(xrange, yrange);
 
-		FilterKernel dist2line = (yMat * cosphi - xMat * sinphi);
-		auto rad = blaze::sqrt(xMat % xMat + yMat % yMat);
+			FilterKernel dist2line = (yMat * cosphi - xMat * sinphi);
+			auto rad = blaze::sqrt(xMat % xMat + yMat % yMat);
 
-		// find points beyond the line's end-point but within the line width
-		blaze::DynamicMatrix<bool> cond = blaze::map(rad, [half](const auto &x) { return x >= half; })
-										  && blaze::map(abs(dist2line),
-														[linewdt](const auto &x) { return x <= linewdt; });
+			// find points beyond the line's end-point but within the line width
+			blaze::DynamicMatrix<bool> cond = blaze::map(rad, [half](const auto &x) { return x >= half; })
+											  && blaze::map(abs(dist2line),
+															[linewdt](const auto &x) { return x <= linewdt; });
 
-		auto lastpix = mfind(static_cast<FilterKernel>(dist2line), cond);
+			auto lastpix = mfind(static_cast<FilterKernel>(dist2line), cond);
 
-		for (auto[i, j] : lastpix) {
-			auto v = dist2line(i, j);
-			auto pix = half - abs((xMat(i, j) + v * sinphi) / cosphi);
-			dist2line(i, j) = std::sqrt(v * v + pix * pix);
-		}
+			for (auto[i, j] : lastpix) {
+				auto v = dist2line(i, j);
+				auto pix = half - abs((xMat(i, j) + v * sinphi) / cosphi);
+				dist2line(i, j) = std::sqrt(v * v + pix * pix);
+			}
 
-		dist2line = linewdt + eps - abs(dist2line);
-		// zero out anything beyond line width
-		dist2line = blaze::map(dist2line, [](const FilterKernel::ElementType &v) {
-			return v < 0 ? 0 : v;
-		});
+			dist2line = linewdt + eps - abs(dist2line);
+			// zero out anything beyond line width
+			dist2line = blaze::map(dist2line, [](const FilterKernel::ElementType &v) {
+				return v < 0 ? 0 : v;
+			});
 
-		auto h = rot90(rot90<FilterKernel::ElementType>(dist2line));
+			auto h = rot90(rot90<FilterKernel::ElementType>(dist2line));
 
-		_kernel = FilterKernel(h.rows() * 2 - 1, h.columns() * 2 - 1);
-		blaze::submatrix(_kernel, 0, 0, h.rows(), h.columns()) = h;
-		blaze::submatrix(_kernel,
-						 h.rows() - 1, h.columns() - 1, dist2line.rows(), dist2line.columns()) = dist2line;
+			FilterKernel kernel(h.rows() * 2 - 1, h.columns() * 2 - 1);
+			blaze::submatrix(kernel, 0, 0, h.rows(), h.columns()) = h;
+			blaze::submatrix(kernel,
+							 h.rows() - 1, h.columns() - 1, dist2line.rows(), dist2line.columns()) = dist2line;
 
-		_kernel /= blaze::sum(_kernel) + eps * len * len;
-		if (cosphi > 0) {
-			_kernel = flipud(_kernel);
-		}
+			kernel /= blaze::sum(kernel) + eps * len * len;
+			if (cosphi > 0) {
+				kernel = flipud(kernel);
+			}
+
+			return kernel;
+		});
 	}
 
 	FilterType::UNSHARP::UNSHARP(double alpha) {
@@ -220,6 +357,84 @@ namespace metric {
 		} - LAPLACIAN(alpha)();
 	}
 
+	FilterType::RANK::RANK(size_t rows, size_t columns, size_t rank) : _rows(rows), _columns(columns), _rank(rank) {
+		if (rows == 0 || columns == 0) {
+			throw std::invalid_argument("the window of a rank filter must have elements");
+		}
+
+		if (rank >= rows * columns) {
+			throw std::invalid_argument("the rank must be less than the number of elements of the window");
+		}
+	}
+
+	FilterType::MEDIAN::MEDIAN(size_t rows, size_t columns) : RANK(rows, columns, (rows * columns - 1) / 2) {}
+
+	FilterType::PERCENTILE::PERCENTILE(size_t rows, size_t columns, double percent)
+			: RANK(rows, columns, std::lround(std::max(0.0, std::min(percent, 100.0)) / 100 * (rows * columns - 1))) {}
+
+	FilterType::MORPHOLOGY::MORPHOLOGY(const StructuringElement &element, MorphologyOperation operation)
+			: _element(element), _operation(operation) {}
+
+	FilterKernel FilterType::MORPHOLOGY::operator()() const {
+		if (_operation == MorphologyOperation::ERODE || _operation == MorphologyOperation::DILATE) {
+			return _element.mask();
+		}
+
+		// The window of the opening and the closing is the element dilated by itself
+		if (_element.diagonal() == 0) {
+			return FilterKernel(2 * _element.rows() - 1, 2 * _element.columns() - 1, 1.0);
+		}
+
+		return StructuringElement::line(2 * _element.rows() - 1, _element.diagonal() > 0 ? 135 : 45).mask();
+	}
+
+	FilterType::ERODE::ERODE(size_t rows, size_t columns)
+			: MORPHOLOGY(StructuringElement::rectangle(rows, columns), MorphologyOperation::ERODE) {}
+
+	FilterType::ERODE::ERODE(const StructuringElement &element) : MORPHOLOGY(element, MorphologyOperation::ERODE) {}
+
+	FilterType::DILATE::DILATE(size_t rows, size_t columns)
+			: MORPHOLOGY(StructuringElement::rectangle(rows, columns), MorphologyOperation::DILATE) {}
+
+	FilterType::DILATE::DILATE(const StructuringElement &element) : MORPHOLOGY(element, MorphologyOperation::DILATE) {}
+
+	FilterType::OPEN::OPEN(size_t rows, size_t columns)
+			: MORPHOLOGY(StructuringElement::rectangle(rows, columns), MorphologyOperation::OPEN) {}
+
+	FilterType::OPEN::OPEN(const StructuringElement &element) : MORPHOLOGY(element, MorphologyOperation::OPEN) {}
+
+	FilterType::CLOSE::CLOSE(size_t rows, size_t columns)
+			: MORPHOLOGY(StructuringElement::rectangle(rows, columns), MorphologyOperation::CLOSE) {}
+
+	FilterType::CLOSE::CLOSE(const StructuringElement &element) : MORPHOLOGY(element, MorphologyOperation::CLOSE) {}
+
+	FilterType::BILATERAL::BILATERAL(double spatialSigma, double rangeSigma)
+			: _spatialSigma(spatialSigma), _rangeSigma(rangeSigma) {
+		if (!(spatialSigma > 0) || !(rangeSigma > 0)) {
+			throw std::invalid_argument("the sigmas of the bilateral filter must be positive");
+		}
+	}
+
+	FilterKernel FilterType::BILATERAL::operator()() const {
+		auto size = static_cast<size_t>(2 * std::ceil(2 * _spatialSigma) + 1);
+		return GAUSSIAN(size, size, _spatialSigma)();
+	}
+
+	template<typename ...Filters>
+	FilterType::CHAIN::CHAIN(const Filters &...filters) {
+		static_assert(sizeof...(Filters) > 0, "a chain needs at least one filter");
+		(add(filters), ...);
+
+		_kernel = _stages[0];
+		for (size_t i = 1; i < _stages.size(); ++i) {
+			_kernel = image_processing_details::mergeKernels(_kernel, _stages[i]);
+		}
+	}
+
+	void FilterType::CHAIN::add(const CHAIN &chain) {
+		_stages.insert(_stages.end(), chain._stages.begin(), chain._stages.end());
+	}
+
 	namespace image_processing_details {
 
 		template<typename T>
@@ -278,69 +493,2881 @@ namespace metric {
 			return out;
 		}
 
-		blaze::DynamicMatrix<double> imgcov2(const blaze::DynamicMatrix<double> &input, const FilterKernel &kernel) {
-			size_t funcRows = kernel.rows();
-			size_t funcCols = kernel.columns();
+		template<typename T>
+		blaze::DynamicMatrix<T> rot180(const blaze::DynamicMatrix<T> &input) {
+			blaze::DynamicMatrix<T> out(input.rows(), input.columns());
+			for (size_t i = 0; i < input.rows(); ++i) {
+				for (size_t j = 0; j < input.columns(); ++j) {
+					out(input.rows() - i - 1, input.columns() - j - 1) = input(i, j);
+				}
+			}
 
-			blaze::DynamicMatrix<double> resultMat(input.rows() - std::ceil((double) funcRows / 2),
-												   input.columns() - std::ceil((double) funcCols / 2));
-			for (auto i = 0; i < input.rows() - funcRows; ++i) {
-				for (auto j = 0; j < input.columns() - funcCols; ++j) {
-					auto bwProd = blaze::submatrix(input, i, j, funcRows, funcCols) % kernel;
-					auto filteredVal = blaze::sum(bwProd);
-					double val = blaze::round(filteredVal);
-					resultMat(i, j) = val > 0 ? val : 0;
+			return out;
+		}
+
+		SeparableKernel separate(const FilterKernel &kernel, double tolerance) {
+			size_t rows = kernel.rows();
+			size_t cols = kernel.columns();
+
+			// One-sided Jacobi: orthogonalize the columns of U, V accumulates the rotations
+			FilterKernel u = kernel;
+			FilterKernel v(cols, cols, 0.0);
+			for (size_t j = 0; j < cols; ++j) {
+				v(j, j) = 1;
+			}
+
+			const auto eps = std::numeric_limits<double>::epsilon();
+			for (int sweep = 0; sweep < 60; ++sweep) {
+				bool rotated = false;
+				for (size_t p = 0; p + 1 < cols; ++p) {
+					for (size_t q = p + 1; q < cols; ++q) {
+						double alpha = 0, beta = 0, gamma = 0;
+						for (size_t k = 0; k < rows; ++k) {
+							alpha += u(k, p) * u(k, p);
+							beta += u(k, q) * u(k, q);
+							gamma += u(k, p) * u(k, q);
+						}
+
+						if (std::abs(gamma) <= eps * std::sqrt(alpha * beta)) {
+							continue;
+						}
+
+						rotated = true;
+						double zeta = (beta - alpha) / (2 * gamma);
+						double t = (zeta >= 0 ? 1 : -1) / (std::abs(zeta) + std::sqrt(1 + zeta * zeta));
+						double c = 1 / std::sqrt(1 + t * t);
+						double s = c * t;
+						for (size_t k = 0; k < rows; ++k) {
+							double up = u(k, p);
+							double uq = u(k, q);
+							u(k, p) = c * up - s * uq;
+							u(k, q) = s * up + c * uq;
+						}
+
+						for (size_t k = 0; k < cols; ++k) {
+							double vp = v(k, p);
+							double vq = v(k, q);
+							v(k, p) = c * vp - s * vq;
+							v(k, q) = s * vp + c * vq;
+						}
+					}
+				}
+
+				if (!rotated) {
+					break;
 				}
 			}
 
-			return resultMat;
+			// Singular values are the norms of the columns
+			std::vector<std::pair<double, size_t>> sigma(cols);
+			double energy = 0;
+			for (size_t j = 0; j < cols; ++j) {
+				double norm = 0;
+				for (size_t k = 0; k < rows; ++k) {
+					norm += u(k, j) * u(k, j);
+				}
+
+				energy += norm;
+				sigma[j] = std::make_pair(std::sqrt(norm), j);
+			}
+
+			std::sort(sigma.begin(), sigma.end(), std::greater<>());
+
+			// Take the lowest rank whose residual satisfies the tolerance
+			SeparableKernel result;
+			double residual = energy;
+			for (auto[value, j] : sigma) {
+				if (residual <= tolerance * tolerance * energy || value == 0) {
+					break;
+				}
+
+				auto scale = std::sqrt(value);
+				blaze::DynamicVector<double, blaze::columnVector> column(rows);
+				blaze::DynamicVector<double, blaze::rowVector> row(cols);
+				for (size_t k = 0; k < rows; ++k) {
+					column[k] = u(k, j) / value * scale;
+				}
+
+				for (size_t k = 0; k < cols; ++k) {
+					row[k] = v(k, j) * scale;
+				}
+
+				result.columns.push_back(std::move(column));
+				result.rows.push_back(std::move(row));
+				residual -= value * value;
+			}
+
+			result.error = energy > 0 ? std::sqrt(std::max<double>(0, residual) / energy) : 0;
+
+			// The SVD factors of a rank-1 kernel (AVERAGE, GAUSSIAN, SOBEL...) carry rounding errors of the rotations,
+			// so split it by the largest element instead which keeps the coefficients of the kernel
+			if (result.rank() == 1) {
+				size_t pr = 0;
+				size_t pc = 0;
+				for (size_t i = 0; i < rows; ++i) {
+					for (size_t j = 0; j < cols; ++j) {
+						if (std::abs(kernel(i, j)) > std::abs(kernel(pr, pc))) {
+							pr = i;
+							pc = j;
+						}
+					}
+				}
+
+				double pivotError = 0;
+				for (size_t i = 0; i < rows; ++i) {
+					for (size_t j = 0; j < cols; ++j) {
+						double diff = kernel(i, j) - kernel(i, pc) * kernel(pr, j) / kernel(pr, pc);
+						pivotError += diff * diff;
+					}
+				}
+
+				if (pivotError <= residual || pivotError <= tolerance * tolerance * energy) {
+					for (size_t i = 0; i < rows; ++i) {
+						result.columns[0][i] = kernel(i, pc);
+					}
+
+					for (size_t j = 0; j < cols; ++j) {
+						result.rows[0][j] = kernel(pr, j) / kernel(pr, pc);
+					}
+
+					result.error = std::sqrt(pivotError / energy);
+				}
+			}
+
+			return result;
 		}
 
+		bool isBox(const FilterKernel &kernel) {
+			if (kernel.rows() == 0 || kernel.columns() == 0 || kernel(0, 0) == 0) {
+				return false;
+			}
 
-		template<typename Filter, typename ChannelType>
-		Channel <ChannelType>
-		filter(const Channel <ChannelType> &channel, const Filter &impl,
-				 const PadModel <ChannelType> &padmodel, bool full) {
-			auto kernel = impl();
-			Channel<ChannelType> result;
-			Shape padShape{kernel.rows() - 1, kernel.columns() - 1};
-			auto[paddedCh, imgCord] = padmodel.pad(padShape, channel);
-			auto filteredChannel = imgcov2(paddedCh, kernel);
-			if (full) {
-				result = filteredChannel;
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					if (kernel(i, j) != kernel(0, 0)) {
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * Returns the number of threads of the settings
+		 */
+		size_t threadCount(const ConvolutionSettings &settings) {
+			return settings.threads == 0 ? ThreadPool::hardwareThreads() : settings.threads;
+		}
+
+		/**
+		 * Runs task(0), ..., task(count - 1) on the thread pool of the settings
+		 */
+		template<typename Task>
+		void forEachTask(size_t count, const ConvolutionSettings &settings, Task task) {
+			size_t threads = threadCount(settings);
+			if (threads <= 1 || count <= 1) {
+				for (size_t t = 0; t < count; ++t) {
+					task(t);
+				}
 			} else {
-				result = blaze::submatrix(filteredChannel,
-										  std::max<size_t>(0, imgCord[0] - 1),
-										  std::max<size_t>(0, imgCord[1] - 1),
-										  channel.rows(),
-										  channel.columns());
+				// A reference fits the small buffer of std::function, so it doesn't allocate
+				ThreadPool::shared(threads).run(count, std::ref(task));
 			}
+		}
 
-			return result;
+		/**
+		 * Splits rows x cols into tiles and runs task(rowBegin, rowEnd, colBegin, colEnd)
+		 * for each of them on the thread pool of the settings
+		 */
+		template<typename Task>
+		void forEachTile(size_t rows, size_t cols, size_t tileRows, size_t tileCols,
+						 const ConvolutionSettings &settings, Task task) {
+			tileRows = std::max<size_t>(1, tileRows);
+			tileCols = std::max<size_t>(1, tileCols);
+			size_t rowTiles = (rows + tileRows - 1) / tileRows;
+			size_t colTiles = (cols + tileCols - 1) / tileCols;
+
+			forEachTask(rowTiles * colTiles, settings, [&](size_t t) {
+				size_t r = t / colTiles;
+				size_t c = t % colTiles;
+				task(r * tileRows, std::min(rows, (r + 1) * tileRows), c * tileCols, std::min(cols, (c + 1) * tileCols));
+			});
 		}
 
-		template<typename Filter, typename ChannelType, size_t ChannelNumber>
-		Image <ChannelType, ChannelNumber>
-		filter(const Image <ChannelType, ChannelNumber> &img, const Filter &impl,
-				 const PadModel <ChannelType> &padmodel, bool full) {
-			auto kernel = impl();
-			Shape padShape{kernel.rows() - 1, kernel.columns() - 1};
-			Image<ChannelType, ChannelNumber> result;
-			for (size_t ch = 0; ch < img.size(); ++ch) {
-				auto[paddedCh, imgCord] = padmodel.pad(padShape, img[ch]);
-				auto filteredChannel = imgcov2(paddedCh, kernel);
-				if (full) {
-					result[ch] = filteredChannel;
-				} else {
-					result[ch] = blaze::submatrix(filteredChannel,
-												  std::max<size_t>(0, imgCord[0] - 1),
-												  std::max<size_t>(0, imgCord[1] - 1),
-												  img[ch].rows(),
-												  img[ch].columns());
+		/**
+		 * Returns the taps of the spread kernel of a plan in the type of the sums
+		 */
+		template<typename T>
+		const std::vector<BasicKernelTap<T>> &planTaps(const ConvolutionPlan &plan) {
+			if constexpr (std::is_same<T, float>::value) {
+				return plan.floatTaps;
+			} else {
+				return plan.taps;
+			}
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the correlation
+		 * by the full 2D multiply-accumulate, tile by tile with the SIMD row kernels
+		 * @tparam T float or double, the type of the sums
+		 */
+		template<typename T>
+		void correlateDirect(const blaze::DynamicMatrix<T> &input, const std::vector<BasicKernelTap<T>> &taps,
+							 size_t funcRows, blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+							 const ConvolutionSettings &settings) {
+			forEachTile(rows, cols, settings.tileRows, settings.tileColumns, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+				thread_local std::vector<const T *> inputRows;
+				inputRows.resize(funcRows);
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t a = 0; a < funcRows; ++a) {
+						inputRows[a] = input.data(i + a) + colBegin;
+					}
+
+					correlateRow(inputRows.data(), taps, resultMat.data(i) + colBegin, colEnd - colBegin);
+				}
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the correlation
+		 * as a sum of 1D row passes followed by 1D column passes, band by band of output rows
+		 * @param stride distance between the columns of the kernel in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void correlateSeparable(const blaze::DynamicMatrix<T> &input, const SeparableKernel &kernel,
+								blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+								const ConvolutionSettings &settings, size_t stride = 1) {
+			size_t funcRows = kernel.columns.front().size();
+			size_t funcCols = kernel.rows.front().size();
+
+			forEachTile(rows, cols, settings.tileRows, cols, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t, size_t) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t j = 0; j < cols; ++j) {
+						resultMat(i, j) = 0;
+					}
+				}
+
+				// Scratch of the thread, it keeps its capacity between calls
+				thread_local std::vector<T> rowPass;
+				rowPass.resize((rowEnd - rowBegin + funcRows - 1) * cols);
+				for (size_t k = 0; k < kernel.rank(); ++k) {
+					const auto &row = kernel.rows[k];
+					const auto &column = kernel.columns[k];
+
+					for (size_t i = 0; i < rowEnd - rowBegin + funcRows - 1; ++i) {
+						for (size_t j = 0; j < cols; ++j) {
+							T val = 0;
+							for (size_t b = 0; b < funcCols; ++b) {
+								val += static_cast<T>(row[b]) * input(rowBegin + i, j + b * stride);
+							}
+
+							rowPass[i * cols + j] = val;
+						}
+					}
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t a = 0; a < funcRows; ++a) {
+							T weight = static_cast<T>(column[a]);
+							for (size_t j = 0; j < cols; ++j) {
+								resultMat(i, j) += weight * rowPass[(i - rowBegin + a) * cols + j];
+							}
+						}
+					}
+				}
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the correlation with a box kernel
+		 * by running sums: the cost of a pixel doesn't depend on the size of the kernel.
+		 * Each band of output rows starts its own sums.
+		 * @param stride distance between the columns of the kernel in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void correlateBox(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+						  blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+						  const ConvolutionSettings &settings, size_t stride = 1) {
+			size_t funcRows = kernel.rows();
+			size_t funcCols = kernel.columns();
+			T area = funcRows * funcCols;
+			// for AVERAGE value * area == 1, so the window sum is divided exactly
+			T scale = static_cast<T>(kernel(0, 0) * area);
+
+			forEachTile(rows, cols, settings.tileRows, cols, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t, size_t) {
+				// Sums of funcRows elements of each column, slide down with the output row
+				thread_local std::vector<T> colSums;
+				thread_local std::vector<T> windowSums;
+				colSums.assign(cols + (funcCols - 1) * stride, T(0));
+				windowSums.resize(stride);
+				for (size_t a = 0; a < funcRows; ++a) {
+					for (size_t j = 0; j < colSums.size(); ++j) {
+						colSums[j] += input(rowBegin + a, j);
+					}
+				}
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					if (i > rowBegin) {
+						for (size_t j = 0; j < colSums.size(); ++j) {
+							colSums[j] += input(i + funcRows - 1, j) - input(i - 1, j);
+						}
+					}
+
+					// Each channel of an interleaved input slides its own window sum
+					for (size_t j = 0; j < std::min(stride, cols); ++j) {
+						windowSums[j] = 0;
+						for (size_t b = 0; b < funcCols; ++b) {
+							windowSums[j] += colSums[j + b * stride];
+						}
+
+						resultMat(i, j) = windowSums[j] * scale / area;
+					}
+
+					for (size_t j = stride; j < cols; ++j) {
+						T &windowSum = windowSums[j % stride];
+						windowSum += colSums[j + (funcCols - 1) * stride] - colSums[j - stride];
+						resultMat(i, j) = windowSum * scale / area;
+					}
+				}
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the correlation in the frequency domain.
+		 * The padded input and the kernel are transformed together as the real and imaginary parts
+		 * of one complex matrix, the transform is not smaller than the input, so the circular
+		 * correlation equals the linear one in the computed part. The transform is in double for any T.
+		 * @param workspace the transform and the spectrum, they're reused if the size is the same
+		 */
+		template<typename T>
+		void correlateFFT(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+						  blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+						  FFTWorkspace &workspace) {
+			size_t fftRows = FFT::goodSize(input.rows());
+			size_t fftCols = FFT::goodSize(input.columns());
+			if (!workspace.fft || workspace.fft->rows() != fftRows || workspace.fft->columns() != fftCols) {
+				workspace.fft = std::make_unique<FFT2>(fftRows, fftCols);
+			}
+
+			const auto &fft = *workspace.fft;
+			auto &spectrum = workspace.spectrum;
+			spectrum.assign(fftRows * fftCols, 0);
+			for (size_t i = 0; i < input.rows(); ++i) {
+				for (size_t j = 0; j < input.columns(); ++j) {
+					spectrum[i * fftCols + j] = input(i, j);
 				}
 			}
 
-			return result;
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					spectrum[i * fftCols + j].imag(kernel(i, j));
+				}
+			}
+
+			fft.forward(spectrum.data());
+
+			// Split the spectrums: X = (Z(f) + conj(Z(-f))) / 2, K = (Z(f) - conj(Z(-f))) / 2i,
+			// then correlation is X * conj(K). The pairs (f, -f) are updated together.
+			for (size_t u = 0; u < fftRows; ++u) {
+				size_t nu = (fftRows - u) % fftRows;
+				for (size_t v = 0; v < fftCols; ++v) {
+					size_t nv = (fftCols - v) % fftCols;
+					size_t idx = u * fftCols + v;
+					size_t nidx = nu * fftCols + nv;
+					if (nidx < idx) {
+						continue;
+					}
+
+					auto z = spectrum[idx];
+					auto nz = std::conj(spectrum[nidx]);
+					auto x = (z + nz) * 0.5;
+					auto k = (z - nz) * std::complex<double>(0, -0.5);
+					spectrum[idx] = x * std::conj(k);
+					// X(-f) = conj(X(f)) and K(-f) = conj(K(f)) for real input
+					spectrum[nidx] = std::conj(spectrum[idx]);
+				}
+			}
+
+			fft.inverse(spectrum.data());
+
+			for (size_t i = 0; i < rows; ++i) {
+				for (size_t j = 0; j < cols; ++j) {
+					resultMat(i, j) = static_cast<T>(spectrum[i * fftCols + j].real());
+				}
+			}
+		}
+
+		/**
+		 * Rounds the result of a correlation and clamps negative values to 0
+		 */
+		template<typename T>
+		void roundAndClamp(blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols) {
+			for (size_t i = 0; i < rows; ++i) {
+				for (size_t j = 0; j < cols; ++j) {
+					T val = blaze::round(resultMat(i, j));
+					resultMat(i, j) = val > 0 ? val : 0;
+				}
+			}
+		}
+
+		/**
+		 * Converts a result of a correlation to the type of the channel, integers are saturated
+		 * as by the fixed-point engines
+		 */
+		template<typename ChannelType, typename T>
+		ChannelType saturate(T value) {
+			if constexpr (std::is_integral<ChannelType>::value && !std::is_integral<T>::value) {
+				value = std::min<T>(value, std::numeric_limits<ChannelType>::max());
+				value = std::max<T>(value, std::numeric_limits<ChannelType>::lowest());
+			}
+
+			return static_cast<ChannelType>(value);
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the rank filter of an 8-bit padded input by sliding histograms
+		 * (Perreault and Hebert): each column of a band of output rows has a histogram of the funcRows elements
+		 * above the current row, it's updated by one element per step down. The histogram of a window is the sum
+		 * of the histograms of its columns, it's updated by one column per step right. The bins are found
+		 * in 16 coarse bins of the high nibbles first, a segment of 16 fine bins is brought up to date only
+		 * when the search enters it, so the cost per pixel doesn't depend on the size of the window.
+		 * @param funcRows number of rows of the window
+		 * @param funcCols number of columns of the window in pixels
+		 * @param stride distance between the columns of the window in the input (channels of an interleaved input)
+		 */
+		void rankFilterHistogram(const blaze::DynamicMatrix<uint8_t> &input, size_t funcRows, size_t funcCols,
+								 size_t rank, blaze::DynamicMatrix<uint8_t> &resultMat, size_t rows, size_t cols,
+								 const ConvolutionSettings &settings, size_t stride) {
+			constexpr size_t none = std::numeric_limits<size_t>::max();
+			size_t span = (funcCols - 1) * stride;
+			// The bands span the whole rows and are taller than the window, the initialization of the column
+			// histograms costs as much as funcRows steps down
+			size_t tileRows = std::max<size_t>(settings.tileRows, 4 * funcRows);
+
+			forEachTile(rows, cols, tileRows, cols, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+				// Histograms of the columns under the tile, 256 fine and 16 coarse bins per column
+				size_t width = colEnd - colBegin + span;
+				thread_local std::vector<uint16_t> fine;
+				thread_local std::vector<uint16_t> coarse;
+				fine.assign(width * 256, 0);
+				coarse.assign(width * 16, 0);
+				for (size_t a = 0; a < funcRows; ++a) {
+					const uint8_t *row = input.data(rowBegin + a) + colBegin;
+					for (size_t e = 0; e < width; ++e) {
+						++fine[e * 256 + row[e]];
+						++coarse[e * 16 + (row[e] >> 4)];
+					}
+				}
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					if (i > rowBegin) {
+						const uint8_t *removed = input.data(i - 1) + colBegin;
+						const uint8_t *added = input.data(i + funcRows - 1) + colBegin;
+						for (size_t e = 0; e < width; ++e) {
+							--fine[e * 256 + removed[e]];
+							--coarse[e * 16 + (removed[e] >> 4)];
+							++fine[e * 256 + added[e]];
+							++coarse[e * 16 + (added[e] >> 4)];
+						}
+					}
+
+					uint8_t *out = resultMat.data(i) + colBegin;
+					size_t n = colEnd - colBegin;
+					// Each channel of an interleaved input slides its own window
+					for (size_t c = 0; c < std::min(stride, n); ++c) {
+						uint32_t windowCoarse[16] = {};
+						uint32_t windowFine[256];
+						// The position of the window each segment of the fine bins is up to date for
+						size_t synced[16];
+						std::fill(synced, synced + 16, none);
+						for (size_t b = 0; b < funcCols; ++b) {
+							const uint16_t *column = coarse.data() + (c + b * stride) * 16;
+							for (size_t k = 0; k < 16; ++k) {
+								windowCoarse[k] += column[k];
+							}
+						}
+
+						for (size_t p = 0, j = c; j < n; ++p, j += stride) {
+							if (p > 0) {
+								const uint16_t *added = coarse.data() + (j + span) * 16;
+								const uint16_t *removed = coarse.data() + (j - stride) * 16;
+								for (size_t k = 0; k < 16; ++k) {
+									windowCoarse[k] += added[k] - removed[k];
+								}
+							}
+
+							size_t count = 0;
+							size_t s = 0;
+							while (count + windowCoarse[s] <= rank) {
+								count += windowCoarse[s++];
+							}
+
+							uint32_t *segment = windowFine + s * 16;
+							if (synced[s] == none || 2 * (p - synced[s]) >= funcCols) {
+								std::fill(segment, segment + 16, 0);
+								for (size_t b = 0; b < funcCols; ++b) {
+									const uint16_t *column = fine.data() + (j + b * stride) * 256 + s * 16;
+									for (size_t f = 0; f < 16; ++f) {
+										segment[f] += column[f];
+									}
+								}
+							} else {
+								for (size_t q = synced[s] + 1; q <= p; ++q) {
+									size_t jq = c + q * stride;
+									const uint16_t *added = fine.data() + (jq + span) * 256 + s * 16;
+									const uint16_t *removed = fine.data() + (jq - stride) * 256 + s * 16;
+									for (size_t f = 0; f < 16; ++f) {
+										segment[f] += added[f] - removed[f];
+									}
+								}
+							}
+
+							synced[s] = p;
+							size_t f = 0;
+							while (count + segment[f] <= rank) {
+								count += segment[f++];
+							}
+
+							out[j] = static_cast<uint8_t>(s * 16 + f);
+						}
+					}
+				}
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the rank filter of a padded input
+		 * by the sliding histograms for 8-bit elements and by the selection in each window for the other types
+		 * @param funcRows number of rows of the window
+		 * @param funcCols number of columns of the window in pixels
+		 * @param stride distance between the columns of the window in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void rankFilter(const blaze::DynamicMatrix<T> &input, size_t funcRows, size_t funcCols, size_t rank,
+						blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+						const ConvolutionSettings &settings, size_t stride = 1) {
+			if constexpr (std::is_same<T, uint8_t>::value) {
+				rankFilterHistogram(input, funcRows, funcCols, rank, resultMat, rows, cols, settings, stride);
+			} else {
+				forEachTile(rows, cols, settings.tileRows, settings.tileColumns, settings,
+							[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+					thread_local std::vector<T> window;
+					window.resize(funcRows * funcCols);
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t j = colBegin; j < colEnd; ++j) {
+							for (size_t a = 0; a < funcRows; ++a) {
+								for (size_t b = 0; b < funcCols; ++b) {
+									window[a * funcCols + b] = input(i + a, j + b * stride);
+								}
+							}
+
+							std::nth_element(window.begin(), window.begin() + rank, window.end());
+							resultMat(i, j) = window[rank];
+						}
+					}
+				});
+			}
+		}
+
+		/**
+		 * Returns the padding of PadType::CONST for the morphological filters: the element which never wins
+		 * the first operation, +inf (the maximum of an integer type) for the erosion and the opening
+		 * and -inf (the minimum) for the dilation and the closing
+		 */
+		template<typename T>
+		T morphologyFill(MorphologyOperation operation) {
+			bool erosion = operation == MorphologyOperation::ERODE || operation == MorphologyOperation::OPEN;
+			if constexpr (std::numeric_limits<T>::has_infinity) {
+				return erosion ? std::numeric_limits<T>::infinity() : -std::numeric_limits<T>::infinity();
+			} else {
+				return erosion ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest();
+			}
+		}
+
+		/**
+		 * Computes n minima (maxima) of the windows of length elements stride elements apart along a row
+		 * by the algorithm of van Herk and Gil-Werman: the row is cut into blocks of length elements, a window
+		 * covers the suffix of a block and the prefix of the next one, which are running minima (maxima)
+		 * @param in the row, n + (length - 1) * stride elements
+		 * @param out n results
+		 * @param stride number of interleaved channels, each channel has its windows
+		 * @param suffix, prefix buffers of the size of the row
+		 * @param op the minimum or the maximum of two elements
+		 */
+		template<typename T, typename Op>
+		void slidingExtremumRow(const T *in, T *out, size_t n, size_t length, size_t stride, T *suffix, T *prefix,
+								Op op) {
+			size_t span = (length - 1) * stride;
+			size_t size = n + span;
+			size_t blockSize = length * stride;
+			for (size_t blockBegin = 0; blockBegin < size; blockBegin += blockSize) {
+				size_t blockEnd = std::min(size, blockBegin + blockSize);
+				size_t edge = std::max(blockBegin, blockEnd - std::min(blockEnd, stride));
+				for (size_t e = edge; e < blockEnd; ++e) {
+					suffix[e] = in[e];
+				}
+
+				for (size_t e = edge; e-- > blockBegin;) {
+					suffix[e] = op(in[e], suffix[e + stride]);
+				}
+
+				edge = std::min(blockEnd, blockBegin + stride);
+				for (size_t e = blockBegin; e < edge; ++e) {
+					prefix[e] = in[e];
+				}
+
+				for (size_t e = edge; e < blockEnd; ++e) {
+					prefix[e] = op(prefix[e - stride], in[e]);
+				}
+			}
+
+			for (size_t j = 0; j < n; ++j) {
+				out[j] = op(suffix[j], prefix[j + span]);
+			}
+		}
+
+		/**
+		 * Computes the minima (maxima) of the windows of length rows by the algorithm of van Herk and Gil-Werman,
+		 * as slidingExtremumRow for whole rows. The window of a diagonal line is shifted by shift elements
+		 * per row, the element k of the window at (i, j) is at (i + k, j + k * shift)
+		 * @param row callable (k) which returns the row k of the input, rows + length - 1 rows
+		 * @param out callable (i) which returns the row i of the result
+		 * @param rows number of rows of the result
+		 * @param width number of elements of the input rows, n + (length - 1) * |shift| for a diagonal
+		 * @param n number of elements of the result rows
+		 * @param suffix buffer of (rows + length - 1) * width elements
+		 * @param prefix, previous buffers of width elements
+		 */
+		template<typename T, typename Rows, typename Outputs, typename Op>
+		void slidingExtremumRows(Rows row, Outputs out, size_t rows, size_t width, size_t n, size_t length,
+								 long shift, T *suffix, T *prefix, T *previous, Op op) {
+			size_t count = rows + length - 1;
+			// The ranges of the columns which have a neighbour in the next (previous) row of the window
+			size_t next = static_cast<size_t>(std::max<long>(0, -shift));
+			size_t nextEnd = width - std::min<size_t>(width, std::max<long>(0, shift));
+			size_t last = static_cast<size_t>(std::max<long>(0, shift));
+			size_t lastEnd = width - std::min<size_t>(width, std::max<long>(0, -shift));
+			// The suffix covers the window from its first row, the prefix from its last one
+			size_t suffixBegin = shift < 0 ? (length - 1) * -shift : 0;
+			size_t prefixBegin = shift > 0 ? (length - 1) * shift : 0;
+
+			for (size_t k = count; k-- > 0;) {
+				const T *x = row(k);
+				T *h = suffix + k * width;
+				if ((k + 1) % length == 0 || k + 1 == count) {
+					std::copy(x, x + width, h);
+					continue;
+				}
+
+				// h(c) = op(x(c), the suffix of the next row at c + shift)
+				const T *below = suffix + (k + 1) * width + last;
+				std::copy(x, x + next, h);
+				for (size_t c = next; c < nextEnd; ++c) {
+					h[c] = op(x[c], below[c - next]);
+				}
+
+				std::copy(x + nextEnd, x + width, h + nextEnd);
+			}
+
+			for (size_t k = 0; k < count; ++k) {
+				const T *x = row(k);
+				std::swap(prefix, previous);
+				if (k % length == 0) {
+					std::copy(x, x + width, prefix);
+				} else {
+					// g(c) = op(the prefix of the previous row at c - shift, x(c))
+					const T *above = previous + next;
+					std::copy(x, x + last, prefix);
+					for (size_t c = last; c < lastEnd; ++c) {
+						prefix[c] = op(above[c - last], x[c]);
+					}
+
+					std::copy(x + lastEnd, x + width, prefix + lastEnd);
+				}
+
+				if (k + 1 >= length) {
+					size_t i = k + 1 - length;
+					const T *h = suffix + i * width + suffixBegin;
+					const T *g = prefix + prefixBegin;
+					T *y = out(i);
+					for (size_t j = 0; j < n; ++j) {
+						y[j] = op(h[j], g[j]);
+					}
+				}
+			}
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the erosion (op is the minimum) or the dilation (the maximum)
+		 * of a padded input by the element: the horizontal pass then the vertical one in bands of rows,
+		 * a diagonal line in one pass whose rows are shifted by a column each
+		 * @param stride distance between the columns of the element in the input (channels of an interleaved input)
+		 */
+		template<typename T, typename Op>
+		void morphologyPass(const blaze::DynamicMatrix<T> &input, const StructuringElement &element, Op op,
+							blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+							const ConvolutionSettings &settings, size_t stride) {
+			size_t length = element.rows();
+			size_t span = (element.columns() - 1) * stride;
+			bool diagonal = element.diagonal() != 0;
+			bool horizontal = !diagonal && element.columns() > 1;
+			size_t tileRows = std::max<size_t>(settings.tileRows, 4 * length);
+
+			forEachTile(rows, cols, tileRows, cols, settings, [&](size_t rowBegin, size_t rowEnd, size_t, size_t) {
+				thread_local std::vector<T> horizontalRows;
+				thread_local std::vector<T> suffix;
+				thread_local std::vector<T> prefix;
+				size_t bandRows = rowEnd - rowBegin;
+				size_t count = bandRows + length - 1;
+				prefix.resize(2 * (cols + span));
+				if (!diagonal && length == 1) {
+					suffix.resize(cols + span);
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						slidingExtremumRow(input.data(i), resultMat.data(i), cols, element.columns(), stride,
+										   suffix.data(), prefix.data(), op);
+					}
+
+					return;
+				}
+
+				// The vertical pass reads the rows of the horizontal one
+				if (horizontal) {
+					suffix.resize(cols + span);
+					horizontalRows.resize(count * cols);
+					for (size_t k = 0; k < count; ++k) {
+						slidingExtremumRow(input.data(rowBegin + k), horizontalRows.data() + k * cols, cols,
+										   element.columns(), stride, suffix.data(), prefix.data(), op);
+					}
+				}
+
+				size_t width = diagonal ? cols + span : cols;
+				suffix.resize(count * width);
+				auto row = [&](size_t k) -> const T * {
+					return horizontal ? horizontalRows.data() + k * cols : input.data(rowBegin + k);
+				};
+
+				slidingExtremumRows(row, [&](size_t i) { return resultMat.data(rowBegin + i); }, bandRows, width, cols,
+									length, element.diagonal() * static_cast<long>(stride), suffix.data(),
+									prefix.data(), prefix.data() + width, op);
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of a morphological filter of a padded input,
+		 * the opening and the closing compute the first operation over the window of the second one
+		 * @param stride distance between the columns of the element in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void morphologyFilter(const blaze::DynamicMatrix<T> &input, const StructuringElement &element,
+							  MorphologyOperation operation, blaze::DynamicMatrix<T> &resultMat, size_t rows,
+							  size_t cols, const ConvolutionSettings &settings, size_t stride) {
+			auto minimum = [](T a, T b) { return b < a ? b : a; };
+			auto maximum = [](T a, T b) { return a < b ? b : a; };
+			if (operation == MorphologyOperation::ERODE) {
+				morphologyPass(input, element, minimum, resultMat, rows, cols, settings, stride);
+				return;
+			}
+
+			if (operation == MorphologyOperation::DILATE) {
+				morphologyPass(input, element, maximum, resultMat, rows, cols, settings, stride);
+				return;
+			}
+
+			blaze::DynamicMatrix<T> first(rows + element.rows() - 1, cols + (element.columns() - 1) * stride);
+			if (operation == MorphologyOperation::OPEN) {
+				morphologyPass(input, element, minimum, first, first.rows(), first.columns(), settings, stride);
+				morphologyPass(first, element, maximum, resultMat, rows, cols, settings, stride);
+			} else {
+				morphologyPass(input, element, maximum, first, first.rows(), first.columns(), settings, stride);
+				morphologyPass(first, element, minimum, resultMat, rows, cols, settings, stride);
+			}
+		}
+
+		/**
+		 * Converts the result of the bilateral filter to the type of the channel, it's between the elements
+		 * of the window, so only the integers need the rounding
+		 */
+		template<typename T, typename Real>
+		T bilateralValue(Real value) {
+			if constexpr (std::is_integral<T>::value) {
+				// The value is between the elements of the window, of an unsigned type it's non-negative
+				return static_cast<T>(std::is_unsigned<T>::value ? value + Real(0.5) : std::round(value));
+			} else {
+				return static_cast<T>(value);
+			}
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the exact bilateral filter of a padded input,
+		 * O(window) per pixel. The range weights of 8 and 16 bit channels are looked up by the difference
+		 * @param radius radius of the window
+		 * @param stride distance between the columns of the window in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void bilateralExact(const blaze::DynamicMatrix<T> &input, size_t radius, double spatialSigma,
+							double rangeSigma, blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+							const ConvolutionSettings &settings, size_t stride) {
+			using Real = std::conditional_t<std::is_same<T, double>::value, double, float>;
+			constexpr bool lookup = std::is_integral<T>::value && sizeof(T) <= 2;
+			size_t size = 2 * radius + 1;
+			std::vector<Real> spatial(size * size);
+			for (size_t a = 0; a < size; ++a) {
+				for (size_t b = 0; b < size; ++b) {
+					double dy = static_cast<double>(a) - radius;
+					double dx = static_cast<double>(b) - radius;
+					spatial[a * size + b] = std::exp(-(dy * dy + dx * dx) / (2 * spatialSigma * spatialSigma));
+				}
+			}
+
+			Real rangeScale = -1 / (2 * rangeSigma * rangeSigma);
+			std::vector<Real> range(lookup ? static_cast<size_t>(std::numeric_limits<T>::max()) + 1 : 0);
+			for (size_t d = 0; d < range.size(); ++d) {
+				range[d] = std::exp(static_cast<Real>(d * d) * rangeScale);
+			}
+
+			forEachTile(rows, cols, settings.tileRows, settings.tileColumns, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					T *out = resultMat.data(i);
+					for (size_t j = colBegin; j < colEnd; ++j) {
+						T centre = input(i + radius, j + radius * stride);
+						Real sum = 0;
+						Real weights = 0;
+						for (size_t a = 0; a < size; ++a) {
+							const T *row = input.data(i + a) + j;
+							const Real *spatialRow = spatial.data() + a * size;
+							for (size_t b = 0; b < size; ++b) {
+								T v = row[b * stride];
+								Real weight;
+								if constexpr (lookup) {
+									weight = spatialRow[b] * range[v > centre ? v - centre : centre - v];
+								} else {
+									Real d = static_cast<Real>(v) - static_cast<Real>(centre);
+									weight = spatialRow[b] * std::exp(d * d * rangeScale);
+								}
+
+								sum += weight * static_cast<Real>(v);
+								weights += weight;
+							}
+						}
+
+						out[j] = bilateralValue<T>(sum / weights);
+					}
+				}
+			});
+		}
+
+		/**
+		 * Blurs the lines of a grid by the binomial [1 4 6 4 1] (a Gaussian of sigma 1) along one axis,
+		 * the cells beyond the ends are 0. The scale isn't divided out, it cancels in the result
+		 * @param lines number of lines, lineStride elements apart
+		 * @param count number of cells of a line
+		 * @param size number of elements of a cell, the cells are contiguous
+		 * @param buffer line with two empty cells at both ends
+		 */
+		template<typename Real>
+		void blurGridAxis(Real *grid, size_t lines, size_t lineStride, size_t count, size_t size,
+						  std::vector<Real> &buffer) {
+			buffer.assign((count + 4) * size, 0);
+			for (size_t l = 0; l < lines; ++l) {
+				Real *line = grid + l * lineStride;
+				std::copy(line, line + count * size, buffer.begin() + 2 * size);
+				const Real *b = buffer.data();
+				for (size_t e = 0; e < count * size; ++e) {
+					line[e] = b[e] + 4 * (b[e + size] + b[e + 3 * size]) + 6 * b[e + 2 * size] + b[e + 4 * size];
+				}
+			}
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the bilateral filter of a padded input by the bilateral grid
+		 * of Paris and Durand: the pixels and their number are summed in the cells of a grid downsampled
+		 * by spatialSigma along the rows and the columns and by rangeSigma along the intensity, the grid
+		 * is blurred by a Gaussian of one cell along each axis and the result is the ratio of the sums
+		 * interpolated in it at the pixel and its intensity. The cost doesn't grow with spatialSigma,
+		 * the grid has fewer cells instead. The bands of rows have their grids with the cells around them,
+		 * the cells are aligned on the padded input, so the bands give the result of one grid
+		 * @param radius radius of the window, the pixel of the result is at its centre
+		 * @param stride distance between the columns of the window in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void bilateralGrid(const blaze::DynamicMatrix<T> &input, size_t radius, double spatialSigma,
+						   double rangeSigma, blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+						   const ConvolutionSettings &settings, size_t stride) {
+			using Real = std::conditional_t<std::is_same<T, double>::value, double, float>;
+			// Cells beyond the pixels on each side, the blur reaches two cells
+			constexpr long margin = 2;
+			size_t paddedRows = rows + 2 * radius;
+			size_t paddedPixels = cols / stride + 2 * radius;
+			if (rows == 0 || cols == 0) {
+				return;
+			}
+
+			// The range of each channel, the cells of the intensity start at its minimum
+			std::vector<T> low(input.data(0), input.data(0) + stride);
+			std::vector<T> high = low;
+			for (size_t p = 0; p < paddedRows; ++p) {
+				const T *row = input.data(p);
+				for (size_t e = 0; e < paddedPixels * stride; ++e) {
+					low[e % stride] = std::min(low[e % stride], row[e]);
+					high[e % stride] = std::max(high[e % stride], row[e]);
+				}
+			}
+
+			// The cell of a coordinate is the nearest one, the result is interpolated between the two around it
+			Real spaceScale = static_cast<Real>(1 / spatialSigma);
+			Real rangeScale = static_cast<Real>(1 / rangeSigma);
+			auto cell = [](Real position) { return static_cast<long>(std::floor(position + Real(0.5))); };
+			long width = cell((paddedPixels - 1) * spaceScale) + 1 + 2 * margin;
+
+			std::vector<long> splatColumns(paddedPixels);
+			for (size_t t = 0; t < paddedPixels; ++t) {
+				splatColumns[t] = cell(t * spaceScale) + margin;
+			}
+
+			std::vector<long> sliceColumns(cols / stride);
+			std::vector<Real> sliceFractions(cols / stride);
+			for (size_t t = 0; t < sliceColumns.size(); ++t) {
+				Real x = (t + radius) * spaceScale;
+				sliceColumns[t] = static_cast<long>(std::floor(x)) + margin;
+				sliceFractions[t] = x - std::floor(x);
+			}
+
+			// The cells of the intensity of 8 and 16 bit channels are looked up by the value
+			constexpr bool lookup = std::is_integral<T>::value && sizeof(T) <= 2;
+			size_t values = lookup ? static_cast<size_t>(std::numeric_limits<T>::max()) + 1 : 0;
+
+			size_t bandRows = std::max<size_t>(settings.tileRows, 32 * static_cast<size_t>(std::ceil(spatialSigma)));
+			forEachTile(rows, cols, bandRows, cols, settings, [&](size_t rowBegin, size_t rowEnd, size_t, size_t) {
+				// The cells of the rows of the band and the cells which the blur spreads over them
+				long first = static_cast<long>(std::floor((rowBegin + radius) * spaceScale)) - margin;
+				long last = static_cast<long>(std::floor((rowEnd - 1 + radius) * spaceScale)) + 1 + margin;
+				long height = last - first + 1;
+				thread_local std::vector<Real> grid;
+				thread_local std::vector<Real> buffer;
+				thread_local std::vector<long> splatCells;
+				thread_local std::vector<long> sliceCells;
+				thread_local std::vector<Real> sliceDepths;
+
+				// The rows of the input whose cells are in the grid
+				double splatFrom = std::max(0.0, std::floor((first - 0.5) * spatialSigma));
+				double splatTo = std::max(0.0, std::ceil((last + 0.5) * spatialSigma) + 1);
+				size_t splatBegin = static_cast<size_t>(splatFrom);
+				size_t splatEnd = std::min(paddedRows, static_cast<size_t>(splatTo));
+
+				for (size_t c = 0; c < stride; ++c) {
+					Real base = low[c];
+					long depth = cell((static_cast<Real>(high[c]) - base) * rangeScale) + 1 + 2 * margin;
+					size_t cellSize = 2 * depth;
+					size_t rowSize = width * cellSize;
+					grid.assign(height * rowSize, 0);
+					if constexpr (lookup) {
+						splatCells.resize(values);
+						sliceCells.resize(values);
+						sliceDepths.resize(values);
+						for (size_t v = low[c]; v <= high[c]; ++v) {
+							Real z = (static_cast<Real>(v) - base) * rangeScale;
+							splatCells[v] = 2 * (cell(z) + margin);
+							sliceCells[v] = 2 * (static_cast<long>(std::floor(z)) + margin);
+							sliceDepths[v] = z - std::floor(z);
+						}
+					}
+
+					for (size_t p = splatBegin; p < splatEnd; ++p) {
+						long r = cell(p * spaceScale) - first;
+						if (r < 0 || r >= height) {
+							continue;
+						}
+
+						const T *row = input.data(p) + c;
+						Real *gridRow = grid.data() + r * rowSize;
+						for (size_t t = 0; t < paddedPixels; ++t) {
+							T v = row[t * stride];
+							Real *node = gridRow + splatColumns[t] * cellSize;
+							if constexpr (lookup) {
+								node += splatCells[v];
+							} else {
+								node += 2 * (cell((static_cast<Real>(v) - base) * rangeScale) + margin);
+							}
+
+							node[0] += static_cast<Real>(v);
+							node[1] += 1;
+						}
+					}
+
+					blurGridAxis(grid.data(), height * width, cellSize, depth, size_t(2), buffer);
+					blurGridAxis(grid.data(), height, rowSize, width, cellSize, buffer);
+					blurGridAxis(grid.data(), size_t(1), size_t(0), height, rowSize, buffer);
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						Real y = (i + radius) * spaceScale;
+						Real fy = y - std::floor(y);
+						const Real *top = grid.data() + (static_cast<long>(std::floor(y)) - first) * rowSize;
+						const Real *bottom = top + rowSize;
+						const T *centres = input.data(i + radius) + radius * stride + c;
+						T *out = resultMat.data(i) + c;
+						for (size_t t = 0; t < sliceColumns.size(); ++t) {
+							T v = centres[t * stride];
+							size_t offset = sliceColumns[t] * cellSize;
+							Real fz;
+							if constexpr (lookup) {
+								offset += sliceCells[v];
+								fz = sliceDepths[v];
+							} else {
+								Real z = (static_cast<Real>(v) - base) * rangeScale;
+								offset += 2 * (static_cast<long>(std::floor(z)) + margin);
+								fz = z - std::floor(z);
+							}
+
+							Real fx = sliceFractions[t];
+							Real sum[2];
+							for (size_t k = 0; k < 2; ++k) {
+								const Real *a = top + offset + k;
+								const Real *b = bottom + offset + k;
+								Real near = (1 - fz) * ((1 - fx) * a[0] + fx * a[cellSize])
+											+ fz * ((1 - fx) * a[2] + fx * a[cellSize + 2]);
+								Real far = (1 - fz) * ((1 - fx) * b[0] + fx * b[cellSize])
+										   + fz * ((1 - fx) * b[2] + fx * b[cellSize + 2]);
+								sum[k] = (1 - fy) * near + fy * far;
+							}
+
+							out[t * stride] = bilateralValue<T>(sum[0] / sum[1]);
+						}
+					}
+				}
+			});
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the bilateral filter of a padded input
+		 * by the grid if the settings choose it, else exactly
+		 * @param stride distance between the columns of the window in the input (channels of an interleaved input)
+		 */
+		template<typename T>
+		void bilateralFilter(const blaze::DynamicMatrix<T> &input, size_t funcRows, double spatialSigma,
+							 double rangeSigma, blaze::DynamicMatrix<T> &resultMat, size_t rows, size_t cols,
+							 const ConvolutionSettings &settings, size_t stride) {
+			size_t radius = funcRows / 2;
+			bool grid = settings.engine == ConvolutionEngine::GRID
+						|| (settings.engine == ConvolutionEngine::AUTO && spatialSigma >= 2);
+			if (grid) {
+				bilateralGrid(input, radius, spatialSigma, rangeSigma, resultMat, rows, cols, settings, stride);
+			} else {
+				bilateralExact(input, radius, spatialSigma, rangeSigma, resultMat, rows, cols, settings, stride);
+			}
+		}
+
+		FilterKernel mergeKernels(const FilterKernel &first, const FilterKernel &second) {
+			FilterKernel merged(first.rows() + second.rows() - 1, first.columns() + second.columns() - 1, 0.0);
+			for (size_t i = 0; i < first.rows(); ++i) {
+				for (size_t j = 0; j < first.columns(); ++j) {
+					if (first(i, j) == 0) {
+						continue;
+					}
+
+					for (size_t a = 0; a < second.rows(); ++a) {
+						for (size_t b = 0; b < second.columns(); ++b) {
+							merged(i + a, j + b) += first(i, j) * second(a, b);
+						}
+					}
+				}
+			}
+
+			return merged;
+		}
+
+		/**
+		 * Returns the cost of an engine per pixel of the result in multiply-accumulates
+		 * @param separable the separable parts of the kernel for the separable engine
+		 */
+		double engineCost(ConvolutionEngine engine, size_t inputRows, size_t inputCols, const FilterKernel &kernel,
+						  const ConvolutionSettings &settings, const SeparableKernel &separable) {
+			size_t funcRows = kernel.rows();
+			size_t funcCols = kernel.columns();
+			switch (engine) {
+				case ConvolutionEngine::SEPARABLE:
+					return separable.rank() * (funcRows + funcCols);
+
+				case ConvolutionEngine::BOX:
+					// Adds and subtracts of the running sums
+					return 4;
+
+				case ConvolutionEngine::FFT: {
+					double rows = inputRows - funcRows + 1;
+					double cols = inputCols - funcCols + 1;
+					double fftSize = FFT::goodSize(inputRows) * FFT::goodSize(inputCols);
+					return (2 * std::log2(fftSize) * settings.fftCostFactor + 4) * fftSize
+						   / std::max<double>(1, rows * cols);
+				}
+
+				default:
+					return funcRows * funcCols;
+			}
+		}
+
+		size_t KernelKeyHash::operator()(const KernelKey &key) const {
+			size_t seed = std::hash<std::string>()(key.filter);
+			for (auto param : key.params) {
+				hashCombine(seed, param);
+			}
+
+			return seed;
+		}
+
+		size_t SeparableKeyHash::operator()(const SeparableKey &key) const {
+			size_t seed = std::hash<size_t>()(key.rows);
+			hashCombine(seed, key.tolerance);
+			for (auto element : key.elements) {
+				hashCombine(seed, element);
+			}
+
+			return seed;
+		}
+
+		KernelCache &kernelCache() {
+			static KernelCache cache(256);
+			return cache;
+		}
+
+		SeparableCache &separableCache() {
+			static SeparableCache cache(256);
+			return cache;
+		}
+
+		std::shared_ptr<const SeparableKernel> separateCached(const FilterKernel &kernel, double tolerance) {
+			SeparableKey key{kernel.rows(), {}, tolerance};
+			key.elements.reserve(kernel.rows() * kernel.columns());
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					key.elements.push_back(kernel(i, j));
+				}
+			}
+
+			return separableCache().get(key, [&] { return separate(kernel, tolerance); });
+		}
+
+		RecursiveGaussian recursiveGaussian(double sigma) {
+			// Young, van Vliet, van Ginkel, "Recursive Gabor filtering", 2002: the poles of sigma = 2
+			// are scaled by the power 1 / q, q is chosen so the variance of both passes is sigma^2
+			const std::complex<double> complexPole(1.41650, 1.00829);
+			const double realPole = 1.86543;
+			auto poles = [&](double q) {
+				return std::make_pair(std::pow(complexPole, 1 / q), std::pow(realPole, 1 / q));
+			};
+
+			auto variance = [&](double q) {
+				auto[complex, real] = poles(q);
+				return (4.0 * complex / ((complex - 1.0) * (complex - 1.0))).real()
+					   + 2 * real / ((real - 1) * (real - 1));
+			};
+
+			double low = 0.01;
+			double high = sigma + 1;
+			for (int iteration = 0; iteration < 60; ++iteration) {
+				double q = (low + high) / 2;
+				(variance(q) < sigma * sigma ? low : high) = q;
+			}
+
+			// The denominator (1 - z^-1 / d1)(1 - z^-1 / d2)(1 - z^-1 / d3) of the forward pass
+			double q = (low + high) / 2;
+			auto[complex, real] = poles(q);
+			double sum = 2 * (1.0 / complex).real();
+			double norm = 1 / std::norm(complex);
+
+			RecursiveGaussian gaussian;
+			gaussian.sigma = sigma;
+			gaussian.a[0] = sum + 1 / real;
+			gaussian.a[1] = -(norm + sum / real);
+			gaussian.a[2] = norm / real;
+			gaussian.gain = 1 - gaussian.a[0] - gaussian.a[1] - gaussian.a[2];
+
+			// The boundary of Triggs and Sdika is linear in the last states of the forward pass and the input
+			// after the end, so its matrix is the response of the filter to each of them on a long constant tail
+			size_t tail = static_cast<size_t>(40 * (q + 3));
+			std::vector<double> w(tail);
+			for (size_t k = 0; k < 4; ++k) {
+				double state[3] = {k == 0 ? 1.0 : 0.0, k == 1 ? 1.0 : 0.0, k == 2 ? 1.0 : 0.0};
+				double input = k == 3 ? 1 : 0;
+				for (size_t n = 0; n < tail; ++n) {
+					w[n] = gaussian.gain * input + gaussian.a[0] * state[0] + gaussian.a[1] * state[1]
+						   + gaussian.a[2] * state[2];
+					state[2] = state[1];
+					state[1] = state[0];
+					state[0] = w[n];
+				}
+
+				// The tail has reached the steady state: input for the tail of the input, 0 for the states
+				double y[3] = {input, input, input};
+				for (size_t n = tail; n-- > 0;) {
+					double value = gaussian.gain * w[n] + gaussian.a[0] * y[0] + gaussian.a[1] * y[1]
+								   + gaussian.a[2] * y[2];
+					y[2] = y[1];
+					y[1] = y[0];
+					y[0] = value;
+					if (n < 3) {
+						gaussian.end[n][k] = value;
+					}
+				}
+			}
+
+			return gaussian;
+		}
+
+		template<size_t Lanes>
+		void recursiveLines(const RecursiveGaussian &gaussian, double *lines, size_t n, size_t stride) {
+			if (n == 0) {
+				return;
+			}
+
+			double gain = gaussian.gain;
+			double a0 = gaussian.a[0];
+			double a1 = gaussian.a[1];
+			double a2 = gaussian.a[2];
+			double last[Lanes];
+			double w0[Lanes];
+			double w1[Lanes];
+			double w2[Lanes];
+			for (size_t r = 0; r < Lanes; ++r) {
+				last[r] = lines[(n - 1) * stride + r];
+				// The steady state of the first element before the line
+				w0[r] = lines[r];
+				w1[r] = lines[r];
+				w2[r] = lines[r];
+			}
+
+			for (size_t i = 0; i < n; ++i) {
+				double *x = lines + i * stride;
+				for (size_t r = 0; r < Lanes; ++r) {
+					double value = gain * x[r] + a0 * w0[r] + a1 * w1[r] + a2 * w2[r];
+					w2[r] = w1[r];
+					w1[r] = w0[r];
+					w0[r] = value;
+					x[r] = value;
+				}
+			}
+
+			const auto &end = gaussian.end;
+			double y0[Lanes];
+			double y1[Lanes];
+			double y2[Lanes];
+			for (size_t r = 0; r < Lanes; ++r) {
+				y0[r] = end[0][0] * w0[r] + end[0][1] * w1[r] + end[0][2] * w2[r] + end[0][3] * last[r];
+				y1[r] = end[1][0] * w0[r] + end[1][1] * w1[r] + end[1][2] * w2[r] + end[1][3] * last[r];
+				y2[r] = end[2][0] * w0[r] + end[2][1] * w1[r] + end[2][2] * w2[r] + end[2][3] * last[r];
+			}
+
+			for (size_t i = n; i-- > 0;) {
+				double *x = lines + i * stride;
+				for (size_t r = 0; r < Lanes; ++r) {
+					double value = gain * x[r] + a0 * y0[r] + a1 * y1[r] + a2 * y2[r];
+					y2[r] = y1[r];
+					y1[r] = y0[r];
+					y0[r] = value;
+					x[r] = value;
+				}
+			}
+		}
+
+		/**
+		 * Resolves ConvolutionEngine::AUTO to the cheapest engine for the kernel and the padded input
+		 * @param separable the separable parts of the kernel, they're computed if the engine may need them
+		 */
+		ConvolutionEngine chooseEngine(size_t inputRows, size_t inputCols, const FilterKernel &kernel,
+									   const ConvolutionSettings &settings, SeparableKernel &separable) {
+			auto engine = settings.engine;
+			if (engine == ConvolutionEngine::RECURSIVE || engine == ConvolutionEngine::GRID) {
+				// Only the recursive Gaussian and the bilateral filter have them,
+				// the convolution chooses them before the kernel engines
+				engine = ConvolutionEngine::AUTO;
+			}
+
+			if (engine == ConvolutionEngine::AUTO && isBox(kernel)) {
+				engine = ConvolutionEngine::BOX;
+			}
+
+			if (engine == ConvolutionEngine::AUTO || engine == ConvolutionEngine::SEPARABLE) {
+				separable = *separateCached(kernel, settings.separableTolerance);
+			}
+
+			if (engine == ConvolutionEngine::AUTO) {
+				auto cost = [&](ConvolutionEngine candidate) {
+					return engineCost(candidate, inputRows, inputCols, kernel, settings, separable);
+				};
+
+				engine = ConvolutionEngine::DIRECT;
+				if (separable.rank() > 0 && cost(ConvolutionEngine::SEPARABLE) < cost(engine)) {
+					engine = ConvolutionEngine::SEPARABLE;
+				}
+
+				if (cost(ConvolutionEngine::FFT) < cost(engine)) {
+					engine = ConvolutionEngine::FFT;
+				}
+			}
+
+			return engine;
+		}
+
+		/**
+		 * Spreads the columns of a kernel by the stride, so it can be applied to an interleaved input:
+		 * the columns between the taps are zeros which the engines skip
+		 */
+		FilterKernel spreadKernel(const FilterKernel &kernel, size_t stride) {
+			if (stride == 1) {
+				return kernel;
+			}
+
+			FilterKernel spread(kernel.rows(), (kernel.columns() - 1) * stride + 1, 0.0);
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					spread(i, j * stride) = kernel(i, j);
+				}
+			}
+
+			return spread;
+		}
+
+		/**
+		 * Returns the shape of the correlation, the columns of an interleaved input are counted in elements
+		 * @param stride number of interleaved channels
+		 */
+		CorrelationShape correlationShape(size_t inputRows, size_t inputCols, const FilterKernel &kernel,
+										  size_t stride = 1) {
+			size_t funcRows = kernel.rows();
+			size_t funcCols = kernel.columns();
+			size_t pixels = inputCols / stride;
+
+			CorrelationShape shape;
+			shape.resultRows = inputRows - std::ceil((double) funcRows / 2);
+			shape.resultCols = (pixels - std::ceil((double) funcCols / 2)) * stride;
+			shape.rows = std::min<size_t>(shape.resultRows, inputRows - funcRows + 1);
+			shape.cols = std::min<size_t>(shape.resultCols, (pixels - funcCols + 1) * stride);
+			return shape;
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the convolution of the padded input by the engine of the plan,
+		 * the other elements of the result aren't changed
+		 * @tparam T float or double, the type of the taps and of the sums
+		 * @param resultMat the result, at least rows x cols
+		 * @param fftWorkspace buffers of the FFT engine
+		 */
+		template<typename T>
+		void correlate(const blaze::DynamicMatrix<T> &input, const ConvolutionPlan &plan,
+					   const ConvolutionSettings &settings, blaze::DynamicMatrix<T> &resultMat,
+					   size_t rows, size_t cols, FFTWorkspace &fftWorkspace) {
+			const auto &taps = planTaps<T>(plan);
+			switch (plan.engine) {
+				case ConvolutionEngine::SEPARABLE:
+					if (plan.separable.rank() > 0) {
+						correlateSeparable(input, plan.separable, resultMat, rows, cols, settings, plan.stride);
+					}
+					break;
+				case ConvolutionEngine::FFT:
+					correlateFFT(input, plan.spread, resultMat, rows, cols, fftWorkspace);
+					break;
+				case ConvolutionEngine::BOX:
+					if (isBox(plan.kernel)) {
+						correlateBox(input, plan.kernel, resultMat, rows, cols, settings, plan.stride);
+					} else {
+						correlateDirect(input, taps, plan.kernel.rows(), resultMat, rows, cols, settings);
+					}
+					break;
+				default:
+					correlateDirect(input, taps, plan.kernel.rows(), resultMat, rows, cols, settings);
+					break;
+			}
+
+			roundAndClamp(resultMat, rows, cols);
+		}
+
+		/**
+		 * Computes the convolution of the padded input by the engine of the plan
+		 * @param resultMat the result, it's reallocated only if its shape differs from the plan
+		 * @param fftWorkspace buffers of the FFT engine
+		 */
+		template<typename T>
+		void correlate(const blaze::DynamicMatrix<T> &input, const ConvolutionPlan &plan,
+					   const ConvolutionSettings &settings, blaze::DynamicMatrix<T> &resultMat,
+					   FFTWorkspace &fftWorkspace) {
+			const auto &shape = plan.shape;
+			if (resultMat.rows() != shape.resultRows || resultMat.columns() != shape.resultCols) {
+				resultMat = blaze::DynamicMatrix<T>(shape.resultRows, shape.resultCols, T(0));
+			}
+
+			correlate(input, plan, settings, resultMat, shape.rows, shape.cols, fftWorkspace);
+		}
+
+		template<typename T>
+		FixedPointKernel quantize(const FilterKernel &kernel) {
+			using Accumulator = std::conditional_t<sizeof(T) == 1, int32_t, int64_t>;
+			const double maxValue = std::numeric_limits<T>::max();
+
+			double absSum = 0;
+			double absMax = 0;
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					absSum += std::abs(kernel(i, j));
+					absMax = std::max(absMax, std::abs(kernel(i, j)));
+				}
+			}
+
+			// The sum with the rounding offset must fit the accumulator and the taps must fit int32_t
+			const double accumulatorLimit = std::numeric_limits<Accumulator>::max() / 2;
+			const double tapLimit = std::numeric_limits<int32_t>::max() / 2;
+			FixedPointKernel result;
+			while (result.shift < 30) {
+				double scale = std::ldexp(1.0, result.shift + 1);
+				if (maxValue * absSum * scale >= accumulatorLimit || absMax * scale >= tapLimit) {
+					break;
+				}
+
+				++result.shift;
+			}
+
+			double scale = std::ldexp(1.0, result.shift);
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					auto value = static_cast<int32_t>(std::lround(kernel(i, j) * scale));
+					result.maxError += std::abs(value / scale - kernel(i, j)) * maxValue;
+					if (value != 0) {
+						result.taps.push_back(FixedKernelTap{i, j, value});
+					}
+				}
+			}
+
+			return result;
+		}
+
+		/**
+		 * Chooses the engine for the kernel and prepares the kernel for it
+		 * @tparam T type of the elements of the input
+		 * @param inputRows number of rows of the padded input
+		 * @param inputCols number of columns of the padded input in elements
+		 * @param stride number of interleaved channels of the input
+		 */
+		template<typename T>
+		void prepareEngine(ConvolutionPlan &plan, size_t inputRows, size_t inputCols, const FilterKernel &kernel,
+						   const ConvolutionSettings &settings, size_t stride) {
+			constexpr bool integer = std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value;
+			size_t funcRows = kernel.rows();
+			size_t funcCols = kernel.columns();
+
+			plan.kernel = kernel;
+			plan.settings = settings;
+			plan.stride = stride;
+			plan.shape = correlationShape(inputRows, inputCols, kernel, stride);
+			plan.separable = SeparableKernel();
+			plan.engine = chooseEngine(inputRows, inputCols / stride, kernel, settings, plan.separable);
+			plan.fixed = integer && settings.fixedPoint
+						 && (plan.engine == ConvolutionEngine::DIRECT
+							 || (plan.engine == ConvolutionEngine::SEPARABLE
+								 && funcRows * funcCols <= 2 * plan.separable.rank() * (funcRows + funcCols)));
+
+			plan.spread = spreadKernel(kernel, stride);
+			plan.taps = kernelTaps(plan.spread);
+			plan.floatTaps = kernelTaps<float>(plan.spread);
+			plan.fixedKernel = FixedPointKernel();
+			if constexpr (integer) {
+				if (plan.fixed) {
+					plan.fixedKernel = quantize<T>(plan.spread);
+				}
+			}
+		}
+
+		blaze::DynamicMatrix<double> imgcov2(const blaze::DynamicMatrix<double> &input, const FilterKernel &kernel,
+											 const ConvolutionSettings &settings) {
+			return imgcov2<double>(input, kernel, settings);
+		}
+
+		template<typename T>
+		std::enable_if_t<std::is_same<T, float>::value || std::is_same<T, double>::value, blaze::DynamicMatrix<T>>
+		imgcov2(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+				const ConvolutionSettings &settings) {
+			ConvolutionPlan plan;
+			prepareEngine<T>(plan, input.rows(), input.columns(), kernel, settings, 1);
+
+			blaze::DynamicMatrix<T> resultMat;
+			FFTWorkspace fftWorkspace;
+			correlate(input, plan, settings, resultMat, fftWorkspace);
+			return resultMat;
+		}
+
+		/**
+		 * Computes the rows x cols top-left part of the fixed-point convolution of the padded input
+		 * with the quantized kernel of the plan, the other elements of the result aren't changed
+		 * @param resultMat the result, at least rows x cols
+		 */
+		template<typename T>
+		void correlateFixed(const blaze::DynamicMatrix<T> &input, const ConvolutionPlan &plan,
+							const ConvolutionSettings &settings, blaze::DynamicMatrix<T> &resultMat,
+							size_t rows, size_t cols) {
+			size_t funcRows = plan.kernel.rows();
+			const auto &fixedKernel = plan.fixedKernel;
+			forEachTile(rows, cols, settings.tileRows, settings.tileColumns * plan.stride, settings,
+						[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+				thread_local std::vector<const T *> inputRows;
+				inputRows.resize(funcRows);
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t a = 0; a < funcRows; ++a) {
+						inputRows[a] = input.data(i + a) + colBegin;
+					}
+
+					correlateRowFixed(inputRows.data(), fixedKernel.taps, fixedKernel.shift,
+									  resultMat.data(i) + colBegin, colEnd - colBegin);
+				}
+			});
+		}
+
+		/**
+		 * Computes the fixed-point convolution of the padded input with the quantized kernel of the plan
+		 * @param resultMat the result, it's reallocated only if its shape differs from the plan
+		 */
+		template<typename T>
+		void correlateFixed(const blaze::DynamicMatrix<T> &input, const ConvolutionPlan &plan,
+							const ConvolutionSettings &settings, blaze::DynamicMatrix<T> &resultMat) {
+			const auto &shape = plan.shape;
+			if (resultMat.rows() != shape.resultRows || resultMat.columns() != shape.resultCols) {
+				resultMat = blaze::DynamicMatrix<T>(shape.resultRows, shape.resultCols, 0);
+			}
+
+			correlateFixed(input, plan, settings, resultMat, shape.rows, shape.cols);
+		}
+
+		template<typename T>
+		blaze::DynamicMatrix<T> imgcov2Fixed(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+											 const ConvolutionSettings &settings) {
+			ConvolutionPlan plan;
+			plan.kernel = kernel;
+			plan.stride = 1;
+			plan.shape = correlationShape(input.rows(), input.columns(), kernel);
+			plan.fixedKernel = quantize<T>(kernel);
+
+			blaze::DynamicMatrix<T> resultMat;
+			correlateFixed(input, plan, settings, resultMat);
+			return resultMat;
+		}
+
+		/**
+		 * Adds a tap of a static kernel to the sum, without a multiply for ±1 and ±2
+		 * and without a load for 0
+		 */
+		template<int Coefficient, typename Accumulator, typename T>
+		void accumulateTap(Accumulator &sum, const T *src) {
+			if constexpr (Coefficient == 1) {
+				sum += static_cast<Accumulator>(*src);
+			} else if constexpr (Coefficient == -1) {
+				sum -= static_cast<Accumulator>(*src);
+			} else if constexpr (Coefficient == 2) {
+				Accumulator value = *src;
+				sum += value + value;
+			} else if constexpr (Coefficient == -2) {
+				Accumulator value = *src;
+				sum -= value + value;
+			} else if constexpr (Coefficient != 0) {
+				sum += Coefficient * static_cast<Accumulator>(*src);
+			}
+		}
+
+		/**
+		 * Rounds the sum of a static kernel divided by its divisor, negative values are clamped to 0 as in imgcov2
+		 * and integers are saturated
+		 */
+		template<int Divisor, typename T, typename Accumulator>
+		T roundStatic(Accumulator sum) {
+			if constexpr (std::is_integral<T>::value) {
+				if (sum <= 0) {
+					return 0;
+				}
+
+				Accumulator val = Divisor == 1 ? sum : (2 * sum + Divisor) / (2 * Divisor);
+				return static_cast<T>(std::min<Accumulator>(val, std::numeric_limits<T>::max()));
+			} else {
+				double val = blaze::round(Divisor == 1 ? sum : sum / Divisor);
+				return static_cast<T>(val > 0 ? val : 0);
+			}
+		}
+
+		template<typename Kernel, bool Contiguous, typename T, size_t ...Taps>
+		void correlateRowStatic(const T *const *rows, T *out, size_t n, size_t stride, std::index_sequence<Taps...>) {
+			using Accumulator = std::conditional_t<std::is_integral<T>::value,
+					std::conditional_t<sizeof(T) == 1, int32_t, int64_t>, double>;
+			for (size_t j = 0; j < n; ++j) {
+				Accumulator sum = 0;
+				(accumulateTap<Kernel::coefficients[Taps]>(
+						sum, rows[Taps / Kernel::columns] + j + Taps % Kernel::columns * (Contiguous ? 1 : stride)), ...);
+				out[j] = roundStatic<Kernel::divisor, T>(sum);
+			}
+		}
+
+		template<typename Kernel, typename T>
+		void correlateRowStatic(const T *const *rows, T *out, size_t n, size_t stride) {
+			auto taps = std::make_index_sequence<Kernel::rows * Kernel::columns>();
+			if (stride == 1) {
+				correlateRowStatic<Kernel, true>(rows, out, n, stride, taps);
+			} else {
+				correlateRowStatic<Kernel, false>(rows, out, n, stride, taps);
+			}
+		}
+
+		/**
+		 * Runs a row kernel over the padded channels without materializing the padding, tile by tile.
+		 * The interior pixels read the rows of the sources directly, the thin border strips
+		 * are remapped into small line buffers. All channels have the same shape, so each tile
+		 * computes the pixels of all of them with the same index maps.
+		 * @param sources callable (ch) which returns the channel ch, a matrix with data(row) access
+		 * @param count number of channels
+		 * @param group number of channels which a tile computes together if settings.fuseChannels is set
+		 * (the channels of a frame), the groups run on the threads as separate tasks
+		 * @param constRow row of init values of the padding, it's as wide as the sources
+		 * @param region rows [region[0], region[1]) and columns [region[2], region[3]) of the result to compute
+		 * @param rowKernel callable (ch, i, rows, j, n) which computes n pixels of the output row i
+		 * of the channel ch from column j
+		 */
+		template<typename T, typename Sources, typename RowKernel>
+		void correlateVirtual(Sources sources, size_t count, size_t group, const std::vector<long> &rowMap,
+							  const std::vector<long> &colMap, size_t padBefore, const T *constRow, T initValue,
+							  size_t funcRows, size_t funcCols, const blaze::StaticVector<size_t, 4> &region,
+							  const ConvolutionSettings &settings, RowKernel rowKernel) {
+			size_t srcCols = sources(0).columns();
+			size_t cols = region[3];
+			// Output columns whose window lies inside the source
+			size_t interiorBegin = std::min(padBefore, cols);
+			size_t interiorEnd = srcCols + 1 >= funcCols ? std::min(padBefore + srcCols + 1 - funcCols, cols) : 0;
+			if (interiorEnd <= interiorBegin) {
+				interiorBegin = interiorEnd = cols;
+			}
+
+			auto runChannels = [&](size_t chBegin, size_t chEnd) {
+				forEachTile(region[1] - region[0], region[3] - region[2], settings.tileRows, settings.tileColumns, settings,
+							[&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+					rowBegin += region[0];
+					rowEnd += region[0];
+					colBegin += region[2];
+					colEnd += region[2];
+					size_t tileInteriorBegin = std::min(std::max(interiorBegin, colBegin), colEnd);
+					size_t tileInteriorEnd = std::max(std::min(interiorEnd, colEnd), tileInteriorBegin);
+					const std::pair<size_t, size_t> strips[] = {{colBegin, tileInteriorBegin}, {tileInteriorEnd, colEnd}};
+
+					// Scratch of the thread, it keeps its capacity between calls
+					thread_local std::vector<T> lines;
+					thread_local std::vector<const T *> srcRows;
+					thread_local std::vector<const T *> windowRows;
+					size_t lineWidth = std::max(tileInteriorBegin - colBegin, colEnd - tileInteriorEnd) + funcCols - 1;
+					lines.resize(funcRows * lineWidth);
+					srcRows.resize(funcRows);
+					windowRows.resize(funcRows);
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t ch = chBegin; ch < chEnd; ++ch) {
+							const auto &src = sources(ch);
+							for (size_t a = 0; a < funcRows; ++a) {
+								long r = rowMap[i + a];
+								srcRows[a] = r < 0 ? constRow : src.data(r);
+							}
+
+							if (tileInteriorBegin < tileInteriorEnd) {
+								for (size_t a = 0; a < funcRows; ++a) {
+									windowRows[a] = srcRows[a] + (tileInteriorBegin - padBefore);
+								}
+
+								rowKernel(ch, i, windowRows.data(), tileInteriorBegin, tileInteriorEnd - tileInteriorBegin);
+							}
+
+							for (auto[from, to] : strips) {
+								if (from >= to) {
+									continue;
+								}
+
+								for (size_t a = 0; a < funcRows; ++a) {
+									T *line = lines.data() + a * lineWidth;
+									for (size_t x = 0; x < to - from + funcCols - 1; ++x) {
+										long c = colMap[from + x];
+										line[x] = c < 0 ? initValue : srcRows[a][c];
+									}
+
+									windowRows[a] = line;
+								}
+
+								rowKernel(ch, i, windowRows.data(), from, to - from);
+							}
+						}
+					}
+				});
+			};
+
+			group = settings.fuseChannels ? std::max<size_t>(1, std::min(group, count)) : 1;
+			if (group == count) {
+				runChannels(0, count);
+			} else {
+				// The tiles of a group run on the threads too, so small frames still use all of them
+				forEachTask((count + group - 1) / group, settings, [&](size_t g) {
+					runChannels(g * group, std::min(count, (g + 1) * group));
+				});
+			}
+		}
+
+		/**
+		 * Expands a map of the padded columns to the elements of interleaved rows
+		 * @param stride number of interleaved channels
+		 */
+		std::vector<long> interleaveMap(const std::vector<long> &map, size_t stride) {
+			std::vector<long> result(map.size() * stride);
+			for (size_t j = 0; j < map.size(); ++j) {
+				for (size_t ch = 0; ch < stride; ++ch) {
+					result[j * stride + ch] = map[j] < 0 ? -1 : map[j] * stride + ch;
+				}
+			}
+
+			return result;
+		}
+
+		/**
+		 * Pads a matrix by the index maps of a PadModel
+		 * @param dst the padded matrix, it's resized only if its shape differs
+		 */
+		template<typename T, typename Source>
+		void remap(const Source &src, const std::vector<long> &rowMap, const std::vector<long> &colMap,
+				   T initValue, blaze::DynamicMatrix<T> &dst) {
+			remap(src, rowMap.data(), rowMap.size(), colMap.data(), colMap.size(), initValue, dst);
+		}
+
+		/**
+		 * Pads a part of a matrix: rows x cols elements of the padded matrix from the first ones of the maps
+		 * @param dst the part of the padded matrix, it's resized only if its shape differs
+		 */
+		template<typename T, typename Source>
+		void remap(const Source &src, const long *rowMap, size_t rows, const long *colMap, size_t cols,
+				   T initValue, blaze::DynamicMatrix<T> &dst) {
+			if (dst.rows() != rows || dst.columns() != cols) {
+				dst.resize(rows, cols, false);
+			}
+
+			for (size_t i = 0; i < dst.rows(); ++i) {
+				for (size_t j = 0; j < dst.columns(); ++j) {
+					bool filled = rowMap[i] < 0 || colMap[j] < 0;
+					dst(i, j) = filled ? initValue : static_cast<T>(src(rowMap[i], colMap[j]));
+				}
+			}
+		}
+
+		/**
+		 * Checks if the settings lead to the same plan
+		 */
+		bool samePlan(const ConvolutionSettings &a, const ConvolutionSettings &b) {
+			return a.engine == b.engine && a.separableTolerance == b.separableTolerance
+				   && a.fftCostFactor == b.fftCostFactor && a.fixedPoint == b.fixedPoint
+				   && a.virtualPadding == b.virtualPadding && a.chain == b.chain;
+		}
+
+		/**
+		 * Prepares the plan for the input, the kernel and the padding, if the plan was prepared
+		 * for other ones (the first call for a shape allocates, the next ones don't)
+		 * @param rows number of rows of the input
+		 * @param columns number of columns of the input in elements
+		 * @param stride number of interleaved channels of the input
+		 * @param stages the kernels of the stages of a chain, it's fused if it's cheaper than the kernel
+		 */
+		template<typename ChannelType>
+		void preparePlan(ConvolutionPlan &plan, size_t rows, size_t columns, size_t stride,
+						 const PadModel<ChannelType> &padmodel, const FilterKernel &kernel,
+						 const ConvolutionSettings &settings, const std::vector<FilterKernel> &stages) {
+			bool same = plan.rows == rows && plan.columns == columns && plan.stride == stride
+						&& plan.padDirection == padmodel.padDirection() && plan.padType == padmodel.padType()
+						&& plan.initValue == static_cast<double>(padmodel.initValue())
+						&& samePlan(plan.settings, settings)
+						&& plan.kernel.rows() == kernel.rows() && plan.kernel.columns() == kernel.columns()
+						&& plan.kernel == kernel;
+			if (same) {
+				return;
+			}
+
+			Shape padShape{kernel.rows() - 1, kernel.columns() - 1};
+			plan.rows = rows;
+			plan.columns = columns;
+			plan.padDirection = padmodel.padDirection();
+			plan.padType = padmodel.padType();
+			plan.initValue = static_cast<double>(padmodel.initValue());
+			plan.rowMap = padmodel.indexMap(padShape[0], rows);
+			plan.colMap = interleaveMap(padmodel.indexMap(padShape[1], columns / stride), stride);
+			plan.padBefore = padmodel.padBefore(padShape[1]) * stride;
+			prepareEngine<ChannelType>(plan, plan.rowMap.size(), plan.colMap.size(), kernel, settings, stride);
+
+			plan.fused = false;
+			plan.stageKernels.clear();
+			plan.stageTaps.clear();
+			if (stages.size() > 1 && settings.chain != ChainMode::MERGED) {
+				double fusedCost = 0;
+				for (const auto &stage : stages) {
+					plan.stageKernels.push_back(spreadKernel(stage, stride));
+					plan.stageTaps.push_back(kernelTaps(plan.stageKernels.back()));
+					fusedCost += plan.stageTaps.back().size();
+				}
+
+				double mergedCost = engineCost(plan.engine, plan.rowMap.size(), plan.colMap.size() / stride, kernel,
+											   settings, plan.separable);
+				plan.fused = settings.chain == ChainMode::FUSED || fusedCost < mergedCost;
+			}
+		}
+
+		/**
+		 * Returns the shape of the result of the filter and its position in the full result (in pixels)
+		 * @param shape shape of the result
+		 */
+		template<typename ChannelType>
+		std::pair<Shape, Shape> filteredShape(size_t rows, size_t columns, const PadModel<ChannelType> &padmodel,
+											  const FilterKernel &kernel, FilterShape shape) {
+			Shape padShape{kernel.rows() - 1, kernel.columns() - 1};
+			if (shape == FilterShape::SAME) {
+				// The centre of the kernel is at (size - 1) / 2 as in Matlab, so an even kernel is before the middle
+				if (padmodel.padDirection() != PadDirection::BOTH) {
+					return std::make_pair(Shape{rows, columns}, Shape{0, 0});
+				}
+
+				return std::make_pair(Shape{rows, columns},
+									  Shape{padShape[0] - padShape[0] / 2, padShape[1] - padShape[1] / 2});
+			}
+
+			if (shape == FilterShape::VALID) {
+				if (rows <= padShape[0] || columns <= padShape[1]) {
+					return std::make_pair(Shape{0, 0}, Shape{0, 0});
+				}
+
+				return std::make_pair(Shape{rows - padShape[0], columns - padShape[1]},
+									  Shape{padmodel.padBefore(padShape[0]), padmodel.padBefore(padShape[1])});
+			}
+
+			auto fullShape = correlationShape(padmodel.paddedSize(padShape[0], rows),
+											  padmodel.paddedSize(padShape[1], columns), kernel);
+			return std::make_pair(Shape{fullShape.resultRows, fullShape.resultCols}, Shape{0, 0});
+		}
+
+		/**
+		 * Computes the stages of a chain one after another over line buffers, so the intermediate results
+		 * don't leave the cache: each row of a stage is computed once from the last rows of the previous stage,
+		 * which are kept in a ring of stage.rows() lines. The bands of rows run on the threads,
+		 * each band computes the intermediate rows of its halo again.
+		 * @param sources callable (ch) which returns the channel ch, a matrix with data(row) access
+		 * @param outputs callable (ch) which returns the output of the channel ch
+		 * @param region rows [region[0], region[1]) and columns [region[2], region[3]) of the result to compute
+		 * @param rowBegin first row of the outputs in the result
+		 * @param colBegin first column of the outputs in the result (in elements)
+		 */
+		template<typename ChannelType, typename Sources, typename Outputs>
+		void correlateFused(Sources sources, Outputs outputs, size_t count, const ConvolutionPlan &plan,
+							double initValue, const blaze::StaticVector<size_t, 4> &region, size_t rowBegin,
+							size_t colBegin, const ConvolutionSettings &settings) {
+			size_t stages = plan.stageKernels.size();
+			size_t rows = region[1] - region[0];
+			size_t width = region[3] - region[2];
+			if (rows == 0 || width == 0) {
+				return;
+			}
+
+			size_t haloRows = 0;
+			size_t maxRows = 0;
+			for (const auto &stageKernel : plan.stageKernels) {
+				haloRows += stageKernel.rows() - 1;
+				maxRows = std::max(maxRows, stageKernel.rows());
+			}
+
+			size_t bandRows = std::max<size_t>(1, settings.tileRows);
+			size_t bands = (rows + bandRows - 1) / bandRows;
+			forEachTask(count * bands, settings, [&](size_t task) {
+				size_t ch = task / bands;
+				size_t bandBegin = region[0] + task % bands * bandRows;
+				size_t bandEnd = std::min(bandBegin + bandRows, region[1]);
+				const auto &src = sources(ch);
+				auto &output = outputs(ch);
+
+				// Scratch of the thread, it keeps its capacity between calls
+				thread_local std::vector<std::vector<double>> rings;
+				thread_local std::vector<size_t> lineWidths;
+				thread_local std::vector<const double *> windowRows;
+				thread_local std::vector<double> sums;
+				rings.resize(stages);
+				lineWidths.resize(stages + 1);
+				windowRows.resize(maxRows);
+				sums.resize(width);
+
+				// The input of a stage is wider than its output by the columns of its kernel
+				lineWidths[stages] = width;
+				for (size_t s = stages; s-- > 0;) {
+					lineWidths[s] = lineWidths[s + 1] + plan.stageKernels[s].columns() - 1;
+					rings[s].resize(plan.stageKernels[s].rows() * lineWidths[s]);
+				}
+
+				for (size_t t = 0; t < bandEnd - bandBegin + haloRows; ++t) {
+					long r = plan.rowMap[bandBegin + t];
+					double *line = rings[0].data() + t % plan.stageKernels[0].rows() * lineWidths[0];
+					for (size_t x = 0; x < lineWidths[0]; ++x) {
+						long c = plan.colMap[region[2] + x];
+						line[x] = r < 0 || c < 0 ? initValue : static_cast<double>(src.data(r)[c]);
+					}
+
+					// Each new row of a stage gives at most one row of the next stage
+					size_t q = t;
+					for (size_t s = 0; s < stages; ++s) {
+						size_t funcRows = plan.stageKernels[s].rows();
+						if (q + 1 < funcRows) {
+							break;
+						}
+
+						q -= funcRows - 1;
+						for (size_t a = 0; a < funcRows; ++a) {
+							windowRows[a] = rings[s].data() + (q + a) % funcRows * lineWidths[s];
+						}
+
+						if (s + 1 < stages) {
+							double *next = rings[s + 1].data() + q % plan.stageKernels[s + 1].rows() * lineWidths[s + 1];
+							correlateRow(windowRows.data(), plan.stageTaps[s], next, lineWidths[s + 1]);
+							continue;
+						}
+
+						correlateRow(windowRows.data(), plan.stageTaps[s], sums.data(), width);
+						ChannelType *out = output.data(bandBegin + q - rowBegin) + (region[2] - colBegin);
+						for (size_t x = 0; x < width; ++x) {
+							double val = blaze::round(sums[x]);
+							out[x] = saturate<ChannelType>(val > 0 ? val : 0);
+						}
+					}
+				}
+			});
+		}
+
+		/**
+		 * Computes the recursive Gaussian of the padded channels: each padded row (read through the index maps
+		 * of the plan) is filtered and the columns of the region are kept, then the columns are filtered
+		 * row by row, so both passes read the memory sequentially
+		 * @param sources callable (ch) which returns the channel ch, a matrix with data(row) access
+		 * @param outputs callable (ch) which returns the output of the channel ch
+		 * @param region rows [region[0], region[1]) and columns [region[2], region[3]) of the result to compute
+		 * @param rowBegin first row of the outputs in the result
+		 * @param colBegin first column of the outputs in the result (in elements)
+		 * @param rows buffer of the rows of the horizontal pass
+		 */
+		template<typename ChannelType, typename Sources, typename Outputs>
+		void correlateRecursive(Sources sources, Outputs outputs, size_t count, const ConvolutionPlan &plan,
+								const RecursiveGaussian &gaussian, double initValue,
+								const blaze::StaticVector<size_t, 4> &region, size_t rowBegin, size_t colBegin,
+								const ConvolutionSettings &settings, blaze::DynamicMatrix<double> &rows) {
+			size_t stride = plan.stride;
+			size_t paddedRows = plan.rowMap.size();
+			size_t paddedCols = plan.colMap.size();
+			size_t width = region[3] - region[2];
+			if (region[1] == region[0] || width == 0) {
+				return;
+			}
+
+			// The result (i, j) is the Gaussian at the center of the kernel over the padded (i, j)
+			size_t centerRow = (plan.kernel.rows() - 1) / 2;
+			size_t centerCol = (plan.kernel.columns() - 1) / 2 * stride;
+			size_t threads = threadCount(settings);
+			if (rows.rows() != paddedRows || rows.columns() != width) {
+				rows.resize(paddedRows, width, false);
+			}
+
+			double gain = gaussian.gain;
+			double a0 = gaussian.a[0];
+			double a1 = gaussian.a[1];
+			double a2 = gaussian.a[2];
+			const auto &end = gaussian.end;
+
+			size_t rowTasks = std::min(threads, paddedRows);
+			size_t rowsPerTask = (paddedRows + rowTasks - 1) / rowTasks;
+			size_t columnTasks = std::max<size_t>(1, std::min(threads, width / 64));
+			size_t columnsPerTask = (width + columnTasks - 1) / columnTasks;
+			for (size_t ch = 0; ch < count; ++ch) {
+				const auto &source = sources(ch);
+				// The rows are filtered by groups whose recursions run together, element by element
+				forEachTask(rowTasks, settings, [&](size_t task) {
+					constexpr size_t lanes = 8;
+					thread_local std::vector<double> group;
+					group.resize(paddedCols * lanes);
+					size_t taskEnd = std::min(paddedRows, (task + 1) * rowsPerTask);
+					for (size_t p = task * rowsPerTask; p < taskEnd; p += lanes) {
+						size_t count = std::min(lanes, taskEnd - p);
+						for (size_t r = 0; r < count; ++r) {
+							long row = plan.rowMap[p + r];
+							for (size_t e = 0; e < paddedCols; ++e) {
+								long col = plan.colMap[e];
+								group[e * lanes + r] =
+										row < 0 || col < 0 ? initValue : static_cast<double>(source.data(row)[col]);
+							}
+						}
+
+						for (size_t c = 0; c < stride; ++c) {
+							if (count == lanes) {
+								recursiveLines<lanes>(gaussian, group.data() + c * lanes, paddedCols / stride,
+													  stride * lanes);
+								continue;
+							}
+
+							for (size_t r = 0; r < count; ++r) {
+								recursiveLines<1>(gaussian, group.data() + c * lanes + r, paddedCols / stride,
+												  stride * lanes);
+							}
+						}
+
+						for (size_t r = 0; r < count; ++r) {
+							double *out = rows.data(p + r);
+							for (size_t j = 0; j < width; ++j) {
+								out[j] = group[(region[2] + j + centerCol) * lanes + r];
+							}
+						}
+					}
+				});
+
+				forEachTask(columnTasks, settings, [&](size_t task) {
+					size_t jBegin = task * columnsPerTask;
+					size_t n = std::min(width, jBegin + columnsPerTask) - std::min(width, jBegin);
+					if (n == 0) {
+						return;
+					}
+
+					// The first and the last input rows are the input before and after the column
+					thread_local std::vector<double> first, last, tail[3];
+					auto at = [&](size_t p) { return rows.data(p) + jBegin; };
+					first.assign(at(0), at(0) + n);
+					last.assign(at(paddedRows - 1), at(paddedRows - 1) + n);
+
+					for (size_t p = 0; p < paddedRows; ++p) {
+						const double *w1 = p >= 1 ? at(p - 1) : first.data();
+						const double *w2 = p >= 2 ? at(p - 2) : first.data();
+						const double *w3 = p >= 3 ? at(p - 3) : first.data();
+						double *w = at(p);
+						for (size_t j = 0; j < n; ++j) {
+							w[j] = gain * w[j] + a0 * w1[j] + a1 * w2[j] + a2 * w3[j];
+						}
+					}
+
+					const double *w0 = at(paddedRows - 1);
+					const double *w1 = paddedRows >= 2 ? at(paddedRows - 2) : first.data();
+					const double *w2 = paddedRows >= 3 ? at(paddedRows - 3) : first.data();
+					for (size_t k = 0; k < 3; ++k) {
+						tail[k].resize(n);
+						for (size_t j = 0; j < n; ++j) {
+							tail[k][j] = end[k][0] * w0[j] + end[k][1] * w1[j] + end[k][2] * w2[j] + end[k][3] * last[j];
+						}
+					}
+
+					// Only the rows of the region are needed, the rows before it don't change them
+					auto next = [&](size_t p) { return p < paddedRows ? at(p) : tail[p - paddedRows].data(); };
+					for (size_t p = paddedRows; p-- > region[0] + centerRow;) {
+						const double *y1 = next(p + 1);
+						const double *y2 = next(p + 2);
+						const double *y3 = next(p + 3);
+						double *y = at(p);
+						for (size_t j = 0; j < n; ++j) {
+							y[j] = gain * y[j] + a0 * y1[j] + a1 * y2[j] + a2 * y3[j];
+						}
+					}
+
+					auto &output = outputs(ch);
+					for (size_t i = region[0]; i < region[1]; ++i) {
+						const double *y = at(i + centerRow);
+						ChannelType *out = output.data(i - rowBegin) + (region[2] + jBegin - colBegin);
+						for (size_t j = 0; j < n; ++j) {
+							double val = blaze::round(y[j]);
+							out[j] = saturate<ChannelType>(val > 0 ? val : 0);
+						}
+					}
+				});
+			}
+		}
+
+		/**
+		 * Resizes a matrix if its shape differs, the memory is reused if it's enough
+		 */
+		template<typename T>
+		void reshape(blaze::DynamicMatrix<T> &matrix, size_t rows, size_t columns) {
+			if (matrix.rows() != rows || matrix.columns() != columns) {
+				matrix.resize(rows, columns, false);
+			}
+		}
+
+		/**
+		 * Convolutes channels of the same shape with the padding of the model and writes the results
+		 * into the outputs. The kernel is prepared once for all of them: in fixed-point for uint8_t and uint16_t
+		 * if the direct engine is cheap enough (it has twice more SIMD lanes), else by the engine which imgcov2
+		 * would choose. The direct engines don't pad the channels if settings.virtualPadding is set,
+		 * and compute only the pixels of the outputs. The stages of a chain (workspace.stages) are fused
+		 * if it's cheaper than the merged kernel.
+		 * @param channels callable (ch) which returns the channel ch: Channel or ChannelView
+		 * @param outputs callable (ch) which returns the output of the channel ch, all of the same shape,
+		 * they receive the part of the full result from the origin
+		 * @param count number of channels
+		 * @param origin position of the outputs in the full result (in pixels)
+		 * @param stride number of interleaved channels in the rows of each matrix (1 for a planar channel)
+		 * @param workspace the plan and the buffers which are reused between calls
+		 * @param group number of channels of a frame, the tiles of the direct engines compute them together
+		 * (0 means all channels are one frame)
+		 */
+		template<typename ChannelType, typename Accumulator, typename Sources, typename Outputs>
+		void convolve(Sources channels, Outputs outputs, size_t count, const Shape &origin,
+					  const PadModel<ChannelType> &padmodel, const FilterKernel &kernel,
+					  const ConvolutionSettings &settings, size_t stride,
+					  FilterWorkspace<ChannelType, Accumulator> &workspace, size_t group = 0) {
+			constexpr bool integer = std::is_same<ChannelType, uint8_t>::value || std::is_same<ChannelType, uint16_t>::value;
+			auto &plan = workspace.plan;
+			auto &profile = workspace.profile;
+			size_t srcCols = channels(0).columns();
+
+			// The recursive Gaussian needs only the index maps and the shape, not the engines of the kernel
+			bool recursive = workspace.recursive.sigma > 0 && (settings.engine == ConvolutionEngine::AUTO
+															   || settings.engine == ConvolutionEngine::RECURSIVE);
+			// The rank, morphological and bilateral filters aren't convolutions, they read the padded channel only
+			bool ordered = workspace.ranked || workspace.morphological || workspace.bilateral;
+			ConvolutionSettings planSettings = settings;
+			if (recursive || ordered) {
+				planSettings.engine = ConvolutionEngine::DIRECT;
+				planSettings.fixedPoint = false;
+			}
+
+			{
+				StageTimer<> timer(profile, FilterStage::PLAN, 0, 0);
+				preparePlan(plan, channels(0).rows(), srcCols, stride, padmodel, kernel, planSettings,
+							workspace.stages);
+			}
+			group = group == 0 ? count : group;
+			ConvolutionSettings tileSettings = settings;
+			tileSettings.tileColumns *= stride;
+
+			const auto &shape = plan.shape;
+			size_t rowBegin = origin[0];
+			size_t colBegin = origin[1] * stride;
+			size_t outRows = outputs(0).rows();
+			size_t outCols = outputs(0).columns();
+
+			// The valid correlation of the padded channel, it's larger than the full result for a kernel of one row
+			// (column), the outputs of FilterShape::SAME can take all of it
+			size_t validRows = plan.rowMap.size() + 1 - std::min(plan.rowMap.size() + 1, plan.kernel.rows());
+			size_t validCols = plan.colMap.size() + 1 - std::min(plan.colMap.size() + 1, plan.spread.columns());
+			size_t limitRows = std::max(shape.resultRows, validRows);
+			size_t limitCols = std::max(shape.resultCols, validCols);
+			if (rowBegin > limitRows || outRows > limitRows - rowBegin
+				|| colBegin > limitCols || outCols > limitCols - colBegin) {
+				throw std::invalid_argument("the output is out of the result of the filter");
+			}
+
+			// Only the part of the outputs inside the computed region, the rest is 0 as in imgcov2
+			blaze::StaticVector<size_t, 4> region{rowBegin, std::max(rowBegin, std::min(rowBegin + outRows, validRows)),
+												  colBegin, std::max(colBegin, std::min(colBegin + outCols, validCols))};
+			size_t outputPixels = count * outRows * outCols;
+			size_t computedPixels = count * (region[1] - region[0]) * (region[3] - region[2]);
+			auto clearOutside = [&] {
+				StageTimer<> timer(profile, FilterStage::CROP, (outputPixels - computedPixels) * sizeof(ChannelType),
+								   outputPixels - computedPixels);
+				for (size_t ch = 0; ch < count; ++ch) {
+					auto &output = outputs(ch);
+					for (size_t i = 0; i < outRows; ++i) {
+						bool computed = rowBegin + i < region[1];
+						for (size_t j = computed ? region[3] - colBegin : 0; j < outCols; ++j) {
+							output(i, j) = 0;
+						}
+					}
+				}
+			};
+
+			if (plan.fused) {
+				clearOutside();
+				StageTimer<> timer(profile, FilterStage::CORRELATE, computedPixels * sizeof(ChannelType), computedPixels);
+				correlateFused<ChannelType>(channels, outputs, count, plan, static_cast<double>(padmodel.initValue()),
+											region, rowBegin, colBegin, settings);
+				return;
+			}
+
+			if (recursive) {
+				clearOutside();
+				StageTimer<> timer(profile, FilterStage::CORRELATE, computedPixels * sizeof(ChannelType), computedPixels);
+				correlateRecursive<ChannelType>(channels, outputs, count, plan, workspace.recursive,
+												static_cast<double>(padmodel.initValue()), region, rowBegin,
+												colBegin, settings, workspace.recursiveRows);
+				return;
+			}
+
+			// The static kernel of the filter replaces the direct engines
+			bool direct = settings.engine == ConvolutionEngine::AUTO || settings.engine == ConvolutionEngine::DIRECT;
+			bool staticKernel = workspace.staticRow && (!workspace.rotated || workspace.symmetric);
+			if (staticKernel && settings.virtualPadding && direct) {
+				clearOutside();
+				auto staticRow = workspace.staticRow;
+				workspace.constRow.assign(srcCols, padmodel.initValue());
+				StageTimer<> timer(profile, FilterStage::CORRELATE, computedPixels * sizeof(ChannelType), computedPixels);
+				correlateVirtual(channels, count, group, plan.rowMap, plan.colMap, plan.padBefore,
+								 workspace.constRow.data(), padmodel.initValue(), plan.kernel.rows(),
+								 plan.spread.columns(), region, tileSettings,
+								 [&](size_t ch, size_t i, const ChannelType *const *windowRows, size_t j, size_t n) {
+							staticRow(windowRows, outputs(ch).data(i - rowBegin) + (j - colBegin), n, stride);
+						});
+
+				return;
+			}
+
+			if (ordered || !settings.virtualPadding
+				|| (!plan.fixed && plan.engine != ConvolutionEngine::DIRECT)) {
+				// The engines of the padded matrix work on the whole channel, so the channels run concurrently.
+				// Each task has its buffers and takes every slots-th channel, so a batch of many frames
+				// needs the buffers of the threads only
+				size_t slots = std::min(count, threadCount(settings));
+				if (workspace.padded.size() < slots) {
+					workspace.padded.resize(slots);
+					workspace.results.resize(slots);
+					workspace.fft.resize(slots);
+					workspace.paddedChannels.resize(slots);
+					workspace.resultChannels.resize(slots);
+				}
+
+				// Only the padded rows and columns under the region are remapped,
+				// so the engines compute the pixels of the outputs and nothing else
+				ChannelType fill = workspace.morphological ? morphologyFill<ChannelType>(workspace.morphology)
+														   : padmodel.initValue();
+				size_t regionRows = region[1] - region[0];
+				size_t regionCols = region[3] - region[2];
+				bool empty = regionRows == 0 || regionCols == 0;
+				size_t paddedRows = empty ? 0 : regionRows + plan.kernel.rows() - 1;
+				size_t paddedCols = empty ? 0 : regionCols + plan.spread.columns() - 1;
+				const long *rowMap = plan.rowMap.data() + region[0];
+				const long *colMap = plan.colMap.data() + region[2];
+				size_t paddedPixels = paddedRows * paddedCols;
+				size_t resultPixels = regionRows * regionCols;
+
+				// The region is at the top left of the outputs, the rest of them is 0
+				auto copyRegion = [&](size_t ch, const auto &result) {
+					StageTimer<> timer(profile, FilterStage::CROP, outRows * outCols * sizeof(ChannelType),
+									   outRows * outCols);
+					auto &output = outputs(ch);
+					for (size_t i = 0; i < outRows; ++i) {
+						ChannelType *out = output.data(i);
+						size_t j = 0;
+						if (i < regionRows) {
+							for (; j < regionCols; ++j) {
+								out[j] = saturate<ChannelType>(result(i, j));
+							}
+						}
+
+						for (; j < outCols; ++j) {
+							out[j] = 0;
+						}
+					}
+				};
+
+				forEachTask(slots, settings, [&](size_t slot) {
+					for (size_t ch = slot; ch < count; ch += slots) {
+						// The non-linear and the fixed-point engines work in the type of the channel
+						if (ordered || (integer && plan.fixed)) {
+							auto &padded = workspace.paddedChannels[slot];
+							auto &result = workspace.resultChannels[slot];
+							reshape(result, regionRows, regionCols);
+							if (!empty) {
+								{
+									StageTimer<> timer(profile, FilterStage::PAD,
+													   paddedPixels * sizeof(ChannelType), paddedPixels);
+									remap(channels(ch), rowMap, paddedRows, colMap, paddedCols, fill, padded);
+								}
+
+								StageTimer<> timer(profile, FilterStage::CORRELATE,
+												   resultPixels * sizeof(ChannelType), resultPixels);
+								if (workspace.ranked) {
+									rankFilter(padded, plan.kernel.rows(), plan.kernel.columns(), workspace.rank,
+											   result, regionRows, regionCols, settings, stride);
+								} else if (workspace.morphological) {
+									morphologyFilter(padded, workspace.element, workspace.morphology, result,
+													 regionRows, regionCols, settings, stride);
+								} else if (workspace.bilateral) {
+									bilateralFilter(padded, plan.kernel.rows(), workspace.spatialSigma,
+													workspace.rangeSigma, result, regionRows, regionCols, settings,
+													stride);
+								} else if constexpr (integer) {
+									correlateFixed(padded, plan, settings, result, regionRows, regionCols);
+								}
+							}
+
+							copyRegion(ch, result);
+							continue;
+						}
+
+						auto &padded = workspace.padded[slot];
+						auto &result = workspace.results[slot];
+						if (result.rows() != regionRows || result.columns() != regionCols) {
+							result.resize(regionRows, regionCols, false);
+						}
+
+						if (!empty) {
+							{
+								StageTimer<> timer(profile, FilterStage::PAD, paddedPixels * sizeof(Accumulator),
+												   paddedPixels);
+								remap(channels(ch), rowMap, paddedRows, colMap, paddedCols,
+									  static_cast<Accumulator>(padmodel.initValue()), padded);
+							}
+
+							StageTimer<> timer(profile, FilterStage::CORRELATE, resultPixels * sizeof(Accumulator),
+											   resultPixels);
+							correlate(padded, plan, settings, result, regionRows, regionCols, workspace.fft[slot]);
+						}
+
+						copyRegion(ch, result);
+					}
+				});
+
+				return;
+			}
+
+			clearOutside();
+			size_t funcRows = plan.kernel.rows();
+			size_t funcCols = plan.spread.columns();
+
+			if constexpr (integer) {
+				if (plan.fixed) {
+					const auto &fixedKernel = plan.fixedKernel;
+					workspace.constRow.assign(srcCols, padmodel.initValue());
+					StageTimer<> timer(profile, FilterStage::CORRELATE, computedPixels * sizeof(ChannelType),
+									   computedPixels);
+					correlateVirtual(channels, count, group, plan.rowMap, plan.colMap, plan.padBefore,
+									 workspace.constRow.data(), padmodel.initValue(), funcRows, funcCols, region,
+									 tileSettings,
+									 [&](size_t ch, size_t i, const ChannelType *const *windowRows, size_t j, size_t n) {
+								correlateRowFixed(windowRows, fixedKernel.taps, fixedKernel.shift,
+												  outputs(ch).data(i - rowBegin) + (j - colBegin), n);
+							});
+
+					return;
+				}
+			}
+
+			const auto &taps = planTaps<Accumulator>(plan);
+			size_t firstChannel = 0;
+			auto rowKernel = [&](size_t ch, size_t i, const Accumulator *const *windowRows, size_t j, size_t n) {
+				thread_local std::vector<Accumulator> sums;
+				sums.resize(n);
+				correlateRow(windowRows, taps, sums.data(), n);
+
+				ChannelType *out = outputs(firstChannel + ch).data(i - rowBegin) + (j - colBegin);
+				for (size_t x = 0; x < n; ++x) {
+					Accumulator val = blaze::round(sums[x]);
+					out[x] = saturate<ChannelType>(val > 0 ? val : 0);
+				}
+			};
+
+			Accumulator initValue = static_cast<Accumulator>(padmodel.initValue());
+			workspace.constRowAccumulator.assign(srcCols, initValue);
+			if constexpr (std::is_same<ChannelType, Accumulator>::value) {
+				StageTimer<> timer(profile, FilterStage::CORRELATE, computedPixels * sizeof(ChannelType), computedPixels);
+				correlateVirtual(channels, count, group, plan.rowMap, plan.colMap, plan.padBefore,
+								 workspace.constRowAccumulator.data(), initValue, funcRows, funcCols, region,
+								 tileSettings, rowKernel);
+			} else {
+				// The frames of a batch are converted by chunks which keep the threads busy
+				size_t chunk = group == count ? count : group * threadCount(settings);
+				if (workspace.sources.size() < std::min(chunk, count)) {
+					workspace.sources.resize(std::min(chunk, count));
+				}
+
+				for (firstChannel = 0; firstChannel < count; firstChannel += chunk) {
+					size_t chunkCount = std::min(chunk, count - firstChannel);
+					{
+						size_t sourcePixels = chunkCount * channels(0).rows() * srcCols;
+						StageTimer<> timer(profile, FilterStage::CONVERT, sourcePixels * sizeof(Accumulator),
+										   sourcePixels);
+						for (size_t ch = 0; ch < chunkCount; ++ch) {
+							workspace.sources[ch] = channels(firstChannel + ch);
+						}
+					}
+
+					StageTimer<> timer(profile, FilterStage::CORRELATE,
+									   computedPixels * chunkCount / count * sizeof(ChannelType),
+									   computedPixels * chunkCount / count);
+					correlateVirtual([&](size_t ch) -> const Channel<Accumulator> & { return workspace.sources[ch]; },
+									 chunkCount, group, plan.rowMap, plan.colMap, plan.padBefore,
+									 workspace.constRowAccumulator.data(), initValue, funcRows, funcCols, region,
+									 tileSettings, rowKernel);
+				}
+			}
+		}
+
+		template<typename Filter, typename ChannelType, typename Accumulator>
+		Channel <ChannelType>
+		filter(const Channel <ChannelType> &channel, const Filter &impl,
+				 const PadModel <ChannelType> &padmodel, FilterShape filterShape,
+				 const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			Channel<ChannelType> result;
+			filter(channel, result, impl, padmodel, filterShape, settings, workspace);
+			return result;
+		}
+
+		template<typename Filter, typename ChannelType, typename Accumulator>
+		void filter(const Channel<ChannelType> &channel, Channel<ChannelType> &output, const Filter &impl,
+					const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			auto[shape, origin] = filteredShape(channel.rows(), channel.columns(), padmodel, kernel, filterShape);
+			reshape(output, shape[0], shape[1]);
+			convolve([&](size_t) -> const Channel<ChannelType> & { return channel; },
+					 [&](size_t) -> Channel<ChannelType> & { return output; },
+					 1, origin, padmodel, kernel, settings, 1, ws);
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		Image <ChannelType, ChannelNumber>
+		filter(const Image <ChannelType, ChannelNumber> &img, const Filter &impl,
+				 const PadModel <ChannelType> &padmodel, FilterShape filterShape,
+				 const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			Image<ChannelType, ChannelNumber> result;
+			filter(img, result, impl, padmodel, filterShape, settings, workspace);
+			return result;
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		void filter(const Image<ChannelType, ChannelNumber> &img, Image<ChannelType, ChannelNumber> &output,
+					const Filter &impl, const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+
+			// Channels of the same shape are filtered in one pass, the others on their own
+			std::array<bool, ChannelNumber> done{};
+			for (size_t first = 0; first < img.size(); ++first) {
+				if (done[first]) {
+					continue;
+				}
+
+				std::array<size_t, ChannelNumber> group;
+				size_t count = 0;
+				for (size_t ch = first; ch < img.size(); ++ch) {
+					if (!done[ch] && img[ch].rows() == img[first].rows() && img[ch].columns() == img[first].columns()) {
+						done[ch] = true;
+						group[count++] = ch;
+					}
+				}
+
+				auto[shape, origin] = filteredShape(img[first].rows(), img[first].columns(), padmodel, kernel,
+													filterShape);
+				for (size_t k = 0; k < count; ++k) {
+					reshape(output[group[k]], shape[0], shape[1]);
+				}
+
+				convolve([&](size_t k) -> const Channel<ChannelType> & { return img[group[k]]; },
+						 [&](size_t k) -> Channel<ChannelType> & { return output[group[k]]; },
+						 count, origin, padmodel, kernel, settings, 1, ws);
+			}
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		InterleavedImage<ChannelType, ChannelNumber>
+		filter(const InterleavedImage<ChannelType, ChannelNumber> &img, const Filter &impl,
+				 const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+				 const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			InterleavedImage<ChannelType, ChannelNumber> result;
+			filter(img, result, impl, padmodel, filterShape, settings, workspace);
+			return result;
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		void filter(const InterleavedImage<ChannelType, ChannelNumber> &img,
+					InterleavedImage<ChannelType, ChannelNumber> &output,
+					const Filter &impl, const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			auto[shape, origin] = filteredShape(img.rows(), img.columns(), padmodel, kernel, filterShape);
+			if (output.rows() != shape[0] || output.columns() != shape[1]) {
+				output.resize(shape[0], shape[1]);
+			}
+
+			if (img.rows() == 0 || img.columns() == 0 || shape[0] == 0 || shape[1] == 0) {
+				return;
+			}
+
+			auto result = output.view();
+			convolve([&](size_t) -> const Channel<ChannelType> & { return img.matrix(); },
+					 [&](size_t) -> ChannelView<ChannelType> & { return result; },
+					 1, origin, padmodel, kernel, settings, ChannelNumber, ws);
+		}
+
+		template<typename Filter, typename ChannelType, typename Accumulator>
+		void filter(const ImageView<const ChannelType> &img, const ImageView<ChannelType> &output, const Filter &impl,
+					const PadModel<ChannelType> &padmodel, const ConvolutionSettings &settings,
+					FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			if (img.channels() != output.channels()) {
+				throw std::invalid_argument("the input and the output must have the same number of channels");
+			}
+
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			// The shape of the output chooses the shape of the result
+			Shape shape;
+			Shape origin;
+			bool found = false;
+			for (auto filterShape : {FilterShape::SAME, FilterShape::FULL, FilterShape::VALID}) {
+				std::tie(shape, origin) = filteredShape(img.rows(), img.columns(), padmodel, kernel, filterShape);
+				if (output.rows() == shape[0] && output.columns() == shape[1]) {
+					found = true;
+					break;
+				}
+			}
+
+			if (!found) {
+				throw std::invalid_argument("the output must have the shape of the input, of the full or of the valid result");
+			}
+
+			size_t channels = img.channels();
+			auto &inputViews = ws.inputViews;
+			auto &outputViews = ws.outputViews;
+			inputViews.clear();
+			outputViews.clear();
+			auto inputView = [&](size_t ch) -> const ChannelView<const ChannelType> & { return inputViews[ch]; };
+			auto outputView = [&](size_t ch) -> ChannelView<ChannelType> & { return outputViews[ch]; };
+
+			if (img.interleaved() && output.interleaved()) {
+				// Both are interleaved, so the rows are filtered as one wide matrix
+				inputViews.emplace_back(img.data(), img.rows(), img.columns() * channels, img.rowStride());
+				outputViews.emplace_back(output.data(), output.rows(), output.columns() * channels, output.rowStride());
+				convolve(inputView, outputView, 1, origin, padmodel, kernel, settings, channels, ws);
+				return;
+			}
+
+			if (img.pixelStride() == 1 && output.pixelStride() == 1) {
+				for (size_t ch = 0; ch < channels; ++ch) {
+					inputViews.push_back(img.channel(ch));
+					outputViews.push_back(output.channel(ch));
+				}
+
+				convolve(inputView, outputView, channels, origin, padmodel, kernel, settings, 1, ws);
+				return;
+			}
+
+			// Different layouts: gather the channels and scatter the results
+			auto &sources = ws.gathered;
+			auto &results = ws.scattered;
+			sources.resize(std::max(sources.size(), channels));
+			results.resize(std::max(results.size(), channels));
+			{
+				size_t pixels = channels * img.rows() * img.columns();
+				StageTimer<> timer(ws.profile, FilterStage::CONVERT, pixels * sizeof(ChannelType), pixels);
+				for (size_t ch = 0; ch < channels; ++ch) {
+					reshape(sources[ch], img.rows(), img.columns());
+					reshape(results[ch], shape[0], shape[1]);
+					for (size_t i = 0; i < img.rows(); ++i) {
+						for (size_t j = 0; j < img.columns(); ++j) {
+							sources[ch](i, j) = img(i, j, ch);
+						}
+					}
+				}
+			}
+
+			convolve([&](size_t ch) -> const Channel<ChannelType> & { return sources[ch]; },
+					 [&](size_t ch) -> Channel<ChannelType> & { return results[ch]; },
+					 channels, origin, padmodel, kernel, settings, 1, ws);
+
+			size_t pixels = channels * output.rows() * output.columns();
+			StageTimer<> timer(ws.profile, FilterStage::CONVERT, pixels * sizeof(ChannelType), pixels);
+			for (size_t ch = 0; ch < channels; ++ch) {
+				for (size_t i = 0; i < output.rows(); ++i) {
+					for (size_t j = 0; j < output.columns(); ++j) {
+						output(i, j, ch) = results[ch](i, j);
+					}
+				}
+			}
+		}
+
+		/**
+		 * Checks that all channels of a batch have the shape of the first one
+		 * @param channel callable (k) which returns the channel k
+		 */
+		template<typename Channels>
+		void checkBatchShape(Channels channel, size_t count) {
+			for (size_t k = 1; k < count; ++k) {
+				if (channel(k).rows() != channel(0).rows() || channel(k).columns() != channel(0).columns()) {
+					throw std::invalid_argument("the frames of a batch must have the same shape");
+				}
+			}
+		}
+
+		template<typename Filter, typename ChannelType, typename Accumulator>
+		void filter(const std::vector<Channel<ChannelType>> &frames, std::vector<Channel<ChannelType>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			auto input = [&](size_t k) -> const Channel<ChannelType> & { return frames[k]; };
+			checkBatchShape(input, frames.size());
+			outputs.resize(frames.size());
+			if (frames.empty()) {
+				return;
+			}
+
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			auto[shape, origin] = filteredShape(frames[0].rows(), frames[0].columns(), padmodel, kernel, filterShape);
+			for (auto &output : outputs) {
+				reshape(output, shape[0], shape[1]);
+			}
+
+			convolve(input, [&](size_t k) -> Channel<ChannelType> & { return outputs[k]; },
+					 frames.size(), origin, padmodel, kernel, settings, 1, ws, 1);
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		void filter(const std::vector<Image<ChannelType, ChannelNumber>> &frames,
+					std::vector<Image<ChannelType, ChannelNumber>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			// The channels of all frames are one sequence, a group is the channels of a frame
+			size_t count = frames.size() * ChannelNumber;
+			auto input = [&](size_t k) -> const Channel<ChannelType> & {
+				return frames[k / ChannelNumber][k % ChannelNumber];
+			};
+
+			checkBatchShape(input, count);
+			outputs.resize(frames.size());
+			if (count == 0) {
+				return;
+			}
+
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			auto[shape, origin] = filteredShape(input(0).rows(), input(0).columns(), padmodel, kernel, filterShape);
+			for (auto &output : outputs) {
+				for (auto &channel : output) {
+					reshape(channel, shape[0], shape[1]);
+				}
+			}
+
+			convolve(input, [&](size_t k) -> Channel<ChannelType> & { return outputs[k / ChannelNumber][k % ChannelNumber]; },
+					 count, origin, padmodel, kernel, settings, 1, ws, ChannelNumber);
+		}
+
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator>
+		void filter(const std::vector<InterleavedImage<ChannelType, ChannelNumber>> &frames,
+					std::vector<InterleavedImage<ChannelType, ChannelNumber>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel, FilterShape filterShape,
+					const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			auto input = [&](size_t k) -> const Channel<ChannelType> & { return frames[k].matrix(); };
+			checkBatchShape(input, frames.size());
+			outputs.resize(frames.size());
+			if (frames.empty()) {
+				return;
+			}
+
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+			auto[shape, origin] = filteredShape(frames[0].rows(), frames[0].columns(), padmodel, kernel, filterShape);
+			for (auto &output : outputs) {
+				if (output.rows() != shape[0] || output.columns() != shape[1]) {
+					output.resize(shape[0], shape[1]);
+				}
+			}
+
+			if (frames[0].rows() == 0 || frames[0].columns() == 0 || shape[0] == 0 || shape[1] == 0) {
+				return;
+			}
+
+			auto &results = ws.outputViews;
+			results.clear();
+			for (auto &output : outputs) {
+				results.push_back(output.view());
+			}
+
+			convolve(input, [&](size_t k) -> ChannelView<ChannelType> & { return results[k]; },
+					 frames.size(), origin, padmodel, kernel, settings, ChannelNumber, ws, 1);
+		}
+
+		template<typename Filter, typename ChannelType, typename Accumulator>
+		void filterStream(size_t rows, size_t columns, size_t channels, const RowReader<ChannelType> &reader,
+						  const RowWriter<ChannelType> &writer, const Filter &impl,
+						  const PadModel<ChannelType> &padmodel, size_t bandRows, FilterShape filterShape,
+						  const ConvolutionSettings &settings, FilterWorkspace<ChannelType, Accumulator> *workspace) {
+			constexpr bool integer = std::is_same<ChannelType, uint8_t>::value || std::is_same<ChannelType, uint16_t>::value;
+			if (bandRows == 0) {
+				throw std::invalid_argument("a band must have rows");
+			}
+
+			FilterWorkspace<ChannelType, Accumulator> temporary;
+			auto &ws = workspace ? *workspace : temporary;
+			beginCall(ws.profile);
+			const auto &kernel = ws.kernel(impl, settings.convolution);
+
+			Shape padShape{kernel.rows() - 1, kernel.columns() - 1};
+			size_t width = columns * channels;
+			auto rowMap = padmodel.indexMap(padShape[0], rows);
+			auto colMap = interleaveMap(padmodel.indexMap(padShape[1], columns), channels);
+			auto fullShape = correlationShape(rowMap.size(), colMap.size(), kernel, channels);
+			auto[shape, origin] = filteredShape(rows, columns, padmodel, kernel, filterShape);
+			size_t colBegin = origin[1] * channels;
+			size_t outWidth = shape[1] * channels;
+
+			// The valid correlation of the padded image, as in convolve
+			size_t spreadCols = padShape[1] * channels + 1;
+			size_t validRows = rowMap.size() + 1 - std::min(rowMap.size() + 1, kernel.rows());
+			size_t validCols = colMap.size() + 1 - std::min(colMap.size() + 1, spreadCols);
+			size_t limitRows = std::max(fullShape.resultRows, validRows);
+			size_t limitCols = std::max(fullShape.resultCols, validCols);
+			if (origin[0] > limitRows || shape[0] > limitRows - origin[0]
+				|| colBegin > limitCols || outWidth > limitCols - colBegin) {
+				throw std::invalid_argument("the output is out of the result of the filter");
+			}
+
+			// Only the columns of the output are computed, the columns after the valid ones are 0
+			size_t computedWidth = colBegin < validCols ? std::min(outWidth, validCols - colBegin) : 0;
+			size_t paddedCols = computedWidth + spreadCols - 1;
+
+			// Source rows of the band and of the previous one, sorted
+			std::vector<long> needed;
+			std::vector<long> cached;
+			std::vector<ChannelType> band;
+			std::vector<ChannelType> cache;
+			std::vector<long> bandMap;
+			std::vector<ChannelType> output;
+
+			ConvolutionPlan plan;
+			FFTWorkspace fftWorkspace;
+			blaze::DynamicMatrix<Accumulator> padded;
+			blaze::DynamicMatrix<Accumulator> result;
+			// The non-linear and the fixed-point engines work in the type of the channel
+			bool ordered = ws.ranked || ws.morphological || ws.bilateral;
+			blaze::DynamicMatrix<ChannelType> paddedChannel;
+			blaze::DynamicMatrix<ChannelType> resultChannel;
+
+			for (size_t outBegin = 0; outBegin < shape[0]; outBegin += bandRows) {
+				size_t outEnd = std::min(outBegin + bandRows, shape[0]);
+				size_t rowBegin = origin[0] + outBegin;
+				// Rows after the computed region are 0 as in imgcov2
+				size_t computedEnd = std::max(rowBegin, std::min(origin[0] + outEnd, validRows));
+				size_t computedRows = computedEnd - rowBegin;
+				output.assign((outEnd - outBegin) * outWidth, 0);
+				if (computedRows == 0 || computedWidth == 0) {
+					writer(outBegin, outEnd - outBegin, output.data());
+					continue;
+				}
+
+				size_t paddedRows = computedRows + padShape[0];
+				needed.clear();
+				for (size_t p = rowBegin; p < rowBegin + paddedRows; ++p) {
+					if (rowMap[p] >= 0) {
+						needed.push_back(rowMap[p]);
+					}
+				}
+
+				std::sort(needed.begin(), needed.end());
+				needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+
+				// The halo rows come from the previous band, the others are read by runs of adjacent rows
+				auto isCached = [&](long row) {
+					return std::binary_search(cached.begin(), cached.end(), row);
+				};
+
+				band.resize(std::max<size_t>(1, needed.size() * width));
+				for (size_t k = 0; k < needed.size();) {
+					if (isCached(needed[k])) {
+						size_t from = std::lower_bound(cached.begin(), cached.end(), needed[k]) - cached.begin();
+						std::copy(cache.begin() + from * width, cache.begin() + (from + 1) * width,
+								  band.begin() + k * width);
+						++k;
+						continue;
+					}
+
+					size_t run = 1;
+					while (k + run < needed.size() && needed[k + run] == needed[k] + static_cast<long>(run)
+						   && !isCached(needed[k + run])) {
+						++run;
+					}
+
+					reader(needed[k], run, band.data() + k * width);
+					k += run;
+				}
+
+				bandMap.resize(paddedRows);
+				for (size_t p = 0; p < paddedRows; ++p) {
+					long row = rowMap[rowBegin + p];
+					bandMap[p] = row < 0 ? -1 : std::lower_bound(needed.begin(), needed.end(), row) - needed.begin();
+				}
+
+				// The engine is chosen once for the height of the bands and again for the last one
+				if (!ordered && plan.rows != paddedRows) {
+					StageTimer<> timer(ws.profile, FilterStage::PLAN, 0, 0);
+					prepareEngine<ChannelType>(plan, paddedRows, paddedCols, kernel, settings, channels);
+					plan.rows = paddedRows;
+				}
+
+				// The padded band has only the columns under the output
+				ChannelView<const ChannelType> source(band.data(), needed.size(), width);
+				const long *bandCols = colMap.data() + colBegin;
+				size_t paddedPixels = paddedRows * paddedCols;
+				size_t resultPixels = computedRows * computedWidth;
+				auto copyRows = [&](const auto &resultMat) {
+					StageTimer<> timer(ws.profile, FilterStage::CROP, resultPixels * sizeof(ChannelType),
+									   resultPixels);
+					for (size_t i = 0; i < computedRows; ++i) {
+						for (size_t j = 0; j < computedWidth; ++j) {
+							output[i * outWidth + j] = saturate<ChannelType>(resultMat(i, j));
+						}
+					}
+				};
+
+				if (ordered || (integer && plan.fixed)) {
+					{
+						StageTimer<> timer(ws.profile, FilterStage::PAD, paddedPixels * sizeof(ChannelType),
+										   paddedPixels);
+						ChannelType fill = ws.morphological ? morphologyFill<ChannelType>(ws.morphology)
+															: padmodel.initValue();
+						remap(source, bandMap.data(), paddedRows, bandCols, paddedCols, fill, paddedChannel);
+					}
+					{
+						StageTimer<> timer(ws.profile, FilterStage::CORRELATE, resultPixels * sizeof(ChannelType),
+										   resultPixels);
+						resultChannel.resize(computedRows, computedWidth, false);
+						if (ws.ranked) {
+							rankFilter(paddedChannel, kernel.rows(), kernel.columns(), ws.rank, resultChannel,
+									   computedRows, computedWidth, settings, channels);
+						} else if (ws.morphological) {
+							morphologyFilter(paddedChannel, ws.element, ws.morphology, resultChannel, computedRows,
+											 computedWidth, settings, channels);
+						} else if (ws.bilateral) {
+							bilateralFilter(paddedChannel, kernel.rows(), ws.spatialSigma, ws.rangeSigma,
+											resultChannel, computedRows, computedWidth, settings, channels);
+						} else if constexpr (integer) {
+							correlateFixed(paddedChannel, plan, settings, resultChannel, computedRows, computedWidth);
+						}
+					}
+
+					copyRows(resultChannel);
+				} else {
+					{
+						StageTimer<> timer(ws.profile, FilterStage::PAD, paddedPixels * sizeof(Accumulator),
+										   paddedPixels);
+						remap(source, bandMap.data(), paddedRows, bandCols, paddedCols,
+							  static_cast<Accumulator>(padmodel.initValue()), padded);
+					}
+					{
+						StageTimer<> timer(ws.profile, FilterStage::CORRELATE, resultPixels * sizeof(Accumulator),
+										   resultPixels);
+						result.resize(computedRows, computedWidth, false);
+						correlate(padded, plan, settings, result, computedRows, computedWidth, fftWorkspace);
+					}
+
+					copyRows(result);
+				}
+
+				writer(outBegin, outEnd - outBegin, output.data());
+				needed.swap(cached);
+				band.swap(cache);
+			}
 		}
 	}
-}
\ No newline at end of file
+}
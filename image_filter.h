@@ -7,9 +7,25 @@
 
 #include <algorithm>
 #include <cmath>
+#include <complex>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <blaze/Math.h>
 #include <blaze/Blaze.h>
 
+#include "image_cache.h"
+#include "image_fft.h"
+#include "image_profile.h"
+#include "image_simd.h"
+#include "image_stream.h"
+#include "image_thread_pool.h"
+
 /**
  * Module of image filters based on 2 convolution.
  *
@@ -27,15 +43,35 @@
  * imfilter<double, 1, FilterType::AVERAGE, PadDirection::BOTH, PadType::CONST> f(3, 3);
  * Channel<double> out = f(input);
  *
+ * The result keeps the padding by default, the shape of the input or only the valid pixels:
+ *
+ * f.shape() = FilterShape::SAME;
+ * f.settings().convolution = true;     // the kernel is rotated by 180 degrees (Matlab's 'conv')
+ *
+ * The sums are in double by default, float halves the memory traffic and doubles the SIMD lanes:
+ *
+ * imfilter<float, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE, float> f(7, 7, 1.5);
+ *
  * Implemented filters:
  *   AverageFilter
  *   GaussianFilter
+ *   RecursiveGaussianFilter (IIR, for large sigma)
  *   LaplacianFilter
  *   LogFilter
  *   MotionFilter
  *   PrewittFilter
  *   UnsharpFilter
  *   SobelFilter
+ *   StaticFilter (kernel known at compile time)
+ *   RankFilter (median, percentiles, O(1) per pixel for 8-bit channels)
+ *   MorphologyFilter (erosion, dilation, opening, closing, O(1) per pixel)
+ *   BilateralFilter (edge-preserving, exact or by the bilateral grid)
+ *
+ * Chain of filters, e.g. GAUSSIAN then SOBEL in one pass:
+ *
+ * imfilter<uint8_t, 3, FilterType::CHAIN, PadDirection::BOTH, PadType::REPLICATE> f(
+ *         FilterType::GAUSSIAN(5, 5, 1.0), FilterType::SOBEL());
+ * Image<uint8_t, 3> edges = f(input);
  */
 namespace metric {
 	template<typename T>
@@ -44,9 +80,311 @@ namespace metric {
 	template<typename T, size_t N>
 	using Image = blaze::StaticVector<Channel<T>, N>;
 
+	/**
+	 * Channel in an external buffer, rows are contiguous and the distance between them is the spacing
+	 */
+	template<typename T>
+	using ChannelView = blaze::CustomMatrix<T, blaze::unaligned, blaze::unpadded>;
+
 	using FilterKernel = blaze::DynamicMatrix<double>;
 	using Shape = blaze::StaticVector<size_t, 2>;
 
+	/**
+	 * Non-owning view of an image in an external buffer (CImg, a video frame, a framebuffer...),
+	 * imfilter reads and writes it without copying to Channels.
+	 * The element (row, column) of the channel ch is data[row * rowStride + column * pixelStride + ch * channelStride].
+	 *
+	 * Usage for CImg (planar):
+	 *
+	 * CImg<unsigned char> input("img.png");
+	 * CImg<unsigned char> output(input.width(), input.height(), 1, 3);
+	 * auto in = ImageView<const uint8_t>::planar(input.data(), input.height(), input.width(), 3);
+	 * auto out = ImageView<uint8_t>::planar(output.data(), output.height(), output.width(), 3);
+	 * f(in, out);
+	 *
+	 * @tparam T type of the element, const for an input
+	 */
+	template<typename T>
+	class ImageView {
+	public:
+		/**
+		 * Creates a view
+		 * @param data the first element of the first channel
+		 * @param rows number of rows (height)
+		 * @param columns number of columns (width)
+		 * @param channels number of channels
+		 * @param rowStride distance between the rows in elements
+		 * @param channelStride distance between the channels in elements
+		 * @param pixelStride distance between the adjacent pixels of a row in elements
+		 */
+		ImageView(T *data, size_t rows, size_t columns, size_t channels, size_t rowStride, size_t channelStride,
+				  size_t pixelStride = 1)
+				: _data(data), _rows(rows), _columns(columns), _channels(channels), _rowStride(rowStride),
+				  _channelStride(channelStride), _pixelStride(pixelStride) {}
+
+		/**
+		 * A view of a non-const buffer is a view of a const one
+		 */
+		template<typename U, typename = std::enable_if_t<std::is_same<const U, T>::value>>
+		ImageView(const ImageView<U> &other)
+				: ImageView(other.data(), other.rows(), other.columns(), other.channels(), other.rowStride(),
+							other.channelStride(), other.pixelStride()) {}
+
+		/**
+		 * Creates a view of contiguous channels one after another (CImg)
+		 */
+		static ImageView planar(T *data, size_t rows, size_t columns, size_t channels) {
+			return ImageView(data, rows, columns, channels, columns, rows * columns, 1);
+		}
+
+		/**
+		 * Creates a view of contiguous pixels with the channels next to each other (HWC)
+		 */
+		static ImageView interleaved(T *data, size_t rows, size_t columns, size_t channels) {
+			return ImageView(data, rows, columns, channels, columns * channels, 1, channels);
+		}
+
+		T *data() const {
+			return _data;
+		}
+
+		size_t rows() const {
+			return _rows;
+		}
+
+		size_t columns() const {
+			return _columns;
+		}
+
+		size_t channels() const {
+			return _channels;
+		}
+
+		size_t rowStride() const {
+			return _rowStride;
+		}
+
+		size_t channelStride() const {
+			return _channelStride;
+		}
+
+		size_t pixelStride() const {
+			return _pixelStride;
+		}
+
+		/**
+		 * Checks if the channels of a pixel are adjacent and the pixels are contiguous
+		 */
+		bool interleaved() const {
+			return _channelStride == 1 && _pixelStride == _channels;
+		}
+
+		T &operator()(size_t row, size_t column, size_t channel) const {
+			return _data[row * _rowStride + column * _pixelStride + channel * _channelStride];
+		}
+
+		/**
+		 * Returns a channel as a matrix, only if the pixels are contiguous (pixelStride is 1)
+		 */
+		ChannelView<T> channel(size_t ch) const {
+			return ChannelView<T>(_data + ch * _channelStride, _rows, _columns, _rowStride);
+		}
+
+	private:
+		T *_data;
+		size_t _rows;
+		size_t _columns;
+		size_t _channels;
+		size_t _rowStride;
+		size_t _channelStride;
+		size_t _pixelStride;
+	};
+
+	/**
+	 * Image with interleaved channels (HWC): the channels of a pixel are adjacent in a row,
+	 * as in the buffers of CImg (permuted to cxyz), video decoders and framebuffers.
+	 * imfilter filters it natively, the SIMD kernels compute all channels of the adjacent pixels together.
+	 *
+	 * Usage:
+	 *
+	 * InterleavedImage<uint8_t, 3> input(1080, 1920);
+	 * input(0, 0, 2) = 255;
+	 * imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::CONST> f(3, 3, 0.3);
+	 * InterleavedImage<uint8_t, 3> output = f(input);
+	 *
+	 * @tparam T type of the element in a channel
+	 * @tparam N number of channels
+	 */
+	template<typename T, size_t N>
+	class InterleavedImage {
+	public:
+		InterleavedImage() = default;
+
+		/**
+		 * Creates an image
+		 * @param rows number of rows (height)
+		 * @param columns number of columns (width)
+		 * @param initValue default value for all elements
+		 */
+		InterleavedImage(size_t rows, size_t columns, T initValue = {}) : _data(rows, columns * N, initValue) {}
+
+		/**
+		 * Changes the shape, the elements are not preserved. The memory is reused if it's enough
+		 */
+		void resize(size_t rows, size_t columns) {
+			_data.resize(rows, columns * N, false);
+		}
+
+		/**
+		 * Wraps a matrix whose rows are the interleaved rows of the image
+		 * @param data matrix of rows x (columns * N) elements
+		 */
+		explicit InterleavedImage(Channel<T> data);
+
+		size_t rows() const {
+			return _data.rows();
+		}
+
+		size_t columns() const {
+			return _data.columns() / N;
+		}
+
+		static constexpr size_t channels() {
+			return N;
+		}
+
+		T &operator()(size_t row, size_t column, size_t channel) {
+			return _data(row, column * N + channel);
+		}
+
+		const T &operator()(size_t row, size_t column, size_t channel) const {
+			return _data(row, column * N + channel);
+		}
+
+		/**
+		 * Returns the first element of the row, the elements of a row are contiguous
+		 */
+		T *data(size_t row) {
+			return _data.data(row);
+		}
+
+		const T *data(size_t row) const {
+			return _data.data(row);
+		}
+
+		/**
+		 * Returns the matrix of rows x (columns * N) elements
+		 */
+		const Channel<T> &matrix() const {
+			return _data;
+		}
+
+		/**
+		 * Returns a view of the matrix of rows x (columns * N) elements, the image must not be empty
+		 */
+		ChannelView<T> view() {
+			return ChannelView<T>(_data.data(), _data.rows(), _data.columns(), _data.spacing());
+		}
+
+		bool operator==(const InterleavedImage &other) const {
+			return _data == other._data;
+		}
+
+	private:
+		Channel<T> _data;
+	};
+
+	/**
+	 * Engines which can be used to compute the convolution
+	 */
+	enum class ConvolutionEngine {
+		AUTO,		// choose the cheapest engine for the kernel
+		DIRECT,		// full 2D multiply-accumulate
+		SEPARABLE,	// sum of 1D row and column passes (low-rank approximation of the kernel)
+		BOX,		// running sums, only for kernels with equal elements (AVERAGE)
+		FFT,		// product of the spectrums, for large kernels
+		RECURSIVE,	// recursive (IIR) Gaussian, only for FilterType::RECURSIVE_GAUSSIAN, else it's AUTO
+		GRID,		// bilateral grid, only for FilterType::BILATERAL, else it's AUTO
+	};
+
+	/**
+	 * How FilterType::CHAIN computes its stages
+	 */
+	enum class ChainMode {
+		AUTO,		// the cheaper of MERGED and FUSED
+		MERGED,		// one convolution with the kernels of the stages convolved together
+		FUSED,		// the stages one after another over line buffers, in one pass over the image
+	};
+
+	/**
+	 * Shape of the result of a filter, the analog of the shapes of Matlab's conv2
+	 */
+	enum class FilterShape {
+		FULL,		// the result with the padding (the padded image minus the half of the kernel)
+		SAME,		// the shape of the image: centred on the pixels for PadDirection::BOTH, the kernel ends
+					// (PRE) or starts (POST) at the pixel for the others
+		VALID,		// only the pixels whose neighborhood is inside the image, the padding isn't read
+	};
+
+	/**
+	 * Settings of the convolution
+	 */
+	struct ConvolutionSettings {
+		ConvolutionEngine engine = ConvolutionEngine::AUTO;
+
+		/**
+		 * Max relative error (Frobenius norm) of the low-rank approximation of the kernel
+		 * which is allowed for the separable engine
+		 */
+		double separableTolerance = 1e-6;
+
+		/**
+		 * Cost of one FFT butterfly per element relative to one multiply-accumulate of the direct engine.
+		 * AUTO compares (taps of the kernel) with the cost of the FFT engine per pixel to find the crossover
+		 */
+		double fftCostFactor = 3;
+
+		/**
+		 * Use the fixed-point engine for uint8_t and uint16_t channels when the direct engine is cheap enough
+		 */
+		bool fixedPoint = true;
+
+		/**
+		 * The direct engines read the channel without padding it: only the border strips
+		 * are remapped by the PadModel into small line buffers
+		 */
+		bool virtualPadding = true;
+
+		/**
+		 * Number of threads of the convolution (0 means all hardware threads)
+		 */
+		size_t threads = 0;
+
+		/**
+		 * The channels of an Image are filtered in one pass: each tile computes the pixels of all channels,
+		 * else the channels are scheduled on the threads as separate tasks
+		 */
+		bool fuseChannels = true;
+
+		/**
+		 * Size of the tiles of the output which are scheduled on the threads
+		 */
+		size_t tileRows = 64;
+		size_t tileColumns = 512;
+
+		/**
+		 * How the stages of FilterType::CHAIN are computed. AUTO compares the cost of the engine
+		 * of the merged kernel with the sum of the taps of the stages
+		 */
+		ChainMode chain = ChainMode::AUTO;
+
+		/**
+		 * The kernel is rotated by 180 degrees before the correlation, so the filter computes
+		 * the convolution (the 'conv' option of Matlab's imfilter), else the correlation ('corr')
+		 */
+		bool convolution = false;
+	};
+
 	/**
 	 * Creates an Image
 	 * @tparam T type of the element in a channel
@@ -59,6 +397,22 @@ namespace metric {
 	template<typename T, size_t N>
 	Image<T,N> iminit(size_t rows, size_t columns, T initValue={});
 
+	/**
+	 * Converts a planar image to the interleaved layout
+	 * @param img the image, all its channels must have the same shape
+	 * @return the interleaved image
+	 */
+	template<typename T, size_t N>
+	InterleavedImage<T, N> interleave(const Image<T, N> &img);
+
+	/**
+	 * Converts an interleaved image to the planar layout
+	 * @param img the image
+	 * @return the planar image
+	 */
+	template<typename T, size_t N>
+	Image<T, N> deinterleave(const InterleavedImage<T, N> &img);
+
 	enum class PadDirection {
 		POST,
 		PRE,
@@ -97,26 +451,271 @@ namespace metric {
 		 */
 		std::pair<blaze::DynamicMatrix<T>, Shape> pad(const Shape &shape, const blaze::DynamicMatrix<T> &src) const;
 
+		/**
+		 * Maps the rows (or columns) of the padded matrix to the source, so the matrix can be read without padding
+		 * @param padSize size of the padding along the axis
+		 * @param size size of the source along the axis
+		 * @return index in the source for each row (column) of the padded matrix, -1 if it's filled by the init value
+		 */
+		std::vector<long> indexMap(size_t padSize, size_t size) const;
+
+		/**
+		 * Returns the size of the padding before the source along an axis
+		 * @param padSize size of the padding along the axis
+		 */
+		size_t padBefore(size_t padSize) const {
+			return _padDirection == PadDirection::POST ? 0 : padSize;
+		}
+
+		/**
+		 * Returns the size of the padded source along an axis
+		 * @param padSize size of the padding along the axis
+		 * @param size size of the source along the axis
+		 */
+		size_t paddedSize(size_t padSize, size_t size) const {
+			return _padDirection == PadDirection::BOTH ? size + padSize * 2 : size + padSize;
+		}
+
+		T initValue() const {
+			return _initValue;
+		}
+
+		PadDirection padDirection() const {
+			return _padDirection;
+		}
+
+		PadType padType() const {
+			return _padType;
+		}
+
 	private:
 		PadDirection _padDirection;
 		PadType _padType;
 		T _initValue;
 	};
 
+	/**
+	 * Flat structuring element of the morphological filters (FilterType::ERODE, DILATE, OPEN and CLOSE):
+	 * a rectangle or a line, the analog of Matlab's strel('rectangle') and strel('line')
+	 */
+	class StructuringElement {
+	public:
+		/**
+		 * Creates a rectangle
+		 * @param rows number of rows
+		 * @param columns number of columns
+		 */
+		static StructuringElement rectangle(size_t rows, size_t columns);
+
+		/**
+		 * Creates a line, a diagonal line is the diagonal of a length x length square
+		 * @param length number of pixels
+		 * @param angle angle in degrees counterclockwise from the x-axis, a multiple of 45
+		 */
+		static StructuringElement line(size_t length, double angle);
+
+		/**
+		 * Returns the mask of the element: 1 in its pixels, 0 elsewhere
+		 */
+		FilterKernel mask() const;
+
+		size_t rows() const {
+			return _rows;
+		}
+
+		size_t columns() const {
+			return _columns;
+		}
+
+		/**
+		 * Returns the step of the column per row of a diagonal line: 1 for 135 degrees (down to the right),
+		 * -1 for 45 degrees (down to the left), 0 for a rectangle
+		 */
+		int diagonal() const {
+			return _diagonal;
+		}
+
+	private:
+		StructuringElement(size_t rows, size_t columns, int diagonal);
+
+		size_t _rows;
+		size_t _columns;
+		int _diagonal;
+	};
+
+	/**
+	 * Operations of the morphological filters
+	 */
+	enum class MorphologyOperation {
+		ERODE,		// the minimum under the element
+		DILATE,		// the maximum under the element
+		OPEN,		// the erosion then the dilation, removes the bright details smaller than the element
+		CLOSE,		// the dilation then the erosion, removes the dark details smaller than the element
+	};
+
+
+
+	namespace image_processing_details {
+		template<typename ChannelType, typename Accumulator = double>
+		struct FilterWorkspace;
+
+		/**
+		 * Kernel whose shape and coefficients are known at compile time: element = coefficient / Divisor.
+		 * The convolution with it is unrolled, skips the zero taps and adds or subtracts the taps of ±1 and ±2
+		 * without multiplies. Integer channels are computed exactly in integers.
+		 * @tparam Rows number of rows
+		 * @tparam Columns number of columns
+		 * @tparam Divisor divisor of all coefficients
+		 * @tparam Coefficients the coefficients in row-major order
+		 */
+		template<size_t Rows, size_t Columns, int Divisor, int ...Coefficients>
+		struct StaticKernel {
+			static_assert(sizeof...(Coefficients) == Rows * Columns, "the kernel needs Rows * Columns coefficients");
+			static_assert(Divisor > 0, "the divisor must be positive");
+
+			static constexpr size_t rows = Rows;
+			static constexpr size_t columns = Columns;
+			static constexpr int divisor = Divisor;
+			static constexpr int coefficients[Rows * Columns] = {Coefficients...};
+
+			/**
+			 * Returns the kernel as a matrix for the other engines
+			 */
+			static FilterKernel matrix() {
+				FilterKernel kernel(Rows, Columns);
+				for (size_t i = 0; i < Rows; ++i) {
+					for (size_t j = 0; j < Columns; ++j) {
+						kernel(i, j) = static_cast<double>(coefficients[i * Columns + j]) / Divisor;
+					}
+				}
+
+				return kernel;
+			}
+		};
+
+		/**
+		 * Computes n output pixels of a row with a static kernel
+		 * @param rows pointers to the input rows under the kernel
+		 * @param out the output row
+		 * @param n number of output pixels
+		 * @param stride number of interleaved channels, the taps of a row are stride elements apart
+		 */
+		template<typename Kernel, typename T>
+		void correlateRowStatic(const T *const *rows, T *out, size_t n, size_t stride);
+
+		/**
+		 * Checks if a filter type has a static kernel (Filter::StaticKernel)
+		 */
+		template<typename Filter, typename = void>
+		struct HasStaticKernel : std::false_type {};
 
+		template<typename Filter>
+		struct HasStaticKernel<Filter, std::void_t<typename Filter::StaticKernel>> : std::true_type {};
+	}
 
-	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType>
+	/**
+	 * Filter of channels and images
+	 * @tparam ChannelType type of the elements of the channels
+	 * @tparam N number of channels of the images
+	 * @tparam Filter type of the filter (FilterType)
+	 * @tparam PadDir direction of the padding
+	 * @tparam PadType type of the padding
+	 * @tparam Accumulator float or double: type of the taps of the kernel and of the sums of the engines.
+	 * float is enough for 8 and 16 bit channels and runs twice as many pixels per SIMD register,
+	 * double is for the results which need the accuracy
+	 */
+	template <typename ChannelType, size_t N, typename Filter, PadDirection PadDir, PadType PadType,
+			typename Accumulator = double>
 	class imfilter {
 	public:
+		static_assert(std::is_same<Accumulator, float>::value || std::is_same<Accumulator, double>::value,
+					  "the accumulator must be float or double");
+
 		template <typename ...FilterArgs>
 		imfilter(FilterArgs... args) : _padModel(PadDir, PadType), _filter(args...) {
 		}
 
 		Channel<ChannelType> operator()(const Channel<ChannelType>& input);
 		Image<ChannelType, N> operator()(const Image<ChannelType, N>& input);
+		InterleavedImage<ChannelType, N> operator()(const InterleavedImage<ChannelType, N>& input);
+
+		/**
+		 * Filters into a caller-owned output, it's resized only if its shape differs from the result.
+		 * The kernel, the plan of the convolution and the buffers are kept in the workspace of the filter,
+		 * so repeated calls on inputs of the same shape don't allocate memory
+		 * (except the padded engines with settings().virtualPadding off). The workspace keeps the plan of the last
+		 * shape and layout, so a filter shouldn't alternate between them, and a filter can't be called
+		 * from several threads at once.
+		 * @param input the image to filter
+		 * @param output the result of the shape(), the same as the other operators return
+		 */
+		void operator()(const Channel<ChannelType>& input, Channel<ChannelType>& output);
+		void operator()(const Image<ChannelType, N>& input, Image<ChannelType, N>& output);
+		void operator()(const InterleavedImage<ChannelType, N>& input, InterleavedImage<ChannelType, N>& output);
+
+		/**
+		 * Filters a batch of frames of the same shape, e.g. a burst or thumbnails: the kernel and the plan
+		 * are prepared once, the frames and their tiles run on the threads together,
+		 * so small frames still use all of them
+		 * @param inputs the frames to filter
+		 * @param outputs the results, the same as the other operators return for each frame
+		 */
+		void operator()(const std::vector<Channel<ChannelType>>& inputs, std::vector<Channel<ChannelType>>& outputs);
+		void operator()(const std::vector<Image<ChannelType, N>>& inputs, std::vector<Image<ChannelType, N>>& outputs);
+		void operator()(const std::vector<InterleavedImage<ChannelType, N>>& inputs,
+						std::vector<InterleavedImage<ChannelType, N>>& outputs);
+
+		/**
+		 * Filters an image in an external buffer into another one without copying them.
+		 * The shape of the output chooses the shape of the result: the shape of the input (FilterShape::SAME),
+		 * of the full result or of the valid one.
+		 * @param input view of the image to filter
+		 * @param output view of the buffer for the result, it must not overlap the input
+		 */
+		void operator()(const ImageView<const ChannelType>& input, const ImageView<ChannelType>& output);
+
+		/**
+		 * Filters an image which doesn't need to fit in memory: the rows are read and the result is written
+		 * by bands, only the rows under the kernel of the current band are kept.
+		 * The result is the same as the other operators return.
+		 * @param rows number of rows of the image
+		 * @param columns number of columns of the image
+		 * @param reader reads the interleaved rows of the image
+		 * @param writer receives the rows of the result in order
+		 * @param bandRows number of rows of the result per band
+		 * @param shape shape of the result
+		 */
+		void stream(size_t rows, size_t columns, const RowReader<ChannelType>& reader,
+					const RowWriter<ChannelType>& writer, size_t bandRows = 256,
+					FilterShape shape = FilterShape::FULL);
+
+		/**
+		 * Settings of the convolution, can be changed between calls
+		 */
+		ConvolutionSettings &settings() {
+			return _settings;
+		}
+
+		/**
+		 * Shape of the results of the operators, FilterShape::FULL by default
+		 */
+		FilterShape &shape() {
+			return _shape;
+		}
+
+		/**
+		 * Stages of the calls of the filter (see FilterProfile), recorded with IMAGE_FILTER_PROFILE only
+		 */
+		const FilterProfile &profile() const {
+			return _workspace.profile;
+		}
+
 	private:
 		PadModel<ChannelType> _padModel;
 		Filter _filter;
+		ConvolutionSettings _settings;
+		FilterShape _shape = FilterShape::FULL;
+		image_processing_details::FilterWorkspace<ChannelType, Accumulator> _workspace;
 	};
 
 	class FilterType {
@@ -177,19 +776,62 @@ namespace metric {
 			GAUSSIAN(size_t rows, size_t columns, double sigma);
 
 			FilterKernel operator()() const {
-				return _kernel;
+				return *_kernel;
 			}
 
 		private:
-			FilterKernel _kernel;
-			FilterKernel _xMat;
-			FilterKernel _yMat;
+			/**
+			 * Returns the coordinates of the elements of the kernel relative to its center
+			 */
+			static std::pair<FilterKernel, FilterKernel> grid(size_t rows, size_t columns);
+
+			/** shared with the filters of the same parameters through kernelCache() */
+			std::shared_ptr<const FilterKernel> _kernel;
 		};
 
 		/**
-		 * Laplacian filter
+		 * Gaussian lowpass filter for large sigma: ConvolutionEngine::AUTO (or RECURSIVE) computes it
+		 * by the recursive filter of Young and van Vliet with the boundaries of Triggs and Sdika,
+		 * 3 multiplies forward and backward along the rows and the columns, so the cost per pixel
+		 * doesn't depend on sigma.
+		 *
+		 * The exact filter is the sampled Gaussian kernel of 2 * ceil(3 * sigma) + 1 elements, the image is padded
+		 * for it and the other engines use it. The recursive result differs from the exact one by less than
+		 * 1% of the range of the values (of the image and the CONST padding) for sigma >= 3 and by less than 4%
+		 * for 1 <= sigma < 3; below 1 the recursive filter is a poor Gaussian (up to 15%), GAUSSIAN is cheap there.
+		 * The bound holds for PadType::CONST, REPLICATE and SYMMETRIC: the recursive filter reads the same padding
+		 * through the PadModel and starts from the steady state of the outermost padded values.
+		 *
+		 * Usage:
+		 *
+		 * imfilter<uint8_t, 1, FilterType::RECURSIVE_GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> f(40.0);
+		 * Channel<uint8_t> illumination = f(gray);
 		 */
-		class LAPLACIAN {
+		class RECURSIVE_GAUSSIAN {
+		public:
+			/**
+			 * Creates a filter
+			 * @param sigma standard deviation, at least 0.5
+			 */
+			explicit RECURSIVE_GAUSSIAN(double sigma);
+
+			/**
+			 * Returns the sampled kernel, see the class
+			 */
+			FilterKernel operator()() const;
+
+			double sigma() const {
+				return _sigma;
+			}
+
+		private:
+			double _sigma;
+		};
+
+		/**
+		 * Laplacian filter
+		 */
+		class LAPLACIAN {
 		public:
 			/**
 			 * Creates a 3-by-3 filter approximating the shape
@@ -220,11 +862,11 @@ namespace metric {
 			LOG(size_t rows, size_t columns, double sigma);
 
 			FilterKernel operator()() const {
-				return _kernel;
+				return *_kernel;
 			}
 
 		private:
-			FilterKernel _kernel;
+			std::shared_ptr<const FilterKernel> _kernel;
 		};
 
 		/**
@@ -241,11 +883,11 @@ namespace metric {
 			MOTION(double len, int theta);
 
 			FilterKernel operator()() const {
-				return _kernel;
+				return *_kernel;
 			}
 
 		private:
-			FilterKernel _kernel;
+			std::shared_ptr<const FilterKernel> _kernel;
 		};
 
 		/**
@@ -258,19 +900,16 @@ namespace metric {
 			 * Creates 3-by-3 filter that emphasize
 			 * horizontal edges by approximating a vertical gradient.
 			 */
-			PREWITT() :
-					_kernel{
-							{1,  1,  1},
-							{0,  0,  0},
-							{-1, -1, -1}
-					} {}
+			PREWITT() = default;
+
+			using StaticKernel = image_processing_details::StaticKernel<3, 3, 1,
+					1, 1, 1,
+					0, 0, 0,
+					-1, -1, -1>;
 
 			FilterKernel operator()() const {
-				return _kernel;
+				return StaticKernel::matrix();
 			}
-
-		private:
-			FilterKernel _kernel;
 		};
 
 		/**
@@ -302,19 +941,264 @@ namespace metric {
 			 * horizontal edges utilizing the smoothing effect by approximating a
 			 * vertical gradient
 			 */
-			SOBEL() :
-					_kernel{
-							{1,  2,  1},
-							{0,  0,  0},
-							{-1, -2, -1}
-					} {}
+			SOBEL() = default;
+
+			using StaticKernel = image_processing_details::StaticKernel<3, 3, 1,
+					1, 2, 1,
+					0, 0, 0,
+					-1, -2, -1>;
+
+			FilterKernel operator()() const {
+				return StaticKernel::matrix();
+			}
+		};
+
+		/**
+		 * Filter with a kernel known at compile time, e.g. the 5-by-5 binomial approximation of a Gaussian:
+		 *
+		 * imfilter<uint8_t, 1, FilterType::STATIC<5, 5, 256,
+		 *         1, 4, 6, 4, 1,
+		 *         4, 16, 24, 16, 4,
+		 *         6, 24, 36, 24, 6,
+		 *         4, 16, 24, 16, 4,
+		 *         1, 4, 6, 4, 1>, PadDirection::BOTH, PadType::REPLICATE> f;
+		 *
+		 * @see image_processing_details::StaticKernel
+		 */
+		template<size_t Rows, size_t Columns, int Divisor, int ...Coefficients>
+		class STATIC {
+		public:
+			using StaticKernel = image_processing_details::StaticKernel<Rows, Columns, Divisor, Coefficients...>;
+
+			FilterKernel operator()() const {
+				return StaticKernel::matrix();
+			}
+		};
+
+		/**
+		 * Rank-order filter (the analog of Matlab's ordfilt2): the result is the element of the given rank
+		 * in the sorted window of rows x columns pixels, 0 is the minimum and rows * columns - 1 is the maximum.
+		 * It isn't a convolution: the kernel is the window of ones, so the shapes of the result and the padding
+		 * are the same as for the other filters. 8-bit channels are computed by the sliding histograms
+		 * of Perreault and Hebert, the cost per pixel doesn't depend on the size of the window;
+		 * the other types select the element in each window, O(rows * columns) per pixel.
+		 *
+		 * Usage:
+		 *
+		 * imfilter<uint8_t, 1, FilterType::MEDIAN, PadDirection::BOTH, PadType::SYMMETRIC> f(15, 15);
+		 * Channel<uint8_t> denoised = f(gray);
+		 */
+		class RANK {
+		public:
+			/**
+			 * Creates a rank filter
+			 * @param rows number of rows of the window
+			 * @param columns number of columns of the window
+			 * @param rank order of the result in the sorted window, less than rows * columns
+			 */
+			RANK(size_t rows, size_t columns, size_t rank);
 
+			/**
+			 * Returns the window as a kernel of ones
+			 */
+			FilterKernel operator()() const {
+				return FilterKernel(_rows, _columns, 1.0);
+			}
+
+			size_t rank() const {
+				return _rank;
+			}
+
+		private:
+			size_t _rows;
+			size_t _columns;
+			size_t _rank;
+		};
+
+		/**
+		 * Median filter (Matlab's medfilt2): the rank (rows * columns - 1) / 2, the lower median for an even window
+		 */
+		class MEDIAN : public RANK {
+		public:
+			MEDIAN(size_t rows, size_t columns);
+		};
+
+		/**
+		 * Percentile of the window: the rank round(percent / 100 * (rows * columns - 1)),
+		 * 0 is the minimum and 100 is the maximum
+		 */
+		class PERCENTILE : public RANK {
+		public:
+			PERCENTILE(size_t rows, size_t columns, double percent);
+		};
+
+		/**
+		 * Grayscale morphology with a flat structuring element (the analog of Matlab's imerode, imdilate, imopen
+		 * and imclose). It isn't a convolution: the kernel is the window of the operation, the mask of the element
+		 * for ERODE and DILATE and the element dilated by itself for OPEN and CLOSE, whose results are the opening
+		 * and the closing of the padded image. The minima and the maxima are found by the algorithm of van Herk
+		 * and Gil-Werman in a horizontal and a vertical pass (one pass along a diagonal line), about 3 comparisons
+		 * per pixel and pass whatever the size of the element.
+		 * PadType::CONST pads by +inf (the maximum of an integer type) for ERODE and OPEN and by -inf
+		 * (the minimum) for DILATE and CLOSE, so the padding never wins; the init value of the model isn't used.
+		 *
+		 * Usage, the background of an uneven lighting:
+		 *
+		 * imfilter<uint8_t, 1, FilterType::OPEN, PadDirection::BOTH, PadType::REPLICATE> f(51, 51);
+		 * f.shape() = FilterShape::SAME;
+		 * Channel<uint8_t> background = f(gray);
+		 */
+		class MORPHOLOGY {
+		public:
+			/**
+			 * Creates a morphological filter
+			 * @param element the structuring element
+			 * @param operation the operation
+			 */
+			MORPHOLOGY(const StructuringElement &element, MorphologyOperation operation);
+
+			/**
+			 * Returns the window of the operation as a kernel, 1 in its pixels and 0 elsewhere
+			 */
+			FilterKernel operator()() const;
+
+			const StructuringElement &element() const {
+				return _element;
+			}
+
+			MorphologyOperation operation() const {
+				return _operation;
+			}
+
+		private:
+			StructuringElement _element;
+			MorphologyOperation _operation;
+		};
+
+		/**
+		 * Erosion by a rows x columns rectangle or by an element
+		 */
+		class ERODE : public MORPHOLOGY {
+		public:
+			ERODE(size_t rows, size_t columns);
+			explicit ERODE(const StructuringElement &element);
+		};
+
+		/**
+		 * Dilation by a rows x columns rectangle or by an element
+		 */
+		class DILATE : public MORPHOLOGY {
+		public:
+			DILATE(size_t rows, size_t columns);
+			explicit DILATE(const StructuringElement &element);
+		};
+
+		/**
+		 * Opening by a rows x columns rectangle or by an element
+		 */
+		class OPEN : public MORPHOLOGY {
+		public:
+			OPEN(size_t rows, size_t columns);
+			explicit OPEN(const StructuringElement &element);
+		};
+
+		/**
+		 * Closing by a rows x columns rectangle or by an element
+		 */
+		class CLOSE : public MORPHOLOGY {
+		public:
+			CLOSE(size_t rows, size_t columns);
+			explicit CLOSE(const StructuringElement &element);
+		};
+
+		/**
+		 * Edge-preserving smoothing (the analog of Matlab's imbilatfilt): the average of the window weighted
+		 * by the spatial Gaussian and by the Gaussian of the difference to the centre pixel, each channel
+		 * separately. It isn't a convolution: the kernel is the spatial Gaussian of 2 * ceil(2 * spatialSigma) + 1
+		 * pixels, it chooses the padding and the shapes of the result as for the other filters.
+		 *
+		 * ConvolutionEngine::GRID computes it by the bilateral grid of Paris and Durand: the pixels are summed
+		 * in a grid downsampled by spatialSigma in the space and by rangeSigma in the intensity, the grid is
+		 * blurred and the result is interpolated in it at the pixel and its intensity. The cost per pixel
+		 * doesn't grow with spatialSigma (the grid has fewer cells), it grows with the range / rangeSigma.
+		 * The result differs from the exact one by a few percent of rangeSigma, mostly at the edges.
+		 * The other engines compute the exact filter, O(window) per pixel. AUTO chooses the grid
+		 * for spatialSigma >= 2, where it's faster.
+		 *
+		 * Usage:
+		 *
+		 * imfilter<uint8_t, 3, FilterType::BILATERAL, PadDirection::BOTH, PadType::SYMMETRIC> f(8.0, 20.0);
+		 * f.shape() = FilterShape::SAME;
+		 * Image<uint8_t, 3> smooth = f(photo);
+		 */
+		class BILATERAL {
+		public:
+			/**
+			 * Creates a filter
+			 * @param spatialSigma standard deviation of the spatial Gaussian in pixels, positive
+			 * @param rangeSigma standard deviation of the range Gaussian in the units of the channel, positive
+			 */
+			BILATERAL(double spatialSigma, double rangeSigma);
+
+			/**
+			 * Returns the spatial Gaussian, see the class
+			 */
+			FilterKernel operator()() const;
+
+			double spatialSigma() const {
+				return _spatialSigma;
+			}
+
+			double rangeSigma() const {
+				return _rangeSigma;
+			}
+
+		private:
+			double _spatialSigma;
+			double _rangeSigma;
+		};
+
+		/**
+		 * Chain of filters which are applied one after another, e.g. GAUSSIAN then SOBEL.
+		 * The image is padded once and the intermediate results are neither rounded nor clamped,
+		 * so the chain is equal to one filter whose kernel is the convolution of the kernels of the stages.
+		 * It's computed with this kernel or by the stages fused over line buffers (see ConvolutionSettings::chain),
+		 * in both cases without intermediate images.
+		 */
+		class CHAIN {
+		public:
+			/**
+			 * Creates a chain of filters
+			 * @param filters the stages in the order of application, a CHAIN adds its stages
+			 */
+			template<typename ...Filters>
+			explicit CHAIN(const Filters &...filters);
+
+			/**
+			 * Returns the merged kernel of the stages
+			 */
 			FilterKernel operator()() const {
 				return _kernel;
 			}
 
+			const std::vector<FilterKernel> &stages() const {
+				return _stages;
+			}
+
 		private:
+			void add(const CHAIN &chain);
+
+			template<typename Filter>
+			void add(const Filter &filter) {
+				static_assert(!std::is_base_of<RANK, Filter>::value, "a rank filter can't be a stage of a chain");
+				static_assert(!std::is_base_of<MORPHOLOGY, Filter>::value,
+							  "a morphological filter can't be a stage of a chain");
+				static_assert(!std::is_same<BILATERAL, Filter>::value, "a bilateral filter can't be a stage of a chain");
+				_stages.push_back(filter());
+			}
+
 			FilterKernel _kernel;
+			std::vector<FilterKernel> _stages;
 		};
 	};
 
@@ -381,14 +1265,436 @@ namespace metric {
 		template<typename T>
 		blaze::DynamicMatrix<T> flipud(const blaze::DynamicMatrix<T> &input);
 
+		/**
+		 * Rotates a matrix by 180 degrees (analog of Matlab's rot90(A, 2))
+		 * @tparam T type of the elements
+		 * @param input matrix to rotate
+		 * @return the rotated matrix
+		 */
+		template<typename T>
+		blaze::DynamicMatrix<T> rot180(const blaze::DynamicMatrix<T> &input);
+
+
+		/**
+		 * Kernel approximated by a sum of outer products: sum(columns[k] * rows[k])
+		 */
+		struct SeparableKernel {
+			std::vector<blaze::DynamicVector<double, blaze::columnVector>> columns;
+			std::vector<blaze::DynamicVector<double, blaze::rowVector>> rows;
+
+			/**
+			 * Relative error (Frobenius norm) of the approximation
+			 */
+			double error = 0;
+
+			size_t rank() const {
+				return columns.size();
+			}
+		};
+
+		/**
+		 * Splits a kernel into its separable parts by SVD (one-sided Jacobi)
+		 * @param kernel the kernel to split
+		 * @param tolerance max relative error (Frobenius norm) of the approximation
+		 * @return the approximation with the lowest rank which satisfies the tolerance
+		 */
+		SeparableKernel separate(const FilterKernel &kernel, double tolerance);
+
+		/**
+		 * Key of a generated kernel: name of the filter type and its parameters
+		 */
+		struct KernelKey {
+			std::string filter;
+			std::vector<double> params;
+
+			bool operator==(const KernelKey &other) const {
+				return filter == other.filter && params == other.params;
+			}
+		};
+
+		struct KernelKeyHash {
+			size_t operator()(const KernelKey &key) const;
+		};
+
+		/**
+		 * Key of a separable decomposition: the kernel and the tolerance
+		 */
+		struct SeparableKey {
+			size_t rows;
+			std::vector<double> elements;
+			double tolerance;
+
+			bool operator==(const SeparableKey &other) const {
+				return rows == other.rows && tolerance == other.tolerance && elements == other.elements;
+			}
+		};
+
+		struct SeparableKeyHash {
+			size_t operator()(const SeparableKey &key) const;
+		};
+
+		using KernelCache = LruCache<KernelKey, FilterKernel, KernelKeyHash>;
+		using SeparableCache = LruCache<SeparableKey, SeparableKernel, SeparableKeyHash>;
+
+		/**
+		 * Returns the process-wide cache of the kernels of GAUSSIAN, LOG and MOTION (256 kernels by default),
+		 * so the filters with the same parameters generate their kernel once
+		 */
+		KernelCache &kernelCache();
+
+		/**
+		 * Returns the process-wide cache of the separable decompositions of the kernels (256 by default),
+		 * so a plan for a kernel which was already planned doesn't repeat the SVD
+		 */
+		SeparableCache &separableCache();
+
+		/**
+		 * Returns the separable decomposition of the kernel through separableCache()
+		 */
+		std::shared_ptr<const SeparableKernel> separateCached(const FilterKernel &kernel, double tolerance);
+
+		/**
+		 * Checks if all elements of the kernel are equal (box kernel)
+		 * @param kernel the kernel to check
+		 * @return true if the kernel is a box
+		 */
+		bool isBox(const FilterKernel &kernel);
+
+		/**
+		 * Returns the kernel of two correlations one after another (the full convolution of the kernels)
+		 * @param first the kernel of the first correlation
+		 * @param second the kernel of the second correlation
+		 * @return the kernel of (first.rows() + second.rows() - 1) x (first.columns() + second.columns() - 1)
+		 */
+		FilterKernel mergeKernels(const FilterKernel &first, const FilterKernel &second);
 
 		/**
 		 * Returns the two-dimensional convolution of a matrix and kernel
 		 * @param kernel the kernel to convolute
+		 * @param settings settings of the convolution
 		 * @return
 		 */
-		blaze::DynamicMatrix<double> imgcov2(const blaze::DynamicMatrix<double> &input, const FilterKernel &kernel);
+		blaze::DynamicMatrix<double> imgcov2(const blaze::DynamicMatrix<double> &input, const FilterKernel &kernel,
+											 const ConvolutionSettings &settings = ConvolutionSettings());
+
+		/**
+		 * Returns the two-dimensional convolution of a floating matrix and kernel in the type of the matrix,
+		 * the kernel is converted to it
+		 * @tparam T float or double
+		 * @see imgcov2
+		 */
+		template<typename T>
+		std::enable_if_t<std::is_same<T, float>::value || std::is_same<T, double>::value, blaze::DynamicMatrix<T>>
+		imgcov2(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+				const ConvolutionSettings &settings = ConvolutionSettings());
+
+		/**
+		 * Kernel quantized to Q-format for the fixed-point engine
+		 */
+		struct FixedPointKernel {
+			std::vector<FixedKernelTap> taps;
+
+			/**
+			 * Number of fractional bits of the taps
+			 */
+			int shift = 0;
+
+			/**
+			 * Max error of a sum caused by the quantization: max(T) * sum(|tap / 2^shift - element|).
+			 * The result of imgcov2Fixed differs from imgcov2 by at most 1 while it's below 0.5
+			 */
+			double maxError = 0;
+		};
+
+		/**
+		 * Quantizes a kernel with the max number of fractional bits which can't overflow the accumulator
+		 * (int32_t for uint8_t, int64_t for uint16_t)
+		 * @tparam T type of the elements of the input (uint8_t or uint16_t)
+		 * @param kernel the kernel to quantize
+		 * @return the quantized kernel
+		 */
+		template<typename T>
+		FixedPointKernel quantize(const FilterKernel &kernel);
+
+		/**
+		 * Returns the two-dimensional convolution of a uint8_t or uint16_t matrix and kernel computed in fixed-point.
+		 * The data stays in its native width from load to store, the result is rounded and saturated to the range of T.
+		 * @tparam T type of the elements (uint8_t or uint16_t)
+		 * @param input the matrix
+		 * @param kernel the kernel to convolute
+		 * @param settings settings of the convolution (threads and tiles)
+		 * @return
+		 */
+		template<typename T>
+		blaze::DynamicMatrix<T> imgcov2Fixed(const blaze::DynamicMatrix<T> &input, const FilterKernel &kernel,
+											 const ConvolutionSettings &settings = ConvolutionSettings());
+
+
+		/**
+		 * Shape of the result of the correlation of a padded input with a kernel
+		 */
+		struct CorrelationShape {
+			size_t resultRows = 0;
+			size_t resultCols = 0;
+
+			/**
+			 * The computed top-left part: only positions where the whole kernel lies inside the input
+			 */
+			size_t rows = 0;
+			size_t cols = 0;
+		};
+
+		/**
+		 * Buffers of the FFT engine which are reused between calls.
+		 * A copy doesn't share them, it starts empty
+		 */
+		struct FFTWorkspace {
+			std::unique_ptr<FFT2> fft;
+			std::vector<std::complex<double>> spectrum;
+
+			FFTWorkspace() = default;
+			FFTWorkspace(FFTWorkspace &&) = default;
+			FFTWorkspace &operator=(FFTWorkspace &&) = default;
+
+			FFTWorkspace(const FFTWorkspace &) {}
+
+			FFTWorkspace &operator=(const FFTWorkspace &) {
+				fft.reset();
+				spectrum.clear();
+				return *this;
+			}
+		};
+
+		/**
+		 * Everything which the convolution prepares for a kernel and a shape of the input:
+		 * the index maps of the padding, the chosen engine and the kernel in its form.
+		 * It's rebuilt only when the key changes
+		 */
+		struct ConvolutionPlan {
+			// The key
+			size_t rows = 0;
+			size_t columns = 0;
+			size_t stride = 0;
+			PadDirection padDirection = PadDirection::BOTH;
+			PadType padType = PadType::CONST;
+			double initValue = 0;
+			ConvolutionSettings settings;
+			FilterKernel kernel;
+
+			/**
+			 * Maps of the padded rows and columns (elements of the interleaved rows) to the source
+			 */
+			std::vector<long> rowMap;
+			std::vector<long> colMap;
+
+			/**
+			 * Size of the padding before the source in elements of a row
+			 */
+			size_t padBefore = 0;
+
+			CorrelationShape shape;
+			ConvolutionEngine engine = ConvolutionEngine::DIRECT;
+			SeparableKernel separable;
+			bool fixed = false;
+
+			/**
+			 * The stages of a chain are computed over line buffers, their kernels are spread by the stride
+			 */
+			bool fused = false;
+			std::vector<FilterKernel> stageKernels;
+			std::vector<std::vector<KernelTap>> stageTaps;
+
+			/**
+			 * The kernel spread by the stride, its non zero taps in double and in float and their quantized values
+			 */
+			FilterKernel spread;
+			std::vector<KernelTap> taps;
+			std::vector<BasicKernelTap<float>> floatTaps;
+			FixedPointKernel fixedKernel;
+		};
+
+		/**
+		 * Coefficients of the recursive Gaussian of Young and van Vliet:
+		 * forward w[n] = gain * x[n] + a[0] * w[n-1] + a[1] * w[n-2] + a[2] * w[n-3],
+		 * backward y[n] = gain * w[n] + a[0] * y[n+1] + a[1] * y[n+2] + a[2] * y[n+3]
+		 */
+		struct RecursiveGaussian {
+			double sigma = 0;
+			double gain = 0;
+			double a[3] = {};
+
+			/**
+			 * Boundary of Triggs and Sdika: y[N + k] = sum(end[k][i] * w[N-1-i]) + end[k][3] * x[N-1]
+			 * for the input which is x[N-1] after the end
+			 */
+			double end[3][4] = {};
+		};
+
+		/**
+		 * Computes the coefficients of the recursive Gaussian
+		 * @param sigma standard deviation, at least 0.5
+		 */
+		RecursiveGaussian recursiveGaussian(double sigma);
+
+		/**
+		 * Filters Lanes interleaved lines in place by the recursive Gaussian, the input of a line is its first
+		 * (last) element before (after) it. The lines are independent, so their recursions are computed together
+		 * @tparam Lanes number of lines, the element k of the line r is lines[k * stride + r]
+		 * @param lines the first element of the first line
+		 * @param n number of elements of a line
+		 * @param stride distance between the elements of a line
+		 */
+		template<size_t Lanes>
+		void recursiveLines(const RecursiveGaussian &gaussian, double *lines, size_t n, size_t stride);
+
+		/**
+		 * Buffers of the filter which are reused between calls, so the steady state doesn't allocate memory.
+		 * A workspace belongs to one filter: the kernel is computed on the first call only.
+		 * imfilter keeps its own workspace
+		 * @tparam ChannelType type of the channel
+		 */
+		template<typename ChannelType, typename Accumulator>
+		struct FilterWorkspace {
+			/**
+			 * Returns the kernel of the filter, it's computed on the first call only
+			 * @param convolution rotate the kernel (and the stages of a chain) by 180 degrees
+			 */
+			template<typename Filter>
+			const FilterKernel &kernel(const Filter &impl, bool convolution = false) {
+				if (!hasKernel) {
+					StageTimer<> timer(profile, FilterStage::KERNEL, 0, 0);
+					filterKernel = impl();
+					timer.amount(filterKernel.rows() * filterKernel.columns() * sizeof(double),
+								 filterKernel.rows() * filterKernel.columns());
+					if constexpr (std::is_same<Filter, FilterType::CHAIN>::value) {
+						stages = impl.stages();
+					}
+
+					if constexpr (std::is_same<Filter, FilterType::RECURSIVE_GAUSSIAN>::value) {
+						recursive = recursiveGaussian(impl.sigma());
+					}
 
+					if constexpr (std::is_base_of<FilterType::RANK, Filter>::value) {
+						ranked = true;
+						rank = impl.rank();
+					}
+
+					if constexpr (std::is_base_of<FilterType::MORPHOLOGY, Filter>::value) {
+						morphological = true;
+						element = impl.element();
+						morphology = impl.operation();
+					}
+
+					if constexpr (std::is_same<Filter, FilterType::BILATERAL>::value) {
+						bilateral = true;
+						spatialSigma = impl.spatialSigma();
+						rangeSigma = impl.rangeSigma();
+					}
+
+					if constexpr (HasStaticKernel<Filter>::value) {
+						staticRow = &correlateRowStatic<typename Filter::StaticKernel, ChannelType>;
+					}
+
+					symmetric = filterKernel == rot180(filterKernel);
+					hasKernel = true;
+				}
+
+				if (convolution != rotated) {
+					filterKernel = rot180(filterKernel);
+					for (auto &stage : stages) {
+						stage = rot180(stage);
+					}
+
+					rotated = convolution;
+				}
+
+				return filterKernel;
+			}
+
+			bool hasKernel = false;
+			FilterKernel filterKernel;
+
+			/**
+			 * The kernel is rotated for the convolution, symmetric if the rotation doesn't change it
+			 * (the static kernel of the filter can be used only then)
+			 */
+			bool rotated = false;
+			bool symmetric = false;
+
+			/**
+			 * Row kernel of the static kernel of the filter, nullptr if the filter has none.
+			 * The direct engine uses it instead of the generic one
+			 */
+			void (*staticRow)(const ChannelType *const *rows, ChannelType *out, size_t n, size_t stride) = nullptr;
+
+			/**
+			 * Kernels of the stages of FilterType::CHAIN, empty for other filters
+			 */
+			std::vector<FilterKernel> stages;
+			ConvolutionPlan plan;
+
+			/**
+			 * Coefficients of FilterType::RECURSIVE_GAUSSIAN (sigma is 0 for other filters)
+			 * and the rows of its horizontal pass
+			 */
+			RecursiveGaussian recursive;
+			blaze::DynamicMatrix<double> recursiveRows;
+
+			/**
+			 * FilterType::RANK and its kinds: the rank of the result in the window of the kernel
+			 */
+			bool ranked = false;
+			size_t rank = 0;
+
+			/**
+			 * FilterType::MORPHOLOGY and its kinds: the structuring element and the operation
+			 */
+			bool morphological = false;
+			StructuringElement element = StructuringElement::rectangle(1, 1);
+			MorphologyOperation morphology = MorphologyOperation::ERODE;
+
+			/**
+			 * FilterType::BILATERAL: the sigmas of the spatial and the range Gaussians
+			 */
+			bool bilateral = false;
+			double spatialSigma = 0;
+			double rangeSigma = 0;
+
+			/**
+			 * Row of the init value of the padding for the CONST rows
+			 */
+			std::vector<ChannelType> constRow;
+			std::vector<Accumulator> constRowAccumulator;
+
+			/**
+			 * Per channel: the padded input and the result of the padded engines,
+			 * the channels converted to the accumulator for the direct engine
+			 */
+			std::vector<blaze::DynamicMatrix<Accumulator>> padded;
+			std::vector<blaze::DynamicMatrix<Accumulator>> results;
+			std::vector<FFTWorkspace> fft;
+			std::vector<Channel<Accumulator>> sources;
+
+			/**
+			 * Per channel: the padded input and the result of the engines which work in the type of the channel
+			 * (the non-linear filters and the fixed-point engine of the padded matrix)
+			 */
+			std::vector<blaze::DynamicMatrix<ChannelType>> paddedChannels;
+			std::vector<blaze::DynamicMatrix<ChannelType>> resultChannels;
+
+			/**
+			 * Channels of the views and the gathered channels of views of different layouts
+			 */
+			std::vector<ChannelView<const ChannelType>> inputViews;
+			std::vector<ChannelView<ChannelType>> outputViews;
+			std::vector<Channel<ChannelType>> gathered;
+			std::vector<Channel<ChannelType>> scattered;
+
+			/**
+			 * Stages of the calls with this workspace, it's recorded with IMAGE_FILTER_PROFILE only
+			 */
+			FilterProfile profile;
+		};
 
 		/**
 		 * Filter an one channel
@@ -396,13 +1702,17 @@ namespace metric {
 		 * @param img image to filter (onlye a channel)
 		 * @param impl implementation of the filter
 		 * @param padmodel padding
-		 * @param full if true it returns the matrix with padding, else returns only the image
+		 * @param shape shape of the result
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
 		 * @return the filtered image
 		 */
-		template<typename Filter, typename ChannelType>
+		template<typename Filter, typename ChannelType, typename Accumulator = double>
 		Channel<ChannelType>
 		filter(const Channel<ChannelType> &img, const Filter &impl,
-				 const PadModel <ChannelType> &padmodel, bool full = true);
+				 const PadModel <ChannelType> &padmodel, FilterShape shape = FilterShape::FULL,
+				 const ConvolutionSettings &settings = ConvolutionSettings(),
+				 FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
 
 		/**
 		 * Filter an image
@@ -411,13 +1721,165 @@ namespace metric {
 		 * @param img image to filter
 		 * @param impl implementation of the filter
 		 * @param padmodel padding
-		 * @param full if true it returns the matrix with padding, else returns only the image
+		 * @param shape shape of the result
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
 		 * @return the filtered image
 		 */
-		template<typename Filter, typename ChannelType, size_t ChannelNumber>
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
 		Image<ChannelType, ChannelNumber>
 		filter(const Image<ChannelType, ChannelNumber> &img, const Filter &impl,
-				 const PadModel <ChannelType> &padmodel, bool full = true);
+				 const PadModel <ChannelType> &padmodel, FilterShape shape = FilterShape::FULL,
+				 const ConvolutionSettings &settings = ConvolutionSettings(),
+				 FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an interleaved image without converting it to the planar layout
+		 * @tparam Filter type of the filter
+		 * @tparam ChannelType type of the chanel
+		 * @param img image to filter
+		 * @param impl implementation of the filter
+		 * @param padmodel padding
+		 * @param shape shape of the result
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 * @return the filtered image
+		 */
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
+		InterleavedImage<ChannelType, ChannelNumber>
+		filter(const InterleavedImage<ChannelType, ChannelNumber> &img, const Filter &impl,
+			   const PadModel<ChannelType> &padmodel, FilterShape shape = FilterShape::FULL,
+			   const ConvolutionSettings &settings = ConvolutionSettings(),
+			   FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an image in an external buffer into another one
+		 * @tparam Filter type of the filter
+		 * @tparam ChannelType type of the chanel
+		 * @param img view of the image to filter
+		 * @param output view of the result, its shape chooses the shape of the result: the shape
+		 * of the image (FilterShape::SAME), of the full result or of the valid one
+		 * @param impl implementation of the filter
+		 * @param padmodel padding
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 */
+		template<typename Filter, typename ChannelType, typename Accumulator = double>
+		void filter(const ImageView<const ChannelType> &img, const ImageView<ChannelType> &output, const Filter &impl,
+					const PadModel<ChannelType> &padmodel,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter a batch of channels of the same shape. The kernel and the plan are prepared once,
+		 * each frame is a task on the threads and its tiles are tasks too
+		 * @param frames the channels to filter
+		 * @param outputs the results, the vector and the channels are resized if their sizes differ
+		 * @param impl implementation of the filter
+		 * @param padmodel padding
+		 * @param shape shape of the results
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 */
+		template<typename Filter, typename ChannelType, typename Accumulator = double>
+		void filter(const std::vector<Channel<ChannelType>> &frames, std::vector<Channel<ChannelType>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel,
+					FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter a batch of images whose channels have the same shape
+		 * @see filter
+		 */
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
+		void filter(const std::vector<Image<ChannelType, ChannelNumber>> &frames,
+					std::vector<Image<ChannelType, ChannelNumber>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel,
+					FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter a batch of interleaved images of the same shape
+		 * @see filter
+		 */
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
+		void filter(const std::vector<InterleavedImage<ChannelType, ChannelNumber>> &frames,
+					std::vector<InterleavedImage<ChannelType, ChannelNumber>> &outputs,
+					const Filter &impl, const PadModel<ChannelType> &padmodel,
+					FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an image band by band, so it doesn't need to fit in memory. The rows of the current band
+		 * and its halo (kernel.rows() - 1 rows) are padded and convoluted by the engine which imgcov2
+		 * would choose, the rows of the halo are kept for the next band. If bandRows >= kernel.rows() - 1
+		 * the reader is called with increasing rows and reads each row once, except for CIRCULAR padding:
+		 * the top padding reads the last rows and the bottom one reads the first rows again,
+		 * so the reader needs random access.
+		 * Peak memory is O(bandRows * columns), the index maps of the padding are O(rows).
+		 * @tparam Filter type of the filter
+		 * @tparam ChannelType type of the chanel
+		 * @param rows number of rows of the image
+		 * @param columns number of columns of the image
+		 * @param channels number of interleaved channels of the rows
+		 * @param reader reads the rows of the image
+		 * @param writer receives the rows of the result in order
+		 * @param impl implementation of the filter
+		 * @param padmodel padding
+		 * @param bandRows number of rows of the result per band
+		 * @param shape shape of the result
+		 * @param settings settings of the convolution
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 */
+		template<typename Filter, typename ChannelType, typename Accumulator = double>
+		void filterStream(size_t rows, size_t columns, size_t channels, const RowReader<ChannelType> &reader,
+						  const RowWriter<ChannelType> &writer, const Filter &impl,
+						  const PadModel<ChannelType> &padmodel, size_t bandRows = 256,
+						  FilterShape shape = FilterShape::FULL,
+						  const ConvolutionSettings &settings = ConvolutionSettings(),
+						  FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an one channel into an output
+		 * @param output the result, it's resized if its shape differs
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 * @see filter
+		 */
+		template<typename Filter, typename ChannelType, typename Accumulator = double>
+		void filter(const Channel<ChannelType> &img, Channel<ChannelType> &output, const Filter &impl,
+					const PadModel<ChannelType> &padmodel, FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an image into an output
+		 * @param output the result, its channels are resized if their shapes differ
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 * @see filter
+		 */
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
+		void filter(const Image<ChannelType, ChannelNumber> &img, Image<ChannelType, ChannelNumber> &output,
+					const Filter &impl, const PadModel<ChannelType> &padmodel,
+					FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
+
+		/**
+		 * Filter an interleaved image into an output
+		 * @param output the result, it's resized if its shape differs
+		 * @param workspace buffers which are reused between calls, nullptr to use temporary ones
+		 * @see filter
+		 */
+		template<typename Filter, typename ChannelType, size_t ChannelNumber, typename Accumulator = double>
+		void filter(const InterleavedImage<ChannelType, ChannelNumber> &img,
+					InterleavedImage<ChannelType, ChannelNumber> &output,
+					const Filter &impl, const PadModel<ChannelType> &padmodel,
+					FilterShape shape = FilterShape::FULL,
+					const ConvolutionSettings &settings = ConvolutionSettings(),
+					FilterWorkspace<ChannelType, Accumulator> *workspace = nullptr);
 
 	}
 }
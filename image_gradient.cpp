@@ -0,0 +1,138 @@
+//
+// Created by Aleksey Timin on 4/24/20.
+//
+
+#include "image_gradient.h"
+
+namespace metric {
+	namespace image_processing_details {
+		template<typename T, typename V>
+		T gradientValue(V value) {
+			if constexpr (std::is_integral<T>::value && std::is_integral<V>::value) {
+				// The sums of the integer channels only need the saturation, it's vectorized
+				if constexpr (sizeof(T) < sizeof(V)) {
+					value = std::max<V>(std::numeric_limits<T>::lowest(), value);
+					value = std::min<V>(std::numeric_limits<T>::max(), value);
+				}
+
+				return static_cast<T>(value);
+			} else if constexpr (std::is_integral<T>::value) {
+				double rounded = std::round(static_cast<double>(value));
+				rounded = std::max<double>(std::numeric_limits<T>::lowest(), rounded);
+				return static_cast<T>(std::min<double>(std::numeric_limits<T>::max(), rounded));
+			} else {
+				return static_cast<T>(value);
+			}
+		}
+	}
+
+	template<typename ChannelType, typename OutputType, typename Operator>
+	Gradient<OutputType> imgradient<ChannelType, OutputType, Operator>::operator()(const Channel<ChannelType> &input) {
+		Gradient<OutputType> output;
+		(*this)(input, output);
+		return output;
+	}
+
+	template<typename ChannelType, typename OutputType, typename Operator>
+	void imgradient<ChannelType, OutputType, Operator>::operator()(const Channel<ChannelType> &input,
+																	Gradient<OutputType> &output) {
+		using namespace image_processing_details;
+		using Kernel = typename Operator::StaticKernel;
+		// The magnitude of the integer sums is found in float, it's exact enough for the rounding
+		using Real = std::conditional_t<std::is_same<Accumulator, double>::value
+										|| std::is_same<OutputType, double>::value, double, float>;
+
+		beginCall(_profile);
+
+		size_t rows = input.rows();
+		size_t cols = input.columns();
+		for (auto *channel : {&output.x, &output.y, &output.magnitude}) {
+			channel->resize(rows, cols, false);
+		}
+
+		output.orientation.resize(_orientation ? rows : 0, _orientation ? cols : 0, false);
+		if (rows == 0 || cols == 0) {
+			return;
+		}
+
+		StageTimer<> timer(_profile, FilterStage::CORRELATE,
+						   rows * cols * sizeof(OutputType) * (_orientation ? 4 : 3), rows * cols);
+
+		const Accumulator s0 = Kernel::coefficients[0];
+		const Accumulator s1 = Kernel::coefficients[1];
+		const Accumulator s2 = Kernel::coefficients[2];
+
+		// Only the 1-pixel frame is remapped, the rows of -1 (PadType::CONST) are read from a line of init values
+		auto rowMap = _padmodel.indexMap(1, rows);
+		auto colMap = _padmodel.indexMap(1, cols);
+		const ChannelType init = _padmodel.initValue();
+		std::vector<ChannelType> initRow(cols, init);
+
+		auto value = [&](const ChannelType *row, long column) -> Accumulator {
+			return column < 0 ? init : row[column];
+		};
+
+		size_t bandRows = std::max<size_t>(1, _settings.tileRows);
+		size_t bands = (rows + bandRows - 1) / bandRows;
+		forEachTask(bands, _settings, [&](size_t band) {
+			// smooth: the columns smoothed vertically, diff: the vertical differences, both with the frame
+			thread_local std::vector<Accumulator> smooth;
+			thread_local std::vector<Accumulator> diff;
+			smooth.resize(cols + 2);
+			diff.resize(cols + 2);
+
+			for (size_t i = band * bandRows; i < std::min(rows, (band + 1) * bandRows); ++i) {
+				const ChannelType *r[3];
+				for (size_t a = 0; a < 3; ++a) {
+					long src = rowMap[i + a];
+					r[a] = src < 0 ? initRow.data() : input.data(src);
+				}
+
+				for (size_t k : {size_t(0), cols + 1}) {
+					Accumulator v0 = value(r[0], colMap[k]);
+					Accumulator v1 = value(r[1], colMap[k]);
+					Accumulator v2 = value(r[2], colMap[k]);
+					smooth[k] = s0 * v0 + s1 * v1 + s2 * v2;
+					diff[k] = v2 - v0;
+				}
+
+				Accumulator *sm = smooth.data() + 1;
+				Accumulator *df = diff.data() + 1;
+				for (size_t j = 0; j < cols; ++j) {
+					Accumulator v0 = r[0][j];
+					Accumulator v1 = r[1][j];
+					Accumulator v2 = r[2][j];
+					sm[j] = s0 * v0 + s1 * v1 + s2 * v2;
+					df[j] = v2 - v0;
+				}
+
+				OutputType *gx = output.x.data(i);
+				OutputType *gy = output.y.data(i);
+				OutputType *magnitude = output.magnitude.data(i);
+				for (size_t j = 0; j < cols; ++j) {
+					Accumulator x = smooth[j + 2] - smooth[j];
+					Accumulator y = s0 * diff[j] + s1 * diff[j + 1] + s2 * diff[j + 2];
+					gx[j] = gradientValue<OutputType>(x);
+					gy[j] = gradientValue<OutputType>(y);
+					Real length = std::sqrt(static_cast<Real>(x) * x + static_cast<Real>(y) * y);
+					if constexpr (std::is_integral<OutputType>::value) {
+						// The length isn't negative, so the rounding is a truncation of length + 0.5
+						length = std::min<Real>(std::numeric_limits<OutputType>::max(), length + Real(0.5));
+						magnitude[j] = static_cast<OutputType>(length);
+					} else {
+						magnitude[j] = static_cast<OutputType>(length);
+					}
+				}
+
+				if (_orientation) {
+					OutputType *orientation = output.orientation.data(i);
+					for (size_t j = 0; j < cols; ++j) {
+						Real x = smooth[j + 2] - smooth[j];
+						Real y = s0 * diff[j] + s1 * diff[j + 1] + s2 * diff[j + 2];
+						orientation[j] = gradientValue<OutputType>(std::atan2(Real(0) - y, x) * Real(180 / M_PI));
+					}
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,140 @@
+//
+// Created by Aleksey Timin on 4/24/20.
+//
+
+#ifndef IMAGEGRADIENT_H
+#define IMAGEGRADIENT_H
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "image_filter.h"
+
+/**
+ * Gradient of a channel by the Sobel or Prewitt operator (the analog of Matlab's imgradient and imgradientxy).
+ * The neighborhood of each pixel is read once and the directional gradients, the magnitude and the orientation
+ * are computed in the same sweep. Unlike imfilter with FilterType::SOBEL the results are signed.
+ *
+ * Usage:
+ *
+ * imgradient<uint8_t, int16_t, FilterType::SOBEL> g(PadType::REPLICATE);
+ * Gradient<int16_t> grad = g(input);   // grad.x, grad.y, grad.magnitude
+ *
+ * imgradient<uint8_t, float, FilterType::PREWITT> g(PadType::REPLICATE, 0, true);
+ * Gradient<float> grad = g(input);     // and grad.orientation in degrees
+ */
+namespace metric {
+	/**
+	 * Results of imgradient, all of them have the shape of the input
+	 * @tparam T signed integer or floating type of the elements
+	 */
+	template<typename T>
+	struct Gradient {
+		/** horizontal gradient, positive when the intensity increases to the right */
+		Channel<T> x;
+		/** vertical gradient, positive when the intensity increases downwards */
+		Channel<T> y;
+		/** sqrt(x^2 + y^2) */
+		Channel<T> magnitude;
+		/** atan2(-y, x) in degrees in (-180, 180], counterclockwise from the x-axis. Empty if it's not requested */
+		Channel<T> orientation;
+	};
+
+	namespace image_processing_details {
+		/**
+		 * Checks that a static kernel approximates a vertical gradient: the first row is the smoothing,
+		 * the second row is zeros and the third one is the negated first row (FilterType::SOBEL, FilterType::PREWITT)
+		 */
+		template<typename Kernel>
+		constexpr bool isGradientKernel() {
+			if (Kernel::rows != 3 || Kernel::columns != 3 || Kernel::divisor != 1) {
+				return false;
+			}
+
+			for (size_t j = 0; j < 3; ++j) {
+				if (Kernel::coefficients[3 + j] != 0 || Kernel::coefficients[6 + j] != -Kernel::coefficients[j]) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * Type of the sums of the gradient: int32_t for 8 and 16 bit channels, the type itself for floating ones
+		 */
+		template<typename T>
+		using GradientAccumulator = std::conditional_t<std::is_floating_point<T>::value, T,
+				std::conditional_t<sizeof(T) <= 2, int32_t, double>>;
+
+		/**
+		 * Converts a value to the output type: rounds and saturates for integer types
+		 */
+		template<typename T, typename V>
+		T gradientValue(V value);
+	}
+
+	/**
+	 * Gradient of a channel in one pass
+	 * @tparam ChannelType type of the input elements
+	 * @tparam OutputType signed integer or floating type of the results, e.g. int16_t for uint8_t input
+	 * @tparam Operator FilterType::SOBEL or FilterType::PREWITT
+	 */
+	template<typename ChannelType, typename OutputType = float, typename Operator = FilterType::SOBEL>
+	class imgradient {
+	public:
+		static_assert(std::is_signed<OutputType>::value, "the gradient needs a signed output type");
+		static_assert(image_processing_details::isGradientKernel<typename Operator::StaticKernel>(),
+					  "the operator must be a 3-by-3 vertical gradient like FilterType::SOBEL");
+
+		/**
+		 * Creates the operator
+		 * @param padType how the pixels outside the channel are found (PadType::REPLICATE as in Matlab)
+		 * @param initValue the value outside the channel for PadType::CONST
+		 * @param orientation compute the orientation
+		 */
+		explicit imgradient(PadType padType = PadType::REPLICATE, ChannelType initValue = {},
+							bool orientation = false)
+				: _padmodel(PadDirection::BOTH, padType, initValue), _orientation(orientation) {}
+
+		/**
+		 * Computes the gradient of a channel
+		 * @param input the channel
+		 * @return the gradient
+		 */
+		Gradient<OutputType> operator()(const Channel<ChannelType> &input);
+
+		/**
+		 * Computes the gradient of a channel into an output, its channels are resized if their shapes differ
+		 * @param input the channel
+		 * @param output the gradient
+		 */
+		void operator()(const Channel<ChannelType> &input, Gradient<OutputType> &output);
+
+		/**
+		 * Settings of the threads (threads and tileRows are used)
+		 */
+		ConvolutionSettings &settings() {
+			return _settings;
+		}
+
+		/**
+		 * Durations of the sweeps (only with IMAGE_FILTER_PROFILE)
+		 */
+		const FilterProfile &profile() const {
+			return _profile;
+		}
+
+	private:
+		using Accumulator = image_processing_details::GradientAccumulator<ChannelType>;
+
+		PadModel<ChannelType> _padmodel;
+		bool _orientation;
+		ConvolutionSettings _settings;
+		FilterProfile _profile;
+	};
+}
+
+#include "image_gradient.cpp"
+#endif //IMAGEGRADIENT_H
@@ -0,0 +1,150 @@
+//
+// Created by Aleksey Timin on 4/23/20.
+//
+
+#include "image_profile.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace metric {
+	FilterProfile::FilterProfile(const FilterProfile &other) {
+		std::lock_guard<std::mutex> lock(other._mutex);
+		_calls = other._calls;
+		_total = other._total;
+		_last = other._last;
+	}
+
+	FilterProfile &FilterProfile::operator=(const FilterProfile &other) {
+		if (this != &other) {
+			FilterProfile copy(other);
+			std::lock_guard<std::mutex> lock(_mutex);
+			_calls = copy._calls;
+			_total = copy._total;
+			_last = copy._last;
+		}
+
+		return *this;
+	}
+
+	void FilterProfile::begin() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			++_calls;
+			_last = Stages{};
+		}
+
+		auto &shared = global();
+		if (this != &shared) {
+			std::lock_guard<std::mutex> lock(shared._mutex);
+			++shared._calls;
+			shared._last = Stages{};
+		}
+	}
+
+	void FilterProfile::add(FilterStage stage, double seconds, size_t bytes, size_t pixels) {
+		record(stage, seconds, bytes, pixels);
+
+		auto &shared = global();
+		if (this != &shared) {
+			shared.record(stage, seconds, bytes, pixels);
+		}
+	}
+
+	void FilterProfile::record(FilterStage stage, double seconds, size_t bytes, size_t pixels) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto *stages : {&_total, &_last}) {
+			auto &stats = (*stages)[static_cast<size_t>(stage)];
+			++stats.runs;
+			stats.seconds += seconds;
+			stats.bytes += bytes;
+			stats.pixels += pixels;
+		}
+	}
+
+	size_t FilterProfile::calls() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _calls;
+	}
+
+	StageStats FilterProfile::total(FilterStage stage) const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _total[static_cast<size_t>(stage)];
+	}
+
+	StageStats FilterProfile::last(FilterStage stage) const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _last[static_cast<size_t>(stage)];
+	}
+
+	void FilterProfile::reset() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_calls = 0;
+		_total = Stages{};
+		_last = Stages{};
+	}
+
+	std::string FilterProfile::text() const {
+		FilterProfile copy(*this);
+		std::ostringstream out;
+		out << "calls: " << copy._calls << "\n";
+		out << std::left << std::setw(10) << "stage" << std::right << std::setw(10) << "runs" << std::setw(14)
+			<< "ms" << std::setw(16) << "bytes" << std::setw(16) << "pixels" << "\n";
+		for (size_t k = 0; k < filterStageCount; ++k) {
+			auto &stats = copy._total[k];
+			out << std::left << std::setw(10) << name(static_cast<FilterStage>(k)) << std::right << std::setw(10)
+				<< stats.runs << std::setw(14) << std::fixed << std::setprecision(3) << stats.seconds * 1e3
+				<< std::setw(16) << stats.bytes << std::setw(16) << stats.pixels << "\n";
+		}
+
+		return out.str();
+	}
+
+	std::string FilterProfile::json() const {
+		FilterProfile copy(*this);
+		std::ostringstream out;
+		out << std::setprecision(9);
+		auto stages = [&](const Stages &values) {
+			out << "{";
+			for (size_t k = 0; k < filterStageCount; ++k) {
+				auto &stats = values[k];
+				out << (k ? ", " : "") << "\"" << name(static_cast<FilterStage>(k)) << "\": {\"runs\": "
+					<< stats.runs << ", \"seconds\": " << stats.seconds << ", \"bytes\": " << stats.bytes
+					<< ", \"pixels\": " << stats.pixels << "}";
+			}
+
+			out << "}";
+		};
+
+		out << "{\"calls\": " << copy._calls << ", \"total\": ";
+		stages(copy._total);
+		out << ", \"last\": ";
+		stages(copy._last);
+		out << "}";
+		return out.str();
+	}
+
+	FilterProfile &FilterProfile::global() {
+		static FilterProfile profile;
+		return profile;
+	}
+
+	const char *FilterProfile::name(FilterStage stage) {
+		switch (stage) {
+			case FilterStage::KERNEL:
+				return "kernel";
+			case FilterStage::PLAN:
+				return "plan";
+			case FilterStage::PAD:
+				return "pad";
+			case FilterStage::CORRELATE:
+				return "correlate";
+			case FilterStage::CROP:
+				return "crop";
+			case FilterStage::CONVERT:
+				return "convert";
+		}
+
+		return "";
+	}
+}
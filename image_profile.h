@@ -0,0 +1,189 @@
+//
+// Created by Aleksey Timin on 4/23/20.
+//
+
+#ifndef IMAGEPROFILE_H
+#define IMAGEPROFILE_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+/**
+ * Instrumentation of the stages of the filters. It's compiled in only with IMAGE_FILTER_PROFILE defined,
+ * otherwise the timers are empty objects and the profiles stay empty.
+ *
+ * Usage:
+ *
+ * // g++ -DIMAGE_FILTER_PROFILE ...
+ * imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::CONST> f(5, 5, 1.0);
+ * f(input);
+ * std::cout << f.profile().text();                 // the stages of the calls of f
+ * std::cout << FilterProfile::global().json();     // the stages of all filters
+ */
+namespace metric {
+#ifdef IMAGE_FILTER_PROFILE
+	constexpr bool profiling = true;
+#else
+	constexpr bool profiling = false;
+#endif
+
+	/**
+	 * Stages of a call of a filter
+	 */
+	enum class FilterStage {
+		KERNEL,     // impl(): generation of the kernel
+		PLAN,       // choice of the engine and preparation of its plan
+		PAD,        // padding of the input (PadModel::pad or its index maps)
+		CORRELATE,  // imgcov2 and the engines
+		CROP,       // copy of the computed region into the output and zeroing of the rest
+		CONVERT,    // conversion of the channels to double and copies between layouts
+	};
+
+	constexpr size_t filterStageCount = 6;
+
+	/**
+	 * Counters of a stage
+	 */
+	struct StageStats {
+		/** number of times the stage ran */
+		size_t runs = 0;
+		/** sum of the durations, the stages which run concurrently are summed over the threads */
+		double seconds = 0;
+		/** bytes of the buffers the stage wrote */
+		size_t bytes = 0;
+		/** elements (pixels of a channel) the stage processed */
+		size_t pixels = 0;
+	};
+
+	/**
+	 * Per-stage counters of the calls of a filter: the totals and the last call.
+	 * The stages are recorded by several threads, so all methods are thread-safe
+	 */
+	class FilterProfile {
+	public:
+		FilterProfile() = default;
+
+		FilterProfile(const FilterProfile &other);
+		FilterProfile &operator=(const FilterProfile &other);
+
+		/**
+		 * Starts a call: the counters of the last call are reset
+		 */
+		void begin();
+
+		/**
+		 * Records a run of a stage in this profile and in global()
+		 */
+		void add(FilterStage stage, double seconds, size_t bytes, size_t pixels);
+
+		/**
+		 * Returns the number of the calls
+		 */
+		size_t calls() const;
+
+		/**
+		 * Returns the counters of a stage over all calls
+		 */
+		StageStats total(FilterStage stage) const;
+
+		/**
+		 * Returns the counters of a stage in the last call
+		 */
+		StageStats last(FilterStage stage) const;
+
+		/**
+		 * Resets all counters
+		 */
+		void reset();
+
+		/**
+		 * Returns the totals as a table, a line per stage
+		 */
+		std::string text() const;
+
+		/**
+		 * Returns the totals and the last call as a JSON object
+		 */
+		std::string json() const;
+
+		/**
+		 * Returns the process-wide profile which sums all profiles
+		 */
+		static FilterProfile &global();
+
+		/**
+		 * Returns the name of a stage in lower case
+		 */
+		static const char *name(FilterStage stage);
+
+	private:
+		using Stages = std::array<StageStats, filterStageCount>;
+
+		void record(FilterStage stage, double seconds, size_t bytes, size_t pixels);
+
+		mutable std::mutex _mutex;
+		size_t _calls = 0;
+		Stages _total{};
+		Stages _last{};
+	};
+
+	namespace image_processing_details {
+		/**
+		 * Measures a stage from the construction to the destruction and adds it to a profile.
+		 * Without IMAGE_FILTER_PROFILE it does nothing
+		 */
+		template<bool Enabled = profiling>
+		class StageTimer {
+		public:
+			StageTimer(FilterProfile &profile, FilterStage stage, size_t bytes, size_t pixels)
+					: _profile(profile), _stage(stage), _bytes(bytes), _pixels(pixels),
+					  _start(std::chrono::steady_clock::now()) {}
+
+			~StageTimer() {
+				std::chrono::duration<double> duration = std::chrono::steady_clock::now() - _start;
+				_profile.add(_stage, duration.count(), _bytes, _pixels);
+			}
+
+			StageTimer(const StageTimer &) = delete;
+			StageTimer &operator=(const StageTimer &) = delete;
+
+			/**
+			 * Sets the amount of work when it's known after the start
+			 */
+			void amount(size_t bytes, size_t pixels) {
+				_bytes = bytes;
+				_pixels = pixels;
+			}
+
+		private:
+			FilterProfile &_profile;
+			FilterStage _stage;
+			size_t _bytes;
+			size_t _pixels;
+			std::chrono::steady_clock::time_point _start;
+		};
+
+		template<>
+		class StageTimer<false> {
+		public:
+			StageTimer(FilterProfile &, FilterStage, size_t, size_t) {}
+
+			void amount(size_t, size_t) {}
+		};
+
+		/**
+		 * Starts a call of a filter in the profile (only with IMAGE_FILTER_PROFILE)
+		 */
+		inline void beginCall(FilterProfile &profile) {
+			if constexpr (profiling) {
+				profile.begin();
+			}
+		}
+	}
+}
+
+#include "image_profile.cpp"
+#endif //IMAGEPROFILE_H
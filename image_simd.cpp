@@ -0,0 +1,309 @@
+//
+// Created by Aleksey Timin on 4/14/20.
+//
+
+#include "image_simd.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_FILTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace metric {
+	namespace image_processing_details {
+
+		SimdLevel simdLevel() {
+#ifdef IMAGE_FILTER_X86_SIMD
+			static const SimdLevel level = [] {
+				__builtin_cpu_init();
+				if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+					return SimdLevel::AVX2;
+				}
+
+				if (__builtin_cpu_supports("sse2")) {
+					return SimdLevel::SSE2;
+				}
+
+				return SimdLevel::SCALAR;
+			}();
+
+			return level;
+#else
+			return SimdLevel::SCALAR;
+#endif
+		}
+
+		/**
+		 * Computes out[from, columns) without SIMD, the sums are in the type of the elements
+		 */
+		template<typename T>
+		void correlateRowScalar(const T *const *rows, const std::vector<BasicKernelTap<T>> &taps,
+								T *out, size_t from, size_t columns) {
+			for (size_t j = from; j < columns; ++j) {
+				T sum = 0;
+				for (const auto &tap : taps) {
+					sum += tap.value * rows[tap.row][j + tap.column];
+				}
+
+				out[j] = sum;
+			}
+		}
+
+		/**
+		 * Computes out[from, columns) of the fixed-point correlation without SIMD
+		 */
+		template<typename T, typename Accumulator>
+		void correlateRowFixedScalar(const T *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+									 T *out, size_t from, size_t columns) {
+			const Accumulator offset = shift > 0 ? Accumulator(1) << (shift - 1) : 0;
+			const Accumulator maxValue = std::numeric_limits<T>::max();
+			for (size_t j = from; j < columns; ++j) {
+				Accumulator sum = offset;
+				for (const auto &tap : taps) {
+					sum += static_cast<Accumulator>(tap.value) * rows[tap.row][j + tap.column];
+				}
+
+				sum = sum > 0 ? sum >> shift : 0;
+				out[j] = static_cast<T>(std::min(sum, maxValue));
+			}
+		}
+
+#ifdef IMAGE_FILTER_X86_SIMD
+		__attribute__((target("sse2")))
+		void correlateRowSSE2(const double *const *rows, const std::vector<KernelTap> &taps,
+							  double *out, size_t columns) {
+			size_t j = 0;
+			// 8 output pixels per iteration in 4 registers
+			for (; j + 8 <= columns; j += 8) {
+				__m128d acc0 = _mm_setzero_pd();
+				__m128d acc1 = _mm_setzero_pd();
+				__m128d acc2 = _mm_setzero_pd();
+				__m128d acc3 = _mm_setzero_pd();
+				for (const auto &tap : taps) {
+					const double *src = rows[tap.row] + j + tap.column;
+					__m128d k = _mm_set1_pd(tap.value);
+					acc0 = _mm_add_pd(acc0, _mm_mul_pd(k, _mm_loadu_pd(src)));
+					acc1 = _mm_add_pd(acc1, _mm_mul_pd(k, _mm_loadu_pd(src + 2)));
+					acc2 = _mm_add_pd(acc2, _mm_mul_pd(k, _mm_loadu_pd(src + 4)));
+					acc3 = _mm_add_pd(acc3, _mm_mul_pd(k, _mm_loadu_pd(src + 6)));
+				}
+
+				_mm_storeu_pd(out + j, acc0);
+				_mm_storeu_pd(out + j + 2, acc1);
+				_mm_storeu_pd(out + j + 4, acc2);
+				_mm_storeu_pd(out + j + 6, acc3);
+			}
+
+			for (; j + 2 <= columns; j += 2) {
+				__m128d acc = _mm_setzero_pd();
+				for (const auto &tap : taps) {
+					__m128d k = _mm_set1_pd(tap.value);
+					acc = _mm_add_pd(acc, _mm_mul_pd(k, _mm_loadu_pd(rows[tap.row] + j + tap.column)));
+				}
+
+				_mm_storeu_pd(out + j, acc);
+			}
+
+			correlateRowScalar(rows, taps, out, j, columns);
+		}
+
+		__attribute__((target("avx2,fma")))
+		void correlateRowAVX2(const double *const *rows, const std::vector<KernelTap> &taps,
+							  double *out, size_t columns) {
+			size_t j = 0;
+			// 16 output pixels per iteration in 4 registers
+			for (; j + 16 <= columns; j += 16) {
+				__m256d acc0 = _mm256_setzero_pd();
+				__m256d acc1 = _mm256_setzero_pd();
+				__m256d acc2 = _mm256_setzero_pd();
+				__m256d acc3 = _mm256_setzero_pd();
+				for (const auto &tap : taps) {
+					const double *src = rows[tap.row] + j + tap.column;
+					__m256d k = _mm256_set1_pd(tap.value);
+					acc0 = _mm256_fmadd_pd(k, _mm256_loadu_pd(src), acc0);
+					acc1 = _mm256_fmadd_pd(k, _mm256_loadu_pd(src + 4), acc1);
+					acc2 = _mm256_fmadd_pd(k, _mm256_loadu_pd(src + 8), acc2);
+					acc3 = _mm256_fmadd_pd(k, _mm256_loadu_pd(src + 12), acc3);
+				}
+
+				_mm256_storeu_pd(out + j, acc0);
+				_mm256_storeu_pd(out + j + 4, acc1);
+				_mm256_storeu_pd(out + j + 8, acc2);
+				_mm256_storeu_pd(out + j + 12, acc3);
+			}
+
+			for (; j + 4 <= columns; j += 4) {
+				__m256d acc = _mm256_setzero_pd();
+				for (const auto &tap : taps) {
+					__m256d k = _mm256_set1_pd(tap.value);
+					acc = _mm256_fmadd_pd(k, _mm256_loadu_pd(rows[tap.row] + j + tap.column), acc);
+				}
+
+				_mm256_storeu_pd(out + j, acc);
+			}
+
+			correlateRowScalar(rows, taps, out, j, columns);
+		}
+
+		__attribute__((target("sse2")))
+		void correlateRowSSE2(const float *const *rows, const std::vector<BasicKernelTap<float>> &taps,
+							  float *out, size_t columns) {
+			size_t j = 0;
+			// 16 output pixels per iteration in 4 registers
+			for (; j + 16 <= columns; j += 16) {
+				__m128 acc0 = _mm_setzero_ps();
+				__m128 acc1 = _mm_setzero_ps();
+				__m128 acc2 = _mm_setzero_ps();
+				__m128 acc3 = _mm_setzero_ps();
+				for (const auto &tap : taps) {
+					const float *src = rows[tap.row] + j + tap.column;
+					__m128 k = _mm_set1_ps(tap.value);
+					acc0 = _mm_add_ps(acc0, _mm_mul_ps(k, _mm_loadu_ps(src)));
+					acc1 = _mm_add_ps(acc1, _mm_mul_ps(k, _mm_loadu_ps(src + 4)));
+					acc2 = _mm_add_ps(acc2, _mm_mul_ps(k, _mm_loadu_ps(src + 8)));
+					acc3 = _mm_add_ps(acc3, _mm_mul_ps(k, _mm_loadu_ps(src + 12)));
+				}
+
+				_mm_storeu_ps(out + j, acc0);
+				_mm_storeu_ps(out + j + 4, acc1);
+				_mm_storeu_ps(out + j + 8, acc2);
+				_mm_storeu_ps(out + j + 12, acc3);
+			}
+
+			for (; j + 4 <= columns; j += 4) {
+				__m128 acc = _mm_setzero_ps();
+				for (const auto &tap : taps) {
+					__m128 k = _mm_set1_ps(tap.value);
+					acc = _mm_add_ps(acc, _mm_mul_ps(k, _mm_loadu_ps(rows[tap.row] + j + tap.column)));
+				}
+
+				_mm_storeu_ps(out + j, acc);
+			}
+
+			correlateRowScalar(rows, taps, out, j, columns);
+		}
+
+		__attribute__((target("avx2,fma")))
+		void correlateRowAVX2(const float *const *rows, const std::vector<BasicKernelTap<float>> &taps,
+							  float *out, size_t columns) {
+			size_t j = 0;
+			// 32 output pixels per iteration in 4 registers
+			for (; j + 32 <= columns; j += 32) {
+				__m256 acc0 = _mm256_setzero_ps();
+				__m256 acc1 = _mm256_setzero_ps();
+				__m256 acc2 = _mm256_setzero_ps();
+				__m256 acc3 = _mm256_setzero_ps();
+				for (const auto &tap : taps) {
+					const float *src = rows[tap.row] + j + tap.column;
+					__m256 k = _mm256_set1_ps(tap.value);
+					acc0 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src), acc0);
+					acc1 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src + 8), acc1);
+					acc2 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src + 16), acc2);
+					acc3 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src + 24), acc3);
+				}
+
+				_mm256_storeu_ps(out + j, acc0);
+				_mm256_storeu_ps(out + j + 8, acc1);
+				_mm256_storeu_ps(out + j + 16, acc2);
+				_mm256_storeu_ps(out + j + 24, acc3);
+			}
+
+			for (; j + 8 <= columns; j += 8) {
+				__m256 acc = _mm256_setzero_ps();
+				for (const auto &tap : taps) {
+					__m256 k = _mm256_set1_ps(tap.value);
+					acc = _mm256_fmadd_ps(k, _mm256_loadu_ps(rows[tap.row] + j + tap.column), acc);
+				}
+
+				_mm256_storeu_ps(out + j, acc);
+			}
+
+			correlateRowScalar(rows, taps, out, j, columns);
+		}
+
+		__attribute__((target("avx2")))
+		void correlateRowFixedAVX2(const uint8_t *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+								   uint8_t *out, size_t columns) {
+			const __m256i offset = _mm256_set1_epi32(shift > 0 ? 1 << (shift - 1) : 0);
+			const __m128i count = _mm_cvtsi32_si128(shift);
+			size_t j = 0;
+			// 16 output pixels per iteration in 2 registers of 8 int32_t
+			for (; j + 16 <= columns; j += 16) {
+				__m256i acc0 = offset;
+				__m256i acc1 = offset;
+				for (const auto &tap : taps) {
+					const uint8_t *src = rows[tap.row] + j + tap.column;
+					__m256i k = _mm256_set1_epi32(tap.value);
+					__m256i p0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src)));
+					__m256i p1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 8)));
+					acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32(p0, k));
+					acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32(p1, k));
+				}
+
+				acc0 = _mm256_sra_epi32(acc0, count);
+				acc1 = _mm256_sra_epi32(acc1, count);
+
+				// Saturate to int16_t, restore the order of the lanes, then saturate to uint8_t
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc0, acc1), 0xD8);
+				__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + j), bytes);
+			}
+
+			correlateRowFixedScalar<uint8_t, int32_t>(rows, taps, shift, out, j, columns);
+		}
+#endif
+
+		void correlateRow(const double *const *rows, const std::vector<KernelTap> &taps,
+						  double *out, size_t columns, SimdLevel level) {
+#ifdef IMAGE_FILTER_X86_SIMD
+			switch (std::min(level, simdLevel())) {
+				case SimdLevel::AVX2:
+					correlateRowAVX2(rows, taps, out, columns);
+					return;
+				case SimdLevel::SSE2:
+					correlateRowSSE2(rows, taps, out, columns);
+					return;
+				default:
+					break;
+			}
+#endif
+			correlateRowScalar(rows, taps, out, 0, columns);
+		}
+
+		void correlateRow(const float *const *rows, const std::vector<BasicKernelTap<float>> &taps,
+						  float *out, size_t columns, SimdLevel level) {
+#ifdef IMAGE_FILTER_X86_SIMD
+			switch (std::min(level, simdLevel())) {
+				case SimdLevel::AVX2:
+					correlateRowAVX2(rows, taps, out, columns);
+					return;
+				case SimdLevel::SSE2:
+					correlateRowSSE2(rows, taps, out, columns);
+					return;
+				default:
+					break;
+			}
+#endif
+			correlateRowScalar(rows, taps, out, 0, columns);
+		}
+	
+		void correlateRowFixed(const uint8_t *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+							   uint8_t *out, size_t columns, SimdLevel level) {
+#ifdef IMAGE_FILTER_X86_SIMD
+			if (std::min(level, simdLevel()) == SimdLevel::AVX2) {
+				correlateRowFixedAVX2(rows, taps, shift, out, columns);
+				return;
+			}
+#endif
+			correlateRowFixedScalar<uint8_t, int32_t>(rows, taps, shift, out, 0, columns);
+		}
+
+		void correlateRowFixed(const uint16_t *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+							   uint16_t *out, size_t columns, SimdLevel) {
+			correlateRowFixedScalar<uint16_t, int64_t>(rows, taps, shift, out, 0, columns);
+		}
+	}
+}
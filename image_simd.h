@@ -0,0 +1,113 @@
+//
+// Created by Aleksey Timin on 4/14/20.
+//
+
+#ifndef IMAGESIMD_H
+#define IMAGESIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace metric {
+	namespace image_processing_details {
+		/**
+		 * Instruction sets of the convolution kernels
+		 */
+		enum class SimdLevel {
+			SCALAR,
+			SSE2,
+			AVX2,
+		};
+
+		/**
+		 * Returns the best instruction set supported by the CPU (CPUID is checked once)
+		 */
+		SimdLevel simdLevel();
+
+		/**
+		 * Non zero element of a kernel
+		 * @tparam T type of the value, the type of the sums of the row kernel
+		 */
+		template<typename T>
+		struct BasicKernelTap {
+			size_t row;
+			size_t column;
+			T value;
+		};
+
+		using KernelTap = BasicKernelTap<double>;
+
+		/**
+		 * Non zero element of a kernel quantized to Q-format: value = round(element * 2^shift)
+		 */
+		struct FixedKernelTap {
+			size_t row;
+			size_t column;
+			int32_t value;
+		};
+
+		/**
+		 * Collects the non zero elements of a kernel, so the kernels skip zero taps
+		 * @tparam T type of the values of the taps
+		 * @tparam Kernel type of the kernel matrix
+		 * @param kernel the kernel
+		 * @return the taps in row-major order
+		 */
+		template<typename T = double, typename Kernel>
+		std::vector<BasicKernelTap<T>> kernelTaps(const Kernel &kernel) {
+			std::vector<BasicKernelTap<T>> taps;
+			for (size_t i = 0; i < kernel.rows(); ++i) {
+				for (size_t j = 0; j < kernel.columns(); ++j) {
+					if (kernel(i, j) != 0) {
+						taps.push_back(BasicKernelTap<T>{i, j, static_cast<T>(kernel(i, j))});
+					}
+				}
+			}
+
+			return taps;
+		}
+
+		/**
+		 * Computes one row of the correlation: out[j] = sum(tap.value * rows[tap.row][j + tap.column]).
+		 * Adjacent output pixels are computed together by sliding along the rows.
+		 * @param rows pointers to the input rows under the kernel
+		 * @param taps non zero elements of the kernel
+		 * @param out the output row
+		 * @param columns number of output pixels
+		 * @param level instruction set to use
+		 */
+		void correlateRow(const double *const *rows, const std::vector<KernelTap> &taps,
+						  double *out, size_t columns, SimdLevel level = simdLevel());
+
+		/**
+		 * Computes one row of the correlation in single precision with float taps, 8 pixels per AVX register
+		 * @see correlateRow
+		 */
+		void correlateRow(const float *const *rows, const std::vector<BasicKernelTap<float>> &taps,
+						  float *out, size_t columns, SimdLevel level = simdLevel());
+
+		/**
+		 * Computes one row of the fixed-point correlation of 8-bit data: products are accumulated in int32_t,
+		 * then the sums are rounded, shifted and saturated to [0, 255]
+		 * @param rows pointers to the input rows under the kernel
+		 * @param taps quantized non zero elements of the kernel
+		 * @param shift number of fractional bits of the taps
+		 * @param out the output row
+		 * @param columns number of output pixels
+		 * @param level instruction set to use
+		 */
+		void correlateRowFixed(const uint8_t *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+							   uint8_t *out, size_t columns, SimdLevel level = simdLevel());
+
+		/**
+		 * Computes one row of the fixed-point correlation of 16-bit data: products are accumulated in int64_t,
+		 * then the sums are rounded, shifted and saturated to [0, 65535]
+		 */
+		void correlateRowFixed(const uint16_t *const *rows, const std::vector<FixedKernelTap> &taps, int shift,
+							   uint16_t *out, size_t columns, SimdLevel level = simdLevel());
+	}
+}
+
+#include "image_simd.cpp"
+#endif //IMAGESIMD_H
@@ -0,0 +1,65 @@
+//
+// Created by Aleksey Timin on 4/20/20.
+//
+
+#include "image_stream.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metric {
+
+	template<typename T, size_t N>
+	MappedRawImage<T, N>::MappedRawImage(const std::string &path, size_t rows, size_t columns, size_t offset)
+			: _rows(rows), _columns(columns) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("can't open " + path);
+		}
+
+		struct stat info{};
+		size_t size = offset + rows * columns * N * sizeof(T);
+		if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < size) {
+			::close(fd);
+			throw std::invalid_argument(path + " is smaller than the image");
+		}
+
+		if (size > 0) {
+			// The offset of mmap must be aligned to the pages, so the header is mapped too
+			_mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (_mapping == MAP_FAILED) {
+				::close(fd);
+				throw std::runtime_error("can't map " + path);
+			}
+
+			_mappingSize = size;
+			::madvise(_mapping, size, MADV_SEQUENTIAL);
+			_data = reinterpret_cast<const T *>(static_cast<const char *>(_mapping) + offset);
+		}
+
+		::close(fd);
+	}
+
+	template<typename T, size_t N>
+	MappedRawImage<T, N>::~MappedRawImage() {
+		if (_mapping) {
+			::munmap(_mapping, _mappingSize);
+		}
+	}
+
+	template<typename T, size_t N>
+	RowReader<T> MappedRawImage<T, N>::reader() const {
+		return [this](size_t row, size_t count, T *data) {
+			if (row + count > _rows) {
+				throw std::out_of_range("the rows are out of the image");
+			}
+
+			std::copy(this->data(row), this->data(row) + count * _columns * N, data);
+		};
+	}
+}
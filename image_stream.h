@@ -0,0 +1,87 @@
+//
+// Created by Aleksey Timin on 4/20/20.
+//
+
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace metric {
+	/**
+	 * Reads rows [row, row + count) of an image into data: count rows of columns * channels
+	 * interleaved elements one after another
+	 */
+	template<typename T>
+	using RowReader = std::function<void(size_t row, size_t count, T *data)>;
+
+	/**
+	 * Receives rows [row, row + count) of a filtered image in the layout of RowReader
+	 */
+	template<typename T>
+	using RowWriter = std::function<void(size_t row, size_t count, const T *data)>;
+
+	/**
+	 * Raw image file (rows of interleaved pixels without a header) mapped into memory read-only,
+	 * so a streaming filter can read an image which is larger than RAM: the pages are loaded
+	 * when the rows are read and the kernel can drop them after.
+	 *
+	 * Usage:
+	 *
+	 * MappedRawImage<uint16_t, 1> mosaic("mosaic.raw", 200000, 150000);
+	 * imfilter<uint16_t, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> f(5, 5, 1.0);
+	 * f.stream(mosaic.rows(), mosaic.columns(), mosaic.reader(), writer, 512, FilterShape::SAME);
+	 *
+	 * @tparam T type of the element
+	 * @tparam N number of channels
+	 */
+	template<typename T, size_t N = 1>
+	class MappedRawImage {
+	public:
+		/**
+		 * Maps a file
+		 * @param path path to the file
+		 * @param rows number of rows (height)
+		 * @param columns number of columns (width)
+		 * @param offset size of the header before the first row in bytes
+		 */
+		MappedRawImage(const std::string &path, size_t rows, size_t columns, size_t offset = 0);
+
+		~MappedRawImage();
+
+		MappedRawImage(const MappedRawImage &) = delete;
+		MappedRawImage &operator=(const MappedRawImage &) = delete;
+
+		size_t rows() const {
+			return _rows;
+		}
+
+		size_t columns() const {
+			return _columns;
+		}
+
+		/**
+		 * Returns the first element of the row
+		 */
+		const T *data(size_t row) const {
+			return _data + row * _columns * N;
+		}
+
+		/**
+		 * Returns a reader of the rows, it's valid while the image is
+		 */
+		RowReader<T> reader() const;
+
+	private:
+		void *_mapping = nullptr;
+		size_t _mappingSize = 0;
+		const T *_data = nullptr;
+		size_t _rows;
+		size_t _columns;
+	};
+}
+
+#include "image_stream.cpp"
+#endif //IMAGESTREAM_H
@@ -0,0 +1,169 @@
+//
+// Created by Aleksey Timin on 4/18/20.
+//
+
+#include "image_thread_pool.h"
+
+#include <algorithm>
+#include <map>
+
+namespace metric {
+	namespace image_processing_details {
+
+		ThreadPool::ThreadPool(size_t threads) {
+			threads = threads == 0 ? hardwareThreads() : threads;
+			for (size_t i = 1; i < threads; ++i) {
+				_queues.push_back(std::make_unique<Queue>());
+			}
+
+			for (size_t i = 0; i < _queues.size(); ++i) {
+				_workers.emplace_back(&ThreadPool::work, this, i);
+			}
+		}
+
+		ThreadPool::~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+
+			_wake.notify_all();
+			for (auto &worker : _workers) {
+				worker.join();
+			}
+		}
+
+		void ThreadPool::run(size_t count, const std::function<void(size_t)> &task) {
+			if (_queues.empty() || count <= 1) {
+				for (size_t i = 0; i < count; ++i) {
+					task(i);
+				}
+
+				return;
+			}
+
+			Batch batch;
+			batch.task = &task;
+			batch.remaining = count;
+
+			// Neighbour tasks go to the same worker, the others steal if they run out
+			size_t queues = _queues.size();
+			for (size_t q = 0; q < queues; ++q) {
+				std::lock_guard<std::mutex> lock(_queues[q]->mutex);
+				for (size_t i = q * count / queues; i < (q + 1) * count / queues; ++i) {
+					_queues[q]->jobs.push_back(Job{&batch, i});
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_pending += count;
+			}
+
+			_wake.notify_all();
+
+			// Help the workers, then wait for the tasks which they're still running
+			Job job;
+			while (batch.remaining > 0 && take(queues, job)) {
+				execute(job);
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_done.wait(lock, [&batch] { return batch.remaining == 0; });
+			}
+
+			if (batch.error) {
+				std::rethrow_exception(batch.error);
+			}
+		}
+
+		ThreadPool &ThreadPool::shared(size_t threads) {
+			static std::mutex mutex;
+			static std::map<size_t, std::unique_ptr<ThreadPool>> pools;
+
+			threads = threads == 0 ? hardwareThreads() : threads;
+			std::lock_guard<std::mutex> lock(mutex);
+			auto &pool = pools[threads];
+			if (!pool) {
+				pool = std::make_unique<ThreadPool>(threads);
+			}
+
+			return *pool;
+		}
+
+		size_t ThreadPool::hardwareThreads() {
+			return std::max<size_t>(1, std::thread::hardware_concurrency());
+		}
+
+		void ThreadPool::work(size_t queue) {
+			while (true) {
+				Job job;
+				if (take(queue, job)) {
+					execute(job);
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this] { return _stop || _pending > 0; });
+				if (_stop && _pending == 0) {
+					return;
+				}
+			}
+		}
+
+		bool ThreadPool::take(size_t queue, Job &job) {
+			// Own queue from the front
+			if (queue < _queues.size()) {
+				std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+				auto &own = *_queues[queue];
+				if (own.head < own.jobs.size()) {
+					job = own.jobs[own.head++];
+					release(own);
+					--_pending;
+					return true;
+				}
+			}
+
+			// Steal from the back of the others
+			for (size_t i = 1; i <= _queues.size(); ++i) {
+				size_t victim = (queue + i) % _queues.size();
+				std::lock_guard<std::mutex> lock(_queues[victim]->mutex);
+				auto &other = *_queues[victim];
+				if (other.head < other.jobs.size()) {
+					job = other.jobs.back();
+					other.jobs.pop_back();
+					release(other);
+					--_pending;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void ThreadPool::release(Queue &queue) {
+			if (queue.head == queue.jobs.size()) {
+				queue.jobs.clear();
+				queue.head = 0;
+			}
+		}
+
+		void ThreadPool::execute(const Job &job) {
+			auto batch = job.batch;
+			try {
+				(*batch->task)(job.index);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(batch->errorMutex);
+				if (!batch->error) {
+					batch->error = std::current_exception();
+				}
+			}
+
+			if (--batch->remaining == 0) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				_done.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,110 @@
+//
+// Created by Aleksey Timin on 4/18/20.
+//
+
+#ifndef IMAGETHREADPOOL_H
+#define IMAGETHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace metric {
+	namespace image_processing_details {
+		/**
+		 * Work-stealing thread pool of the filters
+		 *
+		 * Each worker has its own queue: it takes tasks from the front of its queue and steals
+		 * from the back of the others when it runs out. The thread which calls run() helps the workers,
+		 * so run() can be called from a task.
+		 *
+		 * Usage:
+		 *
+		 * ThreadPool &pool = ThreadPool::shared(8);
+		 * pool.run(tiles.size(), [&](size_t i) { process(tiles[i]); });
+		 */
+		class ThreadPool {
+		public:
+			/**
+			 * Starts the workers
+			 * @param threads number of threads including the calling one (0 means all hardware threads)
+			 */
+			explicit ThreadPool(size_t threads);
+
+			~ThreadPool();
+
+			ThreadPool(const ThreadPool &) = delete;
+			ThreadPool &operator=(const ThreadPool &) = delete;
+
+			/**
+			 * Returns number of threads including the calling one
+			 */
+			size_t size() const {
+				return _queues.size() + 1;
+			}
+
+			/**
+			 * Runs task(0), ..., task(count - 1) and waits until all of them are done.
+			 * The first exception thrown by a task is rethrown
+			 * @param count number of tasks
+			 * @param task the task
+			 */
+			void run(size_t count, const std::function<void(size_t)> &task);
+
+			/**
+			 * Returns a process-wide pool with the number of threads, it's created on the first call
+			 * @param threads number of threads including the calling one (0 means all hardware threads)
+			 */
+			static ThreadPool &shared(size_t threads);
+
+			/**
+			 * Returns the number of threads which 0 means
+			 */
+			static size_t hardwareThreads();
+
+		private:
+			struct Batch {
+				const std::function<void(size_t)> *task;
+				std::atomic<size_t> remaining;
+				std::exception_ptr error;
+				std::mutex errorMutex;
+			};
+
+			struct Job {
+				Batch *batch;
+				size_t index;
+			};
+
+			/**
+			 * Jobs are taken from [head, jobs.size()), the vector is cleared when it's empty,
+			 * so it keeps its capacity and the steady state doesn't allocate
+			 */
+			struct Queue {
+				std::mutex mutex;
+				std::vector<Job> jobs;
+				size_t head = 0;
+			};
+
+			void work(size_t queue);
+			bool take(size_t queue, Job &job);
+			static void release(Queue &queue);
+			void execute(const Job &job);
+
+			std::vector<std::unique_ptr<Queue>> _queues;
+			std::vector<std::thread> _workers;
+			std::atomic<size_t> _pending{0};
+			std::mutex _mutex;
+			std::condition_variable _wake;
+			std::condition_variable _done;
+			bool _stop = false;
+		};
+	}
+}
+
+#include "image_thread_pool.cpp"
+#endif //IMAGETHREADPOOL_H
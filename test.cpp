@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
 #include "image_filter.h"
+#include "image_gradient.h"
 
 using namespace metric;
 using namespace metric::image_processing_details;
@@ -61,6 +69,26 @@ void vecprint(const std::string &name, const blaze::DynamicVector<T, P> &vec) {
 }
 
 
+// Counts the allocations to check that the steady state doesn't allocate
+std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+	++allocations;
+	if (void *ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
 bool eq(double a, double b) {
 	return fabs(a - b) < 0.001;
 }
@@ -225,7 +253,7 @@ int main() {
 	assert(eq(unsharpKernel(1, 1), 3.35294));
 	assert(eq(unsharpKernel(2, 1), -0.176471));
 
-	auto unsharpFilterResult = filter(Image<uint8_t,1>{ch1}, unsharpFilter, bothConstModel, true);
+	auto unsharpFilterResult = filter(Image<uint8_t,1>{ch1}, unsharpFilter, bothConstModel, FilterShape::FULL);
 	imgprint("unsharpFilterResult_full", unsharpFilterResult);
 
 	assert(blaze::size(unsharpFilterResult[0]) == 25);
@@ -233,7 +261,7 @@ int main() {
 	assert(unsharpFilterResult[0](2, 2) == 5);
 	assert(unsharpFilterResult[0](2, 3) == 13);
 
-	unsharpFilterResult = filter(ch1, unsharpFilter, bothConstModel, false);
+	unsharpFilterResult = filter(ch1, unsharpFilter, bothConstModel, FilterShape::SAME);
 	imgprint("unsharpFilterResult_same", unsharpFilterResult);
 
 	assert(blaze::size(unsharpFilterResult[0]) == 9);
@@ -241,6 +269,1445 @@ int main() {
 	assert(unsharpFilterResult[0](1, 1) == 5);
 	assert(unsharpFilterResult[0](1, 2) == 13);
 
+	// TEST separable kernels
+	auto sobelParts = separate(sobelKernel, 1e-6);
+	assert(sobelParts.rank() == 1);
+	assert(eq(sobelParts.columns[0][0] * sobelParts.rows[0][1], 2));
+	assert(eq(sobelParts.columns[0][2] * sobelParts.rows[0][0], -1));
+
+	auto logParts = separate(FilterType::LOG(5, 5, 1.0)(), 1e-6);
+	assert(logParts.rank() == 3);
+	assert(separate(FilterType::LOG(5, 5, 1.0)(), 0.01).rank() == 2);
+	assert(separate(FilterType::LOG(5, 5, 1.0)(), 0.5).rank() == 1);
+	assert(separate(unsharpKernel, 1e-6).rank() == 2);
+
+	Channel<double> ramp(16, 20);
+	for (size_t i = 0; i < ramp.rows(); ++i) {
+		for (size_t j = 0; j < ramp.columns(); ++j) {
+			ramp(i, j) = (i * 7 + j * 13) % 256;
+		}
+	}
+
+	ConvolutionSettings directSettings;
+	directSettings.engine = ConvolutionEngine::DIRECT;
+	ConvolutionSettings separableSettings;
+	separableSettings.engine = ConvolutionEngine::SEPARABLE;
+
+	FilterKernel gaussian5 = FilterType::GAUSSIAN(5, 5, 1.5)();
+	auto directMat = imgcov2(ramp, gaussian5, directSettings);
+	auto separableMat = imgcov2(ramp, gaussian5, separableSettings);
+	assert(directMat.rows() == separableMat.rows() && directMat.columns() == separableMat.columns());
+	for (size_t i = 0; i < directMat.rows(); ++i) {
+		for (size_t j = 0; j < directMat.columns(); ++j) {
+			assert(std::abs(directMat(i, j) - separableMat(i, j)) <= 1);
+		}
+	}
+
+	// TEST box filter
+	assert(isBox(avgKernel));
+	assert(!isBox(gaussian5));
+
+	ConvolutionSettings boxSettings;
+	boxSettings.engine = ConvolutionEngine::BOX;
+	FilterType::AVERAGE wideAverage(7, 5);
+	for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+		PadModel<double> model(PadDirection::BOTH, padType, 3);
+		auto boxResult = filter(ramp, wideAverage, model, FilterShape::SAME, boxSettings);
+		auto directResult = filter(ramp, wideAverage, model, FilterShape::SAME, directSettings);
+		assert(boxResult.rows() == ramp.rows() && boxResult.columns() == ramp.columns());
+		for (size_t i = 0; i < boxResult.rows(); ++i) {
+			for (size_t j = 0; j < boxResult.columns(); ++j) {
+				assert(std::abs(boxResult(i, j) - directResult(i, j)) <= 1);
+			}
+		}
+	}
+
+	// TEST FFT engine
+	assert(FFT::goodSize(1000) == 1000);
+	assert(FFT::goodSize(1031) == 1080);
+
+	ConvolutionSettings fftSettings;
+	fftSettings.engine = ConvolutionEngine::FFT;
+	for (auto kernel : {gaussian5, FilterType::MOTION(9, 30)(), FilterType::LOG(7, 3, 1.0)()}) {
+		auto fftMat = imgcov2(ramp, kernel, fftSettings);
+		auto directFftMat = imgcov2(ramp, kernel, directSettings);
+		for (size_t i = 0; i < fftMat.rows(); ++i) {
+			for (size_t j = 0; j < fftMat.columns(); ++j) {
+				assert(std::abs(fftMat(i, j) - directFftMat(i, j)) <= 1);
+			}
+		}
+	}
+
+	// TEST SIMD kernels
+	auto sobelTaps = kernelTaps(sobelKernel);
+	assert(sobelTaps.size() == 6);
+	std::vector<const double *> rampRows{ramp.data(0), ramp.data(1), ramp.data(2)};
+	for (auto level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+		std::vector<double> rowOut(ramp.columns() - 2);
+		correlateRow(rampRows.data(), sobelTaps, rowOut.data(), rowOut.size(), level);
+		for (size_t j = 0; j < rowOut.size(); ++j) {
+			double expected = 0;
+			for (size_t a = 0; a < 3; ++a) {
+				for (size_t b = 0; b < 3; ++b) {
+					expected += sobelKernel(a, b) * ramp(a, j + b);
+				}
+			}
+
+			assert(eq(rowOut[j], expected));
+		}
+	}
+
+	// TEST fixed-point engine
+	auto fixedUnsharp = quantize<uint8_t>(unsharpKernel);
+	assert(fixedUnsharp.taps.size() == 9);
+	assert(fixedUnsharp.maxError < 0.5);
+	assert(quantize<uint16_t>(gaussian5).maxError < 0.5);
+
+	Channel<uint8_t> ramp8 = ramp;
+	for (auto kernel : {unsharpKernel, gaussian5, sobelKernel}) {
+		auto fixedMat = imgcov2Fixed(ramp8, kernel);
+		auto referenceMat = imgcov2(ramp, kernel, directSettings);
+		for (size_t i = 0; i < fixedMat.rows(); ++i) {
+			for (size_t j = 0; j < fixedMat.columns(); ++j) {
+				assert(std::abs(fixedMat(i, j) - std::min(referenceMat(i, j), 255.0)) <= 1);
+			}
+		}
+
+		Channel<uint16_t> ramp16 = ramp * 200;
+		auto fixedMat16 = imgcov2Fixed(ramp16, kernel);
+		auto referenceMat16 = imgcov2(ramp * 200, kernel, directSettings);
+		for (size_t i = 0; i < fixedMat16.rows(); ++i) {
+			for (size_t j = 0; j < fixedMat16.columns(); ++j) {
+				assert(std::abs(fixedMat16(i, j) - std::min(referenceMat16(i, j), 65535.0)) <= 1);
+			}
+		}
+	}
+
+	auto fixedGaussian = quantize<uint8_t>(gaussian5);
+	std::vector<const uint8_t *> ramp8Rows;
+	for (size_t a = 0; a < 5; ++a) {
+		ramp8Rows.push_back(ramp8.data(a));
+	}
+
+	std::vector<uint8_t> scalarRow(ramp8.columns() - 4);
+	std::vector<uint8_t> simdRow(ramp8.columns() - 4);
+	correlateRowFixed(ramp8Rows.data(), fixedGaussian.taps, fixedGaussian.shift, scalarRow.data(), scalarRow.size(),
+					  SimdLevel::SCALAR);
+	correlateRowFixed(ramp8Rows.data(), fixedGaussian.taps, fixedGaussian.shift, simdRow.data(), simdRow.size());
+	assert(scalarRow == simdRow);
+
+	// The other engines saturate the results of 8-bit channels as the fixed-point one
+	{
+		Channel<uint8_t> noise(40, 50);
+		uint32_t state = 97531;
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				state = state * 1664525 + 1013904223;
+				noise(i, j) = state >> 24;
+			}
+		}
+
+		ConvolutionSettings fixedSettings = directSettings;
+		ConvolutionSettings doubleSettings = directSettings;
+		doubleSettings.fixedPoint = false;
+		ConvolutionSettings fftSettings;
+		fftSettings.engine = ConvolutionEngine::FFT;
+		PadModel<uint8_t> replicate(PadDirection::BOTH, PadType::REPLICATE);
+		auto close = [](const Channel<uint8_t> &a, const Channel<uint8_t> &b) {
+			for (size_t i = 0; i < a.rows(); ++i) {
+				for (size_t j = 0; j < a.columns(); ++j) {
+					if (std::abs(a(i, j) - b(i, j)) > 1) {
+						return false;
+					}
+				}
+			}
+
+			return true;
+		};
+
+		auto laplacian = filter(noise, FilterType::LAPLACIAN(0.2), replicate, FilterShape::SAME, fixedSettings);
+		assert(close(laplacian, filter(noise, FilterType::LAPLACIAN(0.2), replicate, FilterShape::SAME,
+									   doubleSettings)));
+		assert(close(laplacian, filter(noise, FilterType::LAPLACIAN(0.2), replicate, FilterShape::SAME,
+									   fftSettings)));
+		auto unsharp = filter(noise, FilterType::UNSHARP(0.2), replicate, FilterShape::SAME, fixedSettings);
+		assert(close(unsharp, filter(noise, FilterType::UNSHARP(0.2), replicate, FilterShape::SAME, doubleSettings)));
+		auto sobel = filter(noise, FilterType::SOBEL(), replicate, FilterShape::SAME, directSettings);
+		assert(close(sobel, filter(noise, FilterType::SOBEL(), replicate, FilterShape::SAME, fftSettings)));
+		assert(std::count(laplacian.data(), laplacian.data() + laplacian.columns(), 255) > 0);
+	}
+
+	// TEST virtual padding
+	ConvolutionSettings paddedSettings = directSettings;
+	paddedSettings.virtualPadding = false;
+	FilterType::LOG log45(4, 5, 0.8);
+	for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+		for (auto padDir : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+			PadModel<double> model(padDir, padType, 7);
+			PadModel<uint8_t> model8(padDir, padType, 7);
+			for (auto full : {FilterShape::FULL, FilterShape::SAME, FilterShape::VALID}) {
+				assert(filter(ramp, log45, model, full, directSettings)
+					   == filter(ramp, log45, model, full, paddedSettings));
+				assert(filter(ramp, sobelFilter, model, full, directSettings)
+					   == filter(ramp, sobelFilter, model, full, paddedSettings));
+				assert(filter(ramp8, unsharpFilter, model8, full, directSettings)
+					   == filter(ramp8, unsharpFilter, model8, full, paddedSettings));
+				assert(filter(ch1, log45, model8, full, directSettings)
+					   == filter(ch1, log45, model8, full, paddedSettings));
+			}
+		}
+	}
+
+	// TEST thread pool and tiles
+	ThreadPool pool(4);
+	assert(pool.size() == 4);
+	std::vector<int> visited(100, 0);
+	pool.run(visited.size(), [&visited](size_t i) { visited[i] += 1; });
+	assert(std::count(visited.begin(), visited.end(), 1) == 100);
+
+	bool thrown = false;
+	try {
+		pool.run(10, [](size_t i) {
+			if (i == 7) {
+				throw std::runtime_error("task");
+			}
+		});
+	} catch (const std::runtime_error &) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	ConvolutionSettings tiledSettings;
+	tiledSettings.threads = 4;
+	tiledSettings.tileRows = 3;
+	tiledSettings.tileColumns = 5;
+	ConvolutionSettings serialSettings;
+	serialSettings.threads = 1;
+	for (auto engine : {ConvolutionEngine::DIRECT, ConvolutionEngine::SEPARABLE, ConvolutionEngine::BOX}) {
+		tiledSettings.engine = serialSettings.engine = engine;
+		PadModel<double> model(PadDirection::BOTH, PadType::SYMMETRIC);
+		PadModel<uint8_t> model8(PadDirection::BOTH, PadType::REPLICATE);
+		assert(filter(ramp, wideAverage, model, FilterShape::FULL, tiledSettings)
+			   == filter(ramp, wideAverage, model, FilterShape::FULL, serialSettings));
+		assert(filter(ramp, log45, model, FilterShape::FULL, tiledSettings)
+			   == filter(ramp, log45, model, FilterShape::FULL, serialSettings));
+		assert(filter(ramp8, unsharpFilter, model8, FilterShape::FULL, tiledSettings)
+			   == filter(ramp8, unsharpFilter, model8, FilterShape::FULL, serialSettings));
+	}
+
+	// TEST fused channels
+	Channel<uint8_t> halfRamp8 = ramp / 2;
+	Image<uint8_t, 3> rgb{ramp8, Channel<uint8_t>(ramp8.rows(), ramp8.columns(), 200), halfRamp8};
+	ConvolutionSettings unfusedSettings = tiledSettings;
+	unfusedSettings.fuseChannels = false;
+	for (auto engine : {ConvolutionEngine::AUTO, ConvolutionEngine::DIRECT, ConvolutionEngine::FFT}) {
+		tiledSettings.engine = unfusedSettings.engine = engine;
+		PadModel<uint8_t> model8(PadDirection::BOTH, PadType::SYMMETRIC, 5);
+		auto fused = filter(rgb, log45, model8, FilterShape::FULL, tiledSettings);
+		auto unfused = filter(rgb, log45, model8, FilterShape::FULL, unfusedSettings);
+		for (size_t ch = 0; ch < rgb.size(); ++ch) {
+			assert(fused[ch] == filter(rgb[ch], log45, model8, FilterShape::FULL, serialSettings));
+			assert(fused[ch] == unfused[ch]);
+		}
+	}
+
+	// TEST interleaved images
+	auto interleaved = interleave(rgb);
+	assert(interleaved.rows() == rgb[0].rows() && interleaved.columns() == rgb[0].columns());
+	assert(interleaved(2, 3, 2) == rgb[2](2, 3));
+	assert(deinterleave(interleaved) == rgb);
+	for (auto engine : {ConvolutionEngine::AUTO, ConvolutionEngine::DIRECT, ConvolutionEngine::SEPARABLE,
+						ConvolutionEngine::BOX, ConvolutionEngine::FFT}) {
+		for (bool virtualPadding : {true, false}) {
+			tiledSettings.engine = serialSettings.engine = engine;
+			tiledSettings.virtualPadding = serialSettings.virtualPadding = virtualPadding;
+			for (auto padType : {PadType::CONST, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+				PadModel<uint8_t> model8(PadDirection::PRE, padType, 3);
+				assert(deinterleave(filter(interleaved, log45, model8, FilterShape::FULL, tiledSettings))
+					   == filter(rgb, log45, model8, FilterShape::FULL, serialSettings));
+				assert(deinterleave(filter(interleaved, wideAverage, model8, FilterShape::FULL, tiledSettings))
+					   == filter(rgb, wideAverage, model8, FilterShape::FULL, serialSettings));
+			}
+
+			PadModel<double> model(PadDirection::BOTH, PadType::REPLICATE);
+			Image<double, 2> planar{ramp, ramp * 0.5};
+			FilterType::GAUSSIAN gaussian5Filter(5, 5, 1.5);
+			// The lanes of the SIMD kernels differ, so rounding of ties may differ too
+			auto interleavedResult = deinterleave(filter(interleave(planar), gaussian5Filter, model, FilterShape::SAME,
+															 tiledSettings));
+			auto planarResult = filter(planar, gaussian5Filter, model, FilterShape::SAME, serialSettings);
+			for (size_t ch = 0; ch < planar.size(); ++ch) {
+				for (size_t i = 0; i < planarResult[ch].rows(); ++i) {
+					for (size_t j = 0; j < planarResult[ch].columns(); ++j) {
+						assert(std::abs(interleavedResult[ch](i, j) - planarResult[ch](i, j)) <= 1);
+					}
+				}
+			}
+		}
+	}
+
+	tiledSettings.virtualPadding = serialSettings.virtualPadding = true;
+
+	// TEST views of external buffers
+	size_t viewRows = rgb[0].rows();
+	size_t viewCols = rgb[0].columns();
+	std::vector<uint8_t> planarBuffer(viewRows * viewCols * 3);
+	std::vector<uint8_t> interleavedBuffer(viewRows * (viewCols * 3 + 4));
+	auto planarView = ImageView<uint8_t>::planar(planarBuffer.data(), viewRows, viewCols, 3);
+	// Rows of the interleaved buffer have 4 extra elements
+	ImageView<uint8_t> interleavedView(interleavedBuffer.data(), viewRows, viewCols, 3, viewCols * 3 + 4, 1, 3);
+	assert(interleavedView.interleaved() && !planarView.interleaved());
+	for (size_t ch = 0; ch < 3; ++ch) {
+		for (size_t i = 0; i < viewRows; ++i) {
+			for (size_t j = 0; j < viewCols; ++j) {
+				planarView(i, j, ch) = interleavedView(i, j, ch) = rgb[ch](i, j);
+			}
+		}
+	}
+
+	imfilter<uint8_t, 3, FilterType::LOG, PadDirection::BOTH, PadType::REPLICATE> viewFilter(4, 5, 0.8);
+	auto expectedFull = viewFilter(rgb);
+	auto expected = filter(rgb, log45, PadModel<uint8_t>(PadDirection::BOTH, PadType::REPLICATE), FilterShape::SAME);
+	for (auto inputView : {planarView, interleavedView}) {
+		std::vector<uint8_t> outPlanar(planarBuffer.size(), 1);
+		std::vector<uint8_t> outInterleaved(interleavedBuffer.size(), 1);
+		std::vector<uint8_t> outFull(expectedFull[0].rows() * expectedFull[0].columns() * 3, 1);
+		auto outPlanarView = ImageView<uint8_t>::planar(outPlanar.data(), viewRows, viewCols, 3);
+		ImageView<uint8_t> outInterleavedView(outInterleaved.data(), viewRows, viewCols, 3, viewCols * 3 + 4, 1, 3);
+		auto outFullView = ImageView<uint8_t>::interleaved(outFull.data(), expectedFull[0].rows(),
+														   expectedFull[0].columns(), 3);
+		viewFilter(inputView, outPlanarView);
+		viewFilter(inputView, outInterleavedView);
+		viewFilter(inputView, outFullView);
+		for (size_t ch = 0; ch < 3; ++ch) {
+			for (size_t i = 0; i < viewRows; ++i) {
+				for (size_t j = 0; j < viewCols; ++j) {
+					assert(outPlanarView(i, j, ch) == expected[ch](i, j));
+					assert(outInterleavedView(i, j, ch) == expected[ch](i, j));
+				}
+			}
+
+			for (size_t i = 0; i < expectedFull[ch].rows(); ++i) {
+				for (size_t j = 0; j < expectedFull[ch].columns(); ++j) {
+					assert(outFullView(i, j, ch) == expectedFull[ch](i, j));
+				}
+			}
+		}
+	}
+
+	thrown = false;
+	try {
+		std::vector<uint8_t> small(9);
+		viewFilter(planarView, ImageView<uint8_t>::planar(small.data(), 1, 3, 3));
+	} catch (const std::invalid_argument &) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	// TEST filter chains
+	FilterType::GAUSSIAN chainGaussian(5, 5, 1.0);
+	FilterType::CHAIN gaussianSobel(chainGaussian, FilterType::SOBEL());
+	assert(gaussianSobel.stages().size() == 2);
+	assert(gaussianSobel().rows() == 7 && gaussianSobel().columns() == 7);
+	assert(gaussianSobel() == mergeKernels(chainGaussian(), FilterType::SOBEL()()));
+	FilterType::CHAIN threeStages(gaussianSobel, FilterType::LOG(3, 5, 0.8));
+	assert(threeStages.stages().size() == 3);
+
+	{
+		// Reference: the padded channel correlated by the stages one after another without rounding
+		PadModel<double> model(PadDirection::BOTH, PadType::SYMMETRIC);
+		size_t padRows = threeStages().rows() - 1;
+		size_t padCols = threeStages().columns() - 1;
+		blaze::DynamicMatrix<double> stageMat = model.pad(Shape{padRows, padCols}, ramp).first;
+		for (const auto &stage : threeStages.stages()) {
+			blaze::DynamicMatrix<double> next(stageMat.rows() - stage.rows() + 1, stageMat.columns() - stage.columns() + 1, 0.0);
+			for (size_t i = 0; i < next.rows(); ++i) {
+				for (size_t j = 0; j < next.columns(); ++j) {
+					for (size_t a = 0; a < stage.rows(); ++a) {
+						for (size_t b = 0; b < stage.columns(); ++b) {
+							next(i, j) += stage(a, b) * stageMat(i + a, j + b);
+						}
+					}
+				}
+			}
+
+			stageMat = next;
+		}
+
+		ConvolutionSettings fusedChainSettings = tiledSettings;
+		fusedChainSettings.chain = ChainMode::FUSED;
+		auto chainResult = filter(ramp, threeStages, model, FilterShape::FULL, fusedChainSettings);
+		assert(chainResult.rows() >= stageMat.rows() && chainResult.columns() >= stageMat.columns());
+		for (size_t i = 0; i < stageMat.rows(); ++i) {
+			for (size_t j = 0; j < stageMat.columns(); ++j) {
+				double expected = std::round(stageMat(i, j));
+				assert(std::abs(chainResult(i, j) - (expected > 0 ? expected : 0)) <= 1e-6);
+			}
+		}
+	}
+
+	for (auto padDirection : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+		for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::CIRCULAR}) {
+			PadModel<uint8_t> model8(padDirection, padType, 7);
+			ConvolutionSettings mergedChainSettings = tiledSettings;
+			ConvolutionSettings fusedChainSettings = tiledSettings;
+			mergedChainSettings.chain = ChainMode::MERGED;
+			fusedChainSettings.chain = ChainMode::FUSED;
+			for (const auto &chain : {gaussianSobel, threeStages}) {
+				// The merged kernel sums in another order, so rounding of ties may differ
+				auto merged = filter(rgb, chain, model8, FilterShape::FULL, mergedChainSettings);
+				auto fused = filter(rgb, chain, model8, FilterShape::FULL, fusedChainSettings);
+				auto fusedInterleaved = deinterleave(filter(interleave(rgb), chain, model8, FilterShape::FULL, fusedChainSettings));
+				for (size_t ch = 0; ch < rgb.size(); ++ch) {
+					assert(fused[ch] == fusedInterleaved[ch]);
+					for (size_t i = 0; i < merged[ch].rows(); ++i) {
+						for (size_t j = 0; j < merged[ch].columns(); ++j) {
+							assert(std::abs(merged[ch](i, j) - fused[ch](i, j)) <= 1);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	imfilter<uint8_t, 3, FilterType::CHAIN, PadDirection::BOTH, PadType::REPLICATE> chainFilter(
+			chainGaussian, FilterType::SOBEL());
+	assert(chainFilter(rgb)[0] == filter(rgb[0], gaussianSobel, PadModel<uint8_t>(PadDirection::BOTH, PadType::REPLICATE)));
+
+	// TEST streaming by bands
+	{
+		auto interleavedRgb = interleave(rgb);
+		size_t width = interleavedRgb.columns() * 3;
+		std::vector<size_t> reads(interleavedRgb.rows());
+		RowReader<uint8_t> reader = [&](size_t row, size_t count, uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				++reads[i];
+				std::copy(interleavedRgb.data(i), interleavedRgb.data(i) + width, data + (i - row) * width);
+			}
+		};
+
+		for (auto padDirection : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+			for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+				for (auto full : {FilterShape::FULL, FilterShape::SAME, FilterShape::VALID}) {
+					PadModel<uint8_t> model8(padDirection, padType, 9);
+					for (size_t bandRows : {1, 4, 7, 64}) {
+						for (auto engine : {ConvolutionEngine::AUTO, ConvolutionEngine::DIRECT, ConvolutionEngine::FFT}) {
+							tiledSettings.engine = engine;
+							auto expected = filter(interleavedRgb, log45, model8, full, tiledSettings);
+							InterleavedImage<uint8_t, 3> streamed(expected.rows(), expected.columns());
+							size_t nextRow = 0;
+							RowWriter<uint8_t> writer = [&](size_t row, size_t count, const uint8_t *data) {
+								assert(row == nextRow && count <= bandRows);
+								nextRow += count;
+								size_t outWidth = streamed.columns() * 3;
+								for (size_t i = row; i < row + count; ++i) {
+									std::copy(data + (i - row) * outWidth, data + (i - row + 1) * outWidth, streamed.data(i));
+								}
+							};
+
+							std::fill(reads.begin(), reads.end(), 0);
+							filterStream(interleavedRgb.rows(), interleavedRgb.columns(), 3, reader, writer, log45,
+										 model8, bandRows, full, tiledSettings);
+							assert(nextRow == expected.rows());
+							assert(streamed == expected);
+							// Each row is read once if the bands are as high as the halo, CIRCULAR reads
+							// the rows of the padding again
+							if (padType != PadType::CIRCULAR && bandRows >= log45().rows() - 1) {
+								assert(std::all_of(reads.begin(), reads.end(), [](size_t n) { return n == 1; }));
+							}
+						}
+					}
+				}
+			}
+		}
+
+		tiledSettings.engine = ConvolutionEngine::AUTO;
+
+		// A raw file mapped into memory
+		const char *rawPath = "test_stream.raw";
+		FILE *rawFile = std::fopen(rawPath, "wb");
+		std::fwrite("HDR", 1, 3, rawFile);
+		for (size_t i = 0; i < ramp8.rows(); ++i) {
+			std::fwrite(ramp8.data(i), 1, ramp8.columns(), rawFile);
+		}
+		std::fclose(rawFile);
+
+		{
+			MappedRawImage<uint8_t> mapped(rawPath, ramp8.rows(), ramp8.columns(), 3);
+			assert(mapped.data(2)[3] == ramp8(2, 3));
+			imfilter<uint8_t, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::SYMMETRIC> streamFilter(5, 5, 1.0);
+			Channel<uint8_t> streamed(ramp8.rows(), ramp8.columns());
+			streamFilter.stream(mapped.rows(), mapped.columns(), mapped.reader(),
+								[&](size_t row, size_t count, const uint8_t *data) {
+				for (size_t i = 0; i < count; ++i) {
+					std::copy(data + i * streamed.columns(), data + (i + 1) * streamed.columns(), streamed.data(row + i));
+				}
+			}, 5, FilterShape::SAME);
+			assert(streamed == filter(ramp8, FilterType::GAUSSIAN(5, 5, 1.0),
+									  PadModel<uint8_t>(PadDirection::BOTH, PadType::SYMMETRIC), FilterShape::SAME));
+		}
+
+		thrown = false;
+		try {
+			MappedRawImage<uint8_t> tooLarge(rawPath, ramp8.rows() + 1, ramp8.columns(), 3);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+		assert(thrown);
+		std::remove(rawPath);
+	}
+
+	// TEST batches of frames
+	{
+		std::vector<Channel<uint8_t>> frames{ramp8, halfRamp8, rgb[1], ramp8, halfRamp8};
+		std::vector<Image<uint8_t, 3>> imageFrames{rgb, Image<uint8_t, 3>{halfRamp8, ramp8, rgb[1]}, rgb};
+		std::vector<InterleavedImage<uint8_t, 3>> interleavedFrames;
+		for (const auto &frame : imageFrames) {
+			interleavedFrames.push_back(interleave(frame));
+		}
+
+		ConvolutionSettings batchSettings = tiledSettings;
+		PadModel<uint8_t> model8(PadDirection::BOTH, PadType::SYMMETRIC, 2);
+		for (auto engine : {ConvolutionEngine::AUTO, ConvolutionEngine::DIRECT, ConvolutionEngine::FFT}) {
+			for (bool fixedPoint : {true, false}) {
+				batchSettings.engine = serialSettings.engine = engine;
+				batchSettings.fixedPoint = serialSettings.fixedPoint = fixedPoint;
+				std::vector<Channel<uint8_t>> outputs;
+				std::vector<Image<uint8_t, 3>> imageOutputs;
+				std::vector<InterleavedImage<uint8_t, 3>> interleavedOutputs(7);
+				filter(frames, outputs, log45, model8, FilterShape::SAME, batchSettings);
+				filter(imageFrames, imageOutputs, log45, model8, FilterShape::FULL, batchSettings);
+				filter(interleavedFrames, interleavedOutputs, log45, model8, FilterShape::FULL, batchSettings);
+				assert(outputs.size() == frames.size() && interleavedOutputs.size() == interleavedFrames.size());
+				for (size_t k = 0; k < frames.size(); ++k) {
+					assert(outputs[k] == filter(frames[k], log45, model8, FilterShape::SAME, serialSettings));
+				}
+
+				for (size_t k = 0; k < imageFrames.size(); ++k) {
+					auto expected = filter(imageFrames[k], log45, model8, FilterShape::FULL, serialSettings);
+					assert(imageOutputs[k] == expected);
+					assert(deinterleave(interleavedOutputs[k]) == expected);
+				}
+			}
+		}
+
+		serialSettings.engine = ConvolutionEngine::AUTO;
+		serialSettings.fixedPoint = true;
+
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> batchFilter(5, 5, 1.0);
+		std::vector<Image<uint8_t, 3>> imageOutputs;
+		batchFilter(imageFrames, imageOutputs);
+		assert(imageOutputs[1] == batchFilter(imageFrames[1]));
+
+		thrown = false;
+		try {
+			frames.push_back(Channel<uint8_t>(3, 3, 0));
+			std::vector<Channel<uint8_t>> outputs;
+			filter(frames, outputs, log45, model8);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+
+	// TEST static kernels
+	{
+		assert(FilterType::SOBEL()() == FilterKernel({{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}}));
+		assert(FilterType::PREWITT()() == FilterKernel({{1, 1, 1}, {0, 0, 0}, {-1, -1, -1}}));
+		assert(HasStaticKernel<FilterType::SOBEL>::value && !HasStaticKernel<FilterType::GAUSSIAN>::value);
+
+		using Binomial = FilterType::STATIC<5, 5, 256,
+				1, 4, 6, 4, 1,
+				4, 16, 24, 16, 4,
+				6, 24, 36, 24, 6,
+				4, 16, 24, 16, 4,
+				1, 4, 6, 4, 1>;
+		assert(eq(Binomial()()(2, 2), 36.0 / 256));
+
+		// The generic engines: the fixed-point one for uint8_t saturates as the static kernels do
+		ConvolutionSettings genericSettings = tiledSettings;
+		genericSettings.engine = ConvolutionEngine::DIRECT;
+		genericSettings.virtualPadding = false;
+		auto interleavedRgb = interleave(rgb);
+		for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+			PadModel<uint8_t> model8(PadDirection::BOTH, padType, 11);
+			PadModel<double> model(PadDirection::BOTH, padType, 11);
+			assert(filter(rgb, FilterType::SOBEL(), model8, FilterShape::FULL, tiledSettings)
+				   == filter(rgb, FilterType::SOBEL(), model8, FilterShape::FULL, genericSettings));
+			assert(filter(interleavedRgb, FilterType::PREWITT(), model8, FilterShape::SAME, tiledSettings)
+				   == filter(interleavedRgb, FilterType::PREWITT(), model8, FilterShape::SAME, genericSettings));
+			assert(filter(rgb, Binomial(), model8, FilterShape::FULL, tiledSettings)
+				   == filter(rgb, Binomial(), model8, FilterShape::FULL, genericSettings));
+			assert(filter(ramp, FilterType::SOBEL(), model, FilterShape::FULL, tiledSettings)
+				   == filter(ramp, FilterType::SOBEL(), model, FilterShape::FULL, genericSettings));
+		}
+
+		// The bottom edge of a bright image against the CONST padding: 1000 is saturated
+		Channel<uint8_t> bright(8, 8, 250);
+		imfilter<uint8_t, 1, FilterType::SOBEL, PadDirection::BOTH, PadType::CONST> sobelFilter;
+		assert(sobelFilter(bright)(8, 4) == 255 && sobelFilter(bright)(0, 4) == 0);
+	}
+
+	// TEST output buffers and workspaces
+	{
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> gaussFilter(5, 5, 1.0);
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> gaussViewFilter(5, 5, 1.0);
+		imfilter<uint8_t, 1, FilterType::UNSHARP, PadDirection::BOTH, PadType::SYMMETRIC> unsharpImfilter(0.5);
+		imfilter<uint8_t, 3, FilterType::AVERAGE, PadDirection::PRE, PadType::CONST> averageFilter(3, 3);
+		imfilter<double, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::CIRCULAR> fftFilter(7, 7, 2.0);
+		fftFilter.settings().engine = ConvolutionEngine::FFT;
+		fftFilter.settings().virtualPadding = false;
+		imfilter<uint8_t, 3, FilterType::MEDIAN, PadDirection::BOTH, PadType::SYMMETRIC> medianFilter(5, 5);
+		imfilter<uint8_t, 1, FilterType::PERCENTILE, PadDirection::BOTH, PadType::CONST> percentileFilter(3, 7, 20.0);
+
+		InterleavedImage<uint8_t, 3> interleavedRgb = interleave(rgb);
+		Image<uint8_t, 3> rgbOut;
+		Channel<uint8_t> unsharpOut;
+		InterleavedImage<uint8_t, 3> averageOut;
+		Channel<double> fftOut;
+		Image<uint8_t, 3> medianOut;
+		Channel<uint8_t> percentileOut;
+		std::vector<uint8_t> viewOut(rgb[0].rows() * rgb[0].columns() * 3);
+		auto rgbView = ImageView<const uint8_t>::interleaved(interleavedRgb.data(0), rgb[0].rows(), rgb[0].columns(), 3);
+		auto outView = ImageView<uint8_t>::interleaved(viewOut.data(), rgb[0].rows(), rgb[0].columns(), 3);
+
+		auto run = [&] {
+			gaussFilter(rgb, rgbOut);
+			unsharpImfilter(ramp8, unsharpOut);
+			averageFilter(interleavedRgb, averageOut);
+			fftFilter(ramp, fftOut);
+			gaussViewFilter(rgbView, outView);
+			medianFilter(rgb, medianOut);
+			percentileFilter(ramp8, percentileOut);
+		};
+
+		run();
+		assert(rgbOut == gaussFilter(rgb));
+		assert(unsharpOut == unsharpImfilter(ramp8));
+		assert(averageOut == averageFilter(interleavedRgb));
+		assert(fftOut == fftFilter(ramp));
+		assert(medianOut == medianFilter(rgb));
+		assert(percentileOut == percentileFilter(ramp8));
+
+		size_t before = allocations;
+		for (int k = 0; k < 3; ++k) {
+			run();
+		}
+		assert(allocations == before);
+	}
+
+	// TEST kernel cache
+	{
+		LruCache<int, int> small(2);
+		auto make = [](int value) { return [value] { return value * 10; }; };
+		small.get(1, make(1));
+		small.get(2, make(2));
+		assert(*small.get(1, make(1)) == 10);
+		small.get(3, make(3));
+		assert(small.size() == 2 && small.hits() == 1 && small.misses() == 3);
+		small.get(2, make(2));
+		assert(small.misses() == 4);
+		small.setCapacity(1);
+		assert(small.size() == 1 && *small.get(2, make(2)) == 20 && small.hits() == 2);
+
+		KernelCache &kernels = kernelCache();
+		size_t hits = kernels.hits();
+		size_t misses = kernels.misses();
+		FilterType::GAUSSIAN gaussian(9, 9, 1.7);
+		FilterType::GAUSSIAN sameGaussian(9, 9, 1.7);
+		assert(kernels.misses() == misses + 1 && kernels.hits() == hits + 1);
+		assert(gaussian() == sameGaussian());
+
+		// LOG takes the Gaussian kernel from the cache too
+		FilterType::LOG log(9, 9, 1.7);
+		assert(kernels.misses() == misses + 2 && kernels.hits() == hits + 2);
+		assert(eq(blaze::sum(log()), 0.0));
+
+		// The separable parts of a kernel are planned once
+		size_t separableMisses = separableCache().misses();
+		imfilter<double, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> first(9, 9, 1.7);
+		imfilter<double, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> second(9, 9, 1.7);
+		assert(first(ramp) == second(ramp));
+		assert(separableCache().misses() <= separableMisses + 1);
+
+		std::vector<std::thread> threads;
+		std::vector<FilterKernel> motions(4);
+		for (size_t k = 0; k < motions.size(); ++k) {
+			threads.emplace_back([&motions, k] {
+				for (int i = 0; i < 20; ++i) {
+					motions[k] = FilterType::MOTION(7 + i % 3, 30)();
+				}
+			});
+		}
+
+		for (auto &thread : threads) {
+			thread.join();
+		}
+
+		for (auto &motion : motions) {
+			assert(motion == FilterType::MOTION(8, 30)());
+		}
+	}
+
+	// TEST profile of the stages
+	{
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> gaussFilter(5, 5, 1.0);
+		imfilter<double, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::CIRCULAR> fftFilter(7, 7, 2.0);
+		fftFilter.settings().engine = ConvolutionEngine::FFT;
+		fftFilter.settings().virtualPadding = false;
+
+		size_t globalCalls = FilterProfile::global().calls();
+		gaussFilter(rgb);
+		auto gaussOut = gaussFilter(rgb);
+		auto fftOut = fftFilter(ramp);
+
+		auto &profile = gaussFilter.profile();
+		if constexpr (profiling) {
+			// The small channels are padded, correlated and cropped one by one
+			size_t pixels = 3 * gaussOut[0].rows() * gaussOut[0].columns();
+			assert(profile.calls() == 2 && FilterProfile::global().calls() == globalCalls + 3);
+			assert(profile.total(FilterStage::KERNEL).runs == 1 && profile.last(FilterStage::KERNEL).runs == 0);
+			assert(profile.last(FilterStage::PAD).runs == 3 && profile.last(FilterStage::CORRELATE).runs == 3);
+			assert(profile.last(FilterStage::CROP).pixels == pixels);
+			assert(profile.total(FilterStage::CROP).pixels == 2 * pixels);
+			assert(profile.text().find("correlate") != std::string::npos);
+
+			auto &fftProfile = fftFilter.profile();
+			assert(fftProfile.last(FilterStage::PAD).runs == 1 && fftProfile.last(FilterStage::CROP).runs == 1);
+			assert(fftProfile.last(FilterStage::CROP).pixels == fftOut.rows() * fftOut.columns());
+			assert(fftProfile.json().find("\"correlate\": {\"runs\": 1") != std::string::npos);
+		} else {
+			assert(profile.calls() == 0 && FilterProfile::global().calls() == globalCalls);
+			assert(profile.total(FilterStage::CORRELATE).runs == 0);
+		}
+	}
+
+	// TEST recursive gaussian
+	{
+		// A step and a peak, against the exact kernel by the FFT engine
+		Channel<double> scene(60, 70, 10.0);
+		for (size_t i = 0; i < scene.rows(); ++i) {
+			for (size_t j = 35; j < scene.columns(); ++j) {
+				scene(i, j) = 200;
+			}
+		}
+
+		scene(20, 20) = 255;
+		ConvolutionSettings exactSettings;
+		exactSettings.engine = ConvolutionEngine::FFT;
+		exactSettings.virtualPadding = false;
+		for (double sigma : {3.0, 8.0}) {
+			FilterType::RECURSIVE_GAUSSIAN gaussian(sigma);
+			assert(gaussian().rows() == 2 * std::ceil(3 * sigma) + 1);
+			for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC}) {
+				for (auto padDirection : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+					PadModel<double> model(padDirection, padType, 0);
+					auto exact = filter(scene, gaussian, model, FilterShape::FULL, exactSettings);
+					auto recursive = filter(scene, gaussian, model);
+					assert(recursive.rows() == exact.rows() && recursive.columns() == exact.columns());
+					assert(blaze::max(blaze::abs(recursive - exact)) <= 0.01 * 255);
+				}
+			}
+		}
+
+		// Interleaved channels are filtered separately
+		InterleavedImage<uint8_t, 3> frame(40, 50);
+		for (size_t i = 0; i < frame.rows(); ++i) {
+			for (size_t j = 0; j < frame.columns(); ++j) {
+				for (size_t ch = 0; ch < 3; ++ch) {
+					frame(i, j, ch) = static_cast<uint8_t>(j < 25 ? 40 * ch : 250 - 40 * ch);
+				}
+			}
+		}
+
+		imfilter<uint8_t, 3, FilterType::RECURSIVE_GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> recursiveFilter(4.0);
+		imfilter<uint8_t, 3, FilterType::RECURSIVE_GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> exactFilter(4.0);
+		exactFilter.settings().engine = ConvolutionEngine::DIRECT;
+		auto recursiveFrame = recursiveFilter(frame);
+		auto exactFrame = exactFilter(frame);
+		for (size_t i = 0; i < exactFrame.rows(); ++i) {
+			for (size_t j = 0; j < exactFrame.columns() * 3; ++j) {
+				assert(std::abs(recursiveFrame.matrix()(i, j) - exactFrame.matrix()(i, j)) <= 3);
+			}
+		}
+
+		bool thrown = false;
+		try {
+			FilterType::RECURSIVE_GAUSSIAN tooSmall(0.2);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+
+		assert(thrown);
+	}
+
+	// TEST fused gradient
+	{
+		// Against the two kernels applied pixel by pixel, with the borders of each pad type
+		auto clampIndex = [](long i, long n) { return std::min(n - 1, std::max<long>(0, i)); };
+		for (auto padType : {PadType::REPLICATE, PadType::CONST, PadType::CIRCULAR, PadType::SYMMETRIC}) {
+			imgradient<uint8_t, int16_t, FilterType::SOBEL> sobel(padType, 7, true);
+			sobel.settings().tileRows = 5;
+			auto grad = sobel(ramp8);
+			assert(grad.x.rows() == ramp8.rows() && grad.x.columns() == ramp8.columns());
+			assert(grad.orientation.rows() == ramp8.rows());
+
+			PadModel<uint8_t> padmodel(PadDirection::BOTH, padType, 7);
+			auto rowMap = padmodel.indexMap(1, ramp8.rows());
+			auto colMap = padmodel.indexMap(1, ramp8.columns());
+			auto pixel = [&](size_t a, size_t b) {
+				return rowMap[a] < 0 || colMap[b] < 0 ? 7 : (int) ramp8(rowMap[a], colMap[b]);
+			};
+
+			const int weights[3] = {1, 2, 1};
+			for (size_t i = 0; i < ramp8.rows(); ++i) {
+				for (size_t j = 0; j < ramp8.columns(); ++j) {
+					int x = 0;
+					int y = 0;
+					for (size_t k = 0; k < 3; ++k) {
+						x += weights[k] * (pixel(i + k, j + 2) - pixel(i + k, j));
+						y += weights[k] * (pixel(i + 2, j + k) - pixel(i, j + k));
+					}
+
+					assert(grad.x(i, j) == x);
+					assert(grad.y(i, j) == y);
+					assert(grad.magnitude(i, j) == std::lround(std::sqrt(x * x + y * y)));
+					assert(grad.orientation(i, j) == std::lround(std::atan2(0 - y, x) * 180 / M_PI));
+				}
+			}
+		}
+
+		// The vertical gradient is the negated response of FilterType::PREWITT
+		imgradient<double, double, FilterType::PREWITT> prewitt;
+		auto grad = prewitt(ramp);
+		assert(grad.orientation.rows() == 0);
+		auto kernel = FilterType::PREWITT()();
+		for (size_t i = 0; i < ramp.rows(); ++i) {
+			for (size_t j = 0; j < ramp.columns(); ++j) {
+				double y = 0;
+				double x = 0;
+				for (size_t a = 0; a < 3; ++a) {
+					for (size_t b = 0; b < 3; ++b) {
+						auto source = ramp(clampIndex(i + a - 1, ramp.rows()), clampIndex(j + b - 1, ramp.columns()));
+						y -= kernel(a, b) * source;
+						x -= kernel(b, 2 - a) * source;
+					}
+				}
+
+				assert(eq(grad.y(i, j), y));
+				assert(eq(grad.x(i, j), x));
+				assert(eq(grad.magnitude(i, j), std::sqrt(x * x + y * y)));
+			}
+		}
+
+		// A vertical step: horizontal gradient only, orientation 0 on the rising edge
+		Channel<uint8_t> step(8, 8, 0);
+		for (size_t i = 0; i < step.rows(); ++i) {
+			for (size_t j = 4; j < step.columns(); ++j) {
+				step(i, j) = 100;
+			}
+		}
+
+		imgradient<uint8_t, float> edges(PadType::REPLICATE, 0, true);
+		auto stepGrad = edges(step);
+		assert(stepGrad.x(3, 3) == 400 && stepGrad.x(3, 4) == 400 && stepGrad.x(3, 5) == 0);
+		assert(stepGrad.y(3, 3) == 0 && stepGrad.orientation(3, 3) == 0);
+	}
+
+	// TEST output shapes
+	{
+		// SAME is centred on (size - 1) / 2 of the kernel for BOTH and ends (starts) at the pixel for PRE (POST),
+		// VALID reads the pixels whose neighborhood is inside the image only
+		auto clampIndex = [](long i, long n) { return std::min(n - 1, std::max<long>(0, i)); };
+		auto check = [&](const auto &impl) {
+			auto kernel = impl();
+			long kr = kernel.rows();
+			long kc = kernel.columns();
+			for (auto padDir : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+				long before[2] = {padDir == PadDirection::BOTH ? (kr - 1) / 2 : padDir == PadDirection::PRE ? kr - 1 : 0,
+								  padDir == PadDirection::BOTH ? (kc - 1) / 2 : padDir == PadDirection::PRE ? kc - 1 : 0};
+				PadModel<double> model(padDir, PadType::REPLICATE);
+				for (auto settings : {directSettings, paddedSettings}) {
+					auto same = filter(ramp, impl, model, FilterShape::SAME, settings);
+					auto valid = filter(ramp, impl, model, FilterShape::VALID, settings);
+					assert(same.rows() == ramp.rows() && same.columns() == ramp.columns());
+					assert(valid.rows() == ramp.rows() - kr + 1 && valid.columns() == ramp.columns() - kc + 1);
+					for (long i = 0; i < (long) ramp.rows(); ++i) {
+						for (long j = 0; j < (long) ramp.columns(); ++j) {
+							double sum = 0;
+							double validSum = 0;
+							for (long a = 0; a < kr; ++a) {
+								for (long b = 0; b < kc; ++b) {
+									sum += kernel(a, b) * ramp(clampIndex(i + a - before[0], ramp.rows()),
+															   clampIndex(j + b - before[1], ramp.columns()));
+									if (i < (long) valid.rows() && j < (long) valid.columns()) {
+										validSum += kernel(a, b) * ramp(i + a, j + b);
+									}
+								}
+							}
+
+							assert(std::abs(same(i, j) - std::max(0.0, std::round(sum))) <= 1);
+							if (i < (long) valid.rows() && j < (long) valid.columns()) {
+								assert(std::abs(valid(i, j) - std::max(0.0, std::round(validSum))) <= 1);
+							}
+						}
+					}
+				}
+			}
+		};
+
+		check(log45);
+		check(FilterType::AVERAGE(1, 5));
+		check(FilterType::GAUSSIAN(5, 5, 1.0));
+
+		// The options of imfilter and the shape of a view
+		imfilter<double, 1, FilterType::LOG, PadDirection::BOTH, PadType::SYMMETRIC> validFilter(4, 5, 0.8);
+		validFilter.shape() = FilterShape::VALID;
+		auto validResult = validFilter(ramp);
+		assert(validResult == filter(ramp, log45, PadModel<double>(PadDirection::BOTH, PadType::CONST),
+									 FilterShape::VALID));
+		std::vector<double> validBuffer(validResult.rows() * validResult.columns());
+		auto validView = ImageView<double>::planar(validBuffer.data(), validResult.rows(), validResult.columns(), 1);
+		validFilter(ImageView<const double>::planar(ramp.data(), ramp.rows(), ramp.columns(), 1), validView);
+		for (size_t i = 0; i < validResult.rows(); ++i) {
+			for (size_t j = 0; j < validResult.columns(); ++j) {
+				assert(validView(i, j, 0) == validResult(i, j));
+			}
+		}
+
+		// The convolution is the correlation with the rotated kernel, the static kernels aren't used for it
+		using Uneven = FilterType::STATIC<2, 3, 2,
+				1, 2, 0,
+				0, 1, 3>;
+		using Rotated = FilterType::STATIC<2, 3, 2,
+				3, 1, 0,
+				0, 2, 1>;
+		using SobelRotated = FilterType::STATIC<3, 3, 1,
+				-1, -2, -1,
+				0, 0, 0,
+				1, 2, 1>;
+		PadModel<uint8_t> model8(PadDirection::BOTH, PadType::SYMMETRIC);
+		for (auto settings : {directSettings, paddedSettings}) {
+			auto convolution = settings;
+			convolution.convolution = true;
+			for (auto shape : {FilterShape::FULL, FilterShape::SAME}) {
+				assert(filter(ramp8, Uneven(), model8, shape, convolution)
+					   == filter(ramp8, Rotated(), model8, shape, settings));
+				assert(filter(ramp8, FilterType::SOBEL(), model8, shape, convolution)
+					   == filter(ramp8, SobelRotated(), model8, shape, settings));
+				assert(filter(ramp8, FilterType::GAUSSIAN(5, 5, 1.0), model8, shape, convolution)
+					   == filter(ramp8, FilterType::GAUSSIAN(5, 5, 1.0), model8, shape, settings));
+			}
+		}
+
+		// The workspace rotates its kernel back when the option is off again
+		imfilter<uint8_t, 1, FilterType::SOBEL, PadDirection::BOTH, PadType::SYMMETRIC> sobel;
+		auto correlated = sobel(ramp8);
+		sobel.settings().convolution = true;
+		assert(sobel(ramp8) == filter(ramp8, SobelRotated(), model8));
+		sobel.settings().convolution = false;
+		assert(sobel(ramp8) == correlated);
+	}
+
+	// TEST float accumulator
+	{
+		// The float row kernels agree with the double ones for all instruction sets
+		Channel<float> rampFloat = ramp;
+		auto gaussianTaps = kernelTaps<float>(gaussian5);
+		assert(gaussianTaps.size() == 25);
+		std::vector<const float *> floatRows;
+		std::vector<const double *> doubleRows;
+		for (size_t a = 0; a < 5; ++a) {
+			floatRows.push_back(rampFloat.data(a));
+			doubleRows.push_back(ramp.data(a));
+		}
+
+		std::vector<double> doubleRow(ramp.columns() - 4);
+		correlateRow(doubleRows.data(), kernelTaps(gaussian5), doubleRow.data(), doubleRow.size());
+		for (auto level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+			std::vector<float> floatRow(doubleRow.size());
+			correlateRow(floatRows.data(), gaussianTaps, floatRow.data(), floatRow.size(), level);
+			for (size_t j = 0; j < floatRow.size(); ++j) {
+				assert(std::abs(floatRow[j] - doubleRow[j]) < 1e-3);
+			}
+		}
+
+		// Each engine computes in float
+		for (auto settings : {directSettings, separableSettings, boxSettings, fftSettings}) {
+			for (auto kernel : {gaussian5, avgKernel, FilterType::LOG(7, 3, 1.0)()}) {
+				auto floatMat = imgcov2(rampFloat, kernel, settings);
+				auto doubleMat = imgcov2(ramp, kernel, settings);
+				assert(floatMat.rows() == doubleMat.rows() && floatMat.columns() == doubleMat.columns());
+				for (size_t i = 0; i < floatMat.rows(); ++i) {
+					for (size_t j = 0; j < floatMat.columns(); ++j) {
+						assert(std::abs(floatMat(i, j) - doubleMat(i, j)) <= 1);
+					}
+				}
+			}
+		}
+
+		// The sums of the filters differ from double by the rounding of the ties only
+		PadModel<uint8_t> model8(PadDirection::BOTH, PadType::REPLICATE);
+		PadModel<float> modelFloat(PadDirection::BOTH, PadType::REPLICATE);
+		for (auto settings : {directSettings, paddedSettings, separableSettings}) {
+			settings.fixedPoint = false;
+			FilterWorkspace<uint8_t, float> workspace8;
+			FilterWorkspace<float, float> workspaceFloat;
+			for (auto shape : {FilterShape::FULL, FilterShape::SAME}) {
+				auto float8 = filter(ramp8, log45, model8, shape, settings, &workspace8);
+				auto double8 = filter(ramp8, log45, model8, shape, settings);
+				auto floatFloat = filter(rampFloat, log45, modelFloat, shape, settings, &workspaceFloat);
+				assert(float8.rows() == double8.rows() && floatFloat.rows() == double8.rows());
+				for (size_t i = 0; i < float8.rows(); ++i) {
+					for (size_t j = 0; j < float8.columns(); ++j) {
+						assert(std::abs(float8(i, j) - double8(i, j)) <= 1);
+						assert(std::abs(floatFloat(i, j) - double8(i, j)) <= 1);
+					}
+				}
+			}
+		}
+
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE, float> floatGaussian(5, 5, 1.0);
+		imfilter<uint8_t, 3, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE> doubleGaussian(5, 5, 1.0);
+		floatGaussian.settings().fixedPoint = false;
+		doubleGaussian.settings().fixedPoint = false;
+		auto floatRgb = floatGaussian(rgb);
+		auto doubleRgb = doubleGaussian(rgb);
+		for (size_t c = 0; c < 3; ++c) {
+			for (size_t i = 0; i < floatRgb[c].rows(); ++i) {
+				for (size_t j = 0; j < floatRgb[c].columns(); ++j) {
+					assert(std::abs(floatRgb[c](i, j) - doubleRgb[c](i, j)) <= 1);
+				}
+			}
+		}
+
+		// The bands of a stream are computed in float too
+		Channel<uint8_t> streamed(floatRgb[0].rows(), floatRgb[0].columns());
+		imfilter<uint8_t, 1, FilterType::GAUSSIAN, PadDirection::BOTH, PadType::REPLICATE, float> floatStream(5, 5, 1.0);
+		floatStream.settings().fixedPoint = false;
+		size_t columns = rgb[0].columns();
+		floatStream.stream(rgb[0].rows(), columns, [&](size_t row, size_t count, uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(rgb[0].data(i), rgb[0].data(i) + columns, data + (i - row) * columns);
+			}
+		}, [&](size_t row, size_t count, const uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(data + (i - row) * streamed.columns(), data + (i - row + 1) * streamed.columns(),
+						  streamed.data(i));
+			}
+		}, 3);
+		assert(streamed == floatRgb[0]);
+	}
+
+	// TEST rank filters
+	{
+		assert(FilterType::MEDIAN(3, 3).rank() == 4);
+		assert(FilterType::MEDIAN(4, 4).rank() == 7);
+		assert(FilterType::PERCENTILE(3, 5, 0).rank() == 0);
+		assert(FilterType::PERCENTILE(3, 5, 100).rank() == 14);
+		assert(FilterType::PERCENTILE(3, 5, 50).rank() == 7);
+		thrown = false;
+		try {
+			FilterType::RANK(3, 3, 9);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		Channel<uint8_t> noise(23, 37);
+		uint32_t state = 12345;
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				state = state * 1664525 + 1013904223;
+				noise(i, j) = state >> 24;
+			}
+		}
+
+		// The element of the rank in the windows of the padded channel, the rest of the full result is 0
+		auto reference = [](const Channel<uint8_t> &padded, size_t kr, size_t kc, size_t rank,
+							size_t rows, size_t cols) {
+			Channel<uint8_t> expected(rows, cols, 0);
+			std::vector<uint8_t> window;
+			for (size_t i = 0; i + kr <= std::min(padded.rows(), rows + kr - 1); ++i) {
+				for (size_t j = 0; j + kc <= std::min(padded.columns(), cols + kc - 1); ++j) {
+					window.clear();
+					for (size_t a = 0; a < kr; ++a) {
+						for (size_t b = 0; b < kc; ++b) {
+							window.push_back(padded(i + a, j + b));
+						}
+					}
+
+					std::nth_element(window.begin(), window.begin() + rank, window.end());
+					expected(i, j) = window[rank];
+				}
+			}
+
+			return expected;
+		};
+
+		for (auto window : {std::make_pair(3, 3), std::make_pair(5, 7), std::make_pair(1, 9), std::make_pair(19, 17)}) {
+			size_t kr = window.first;
+			size_t kc = window.second;
+			for (size_t rank : {size_t(0), (kr * kc - 1) / 2, kr * kc / 3, kr * kc - 1}) {
+				FilterType::RANK impl(kr, kc, rank);
+				for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+					for (auto padDir : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+						PadModel<uint8_t> model(padDir, padType, 100);
+						auto padded = model.pad(Shape{kr - 1, kc - 1}, noise).first;
+						auto full = filter(noise, impl, model, FilterShape::FULL, tiledSettings);
+						assert(full == reference(padded, kr, kc, rank, full.rows(), full.columns()));
+
+						// The generic selection gives the same result
+						Channel<double> noiseDouble = noise;
+						PadModel<double> modelDouble(padDir, padType, 100);
+						Channel<uint8_t> fullDouble = filter(noiseDouble, impl, modelDouble);
+						assert(fullDouble == full);
+					}
+				}
+
+				auto valid = filter(noise, impl, PadModel<uint8_t>(PadDirection::BOTH, PadType::CONST),
+									FilterShape::VALID);
+				assert(valid == reference(noise, kr, kc, rank, noise.rows() - kr + 1, noise.columns() - kc + 1));
+			}
+		}
+
+		// Impulses are removed by the median
+		Channel<uint8_t> impulses(16, 16, 100);
+		impulses(3, 4) = 255;
+		impulses(9, 9) = 0;
+		impulses(15, 0) = 255;
+		imfilter<uint8_t, 1, FilterType::MEDIAN, PadDirection::BOTH, PadType::REPLICATE> median(3, 3);
+		median.shape() = FilterShape::SAME;
+		assert(median(impulses) == Channel<uint8_t>(16, 16, 100));
+
+		// Interleaved images slide a window per channel, the streams and the batches use the same engine
+		imfilter<uint8_t, 3, FilterType::PERCENTILE, PadDirection::BOTH, PadType::SYMMETRIC> percentile(5, 3, 75.0);
+		percentile.shape() = FilterShape::SAME;
+		auto planarPercentile = percentile(rgb);
+		assert(deinterleave(percentile(interleaved)) == planarPercentile);
+
+		Channel<uint8_t> streamed(rgb[1].rows(), rgb[1].columns());
+		imfilter<uint8_t, 1, FilterType::PERCENTILE, PadDirection::BOTH, PadType::SYMMETRIC> percentile1(5, 3, 75.0);
+		size_t columns = rgb[1].columns();
+		percentile1.stream(rgb[1].rows(), columns, [&](size_t row, size_t count, uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(rgb[1].data(i), rgb[1].data(i) + columns, data + (i - row) * columns);
+			}
+		}, [&](size_t row, size_t count, const uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(data + (i - row) * columns, data + (i - row + 1) * columns, streamed.data(i));
+			}
+		}, 4, FilterShape::SAME);
+		assert(streamed == planarPercentile[1]);
+
+		Channel<uint8_t> inverted(noise.rows(), noise.columns());
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				inverted(i, j) = 255 - noise(i, j);
+			}
+		}
+
+		std::vector<Channel<uint8_t>> frames{noise, inverted};
+		std::vector<Channel<uint8_t>> results;
+		PadModel<uint8_t> replicate(PadDirection::BOTH, PadType::REPLICATE);
+		filter(frames, results, FilterType::MEDIAN(7, 7), replicate);
+		for (size_t k = 0; k < frames.size(); ++k) {
+			assert(results[k] == filter(frames[k], FilterType::MEDIAN(7, 7), replicate));
+		}
+	}
+
+	// TEST morphology
+	{
+		FilterKernel line45{{0, 0, 1}, {0, 1, 0}, {1, 0, 0}};
+		FilterKernel line135{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+		assert(StructuringElement::line(3, 45).mask() == line45);
+		assert(StructuringElement::line(3, -135).mask() == line45);
+		assert(StructuringElement::line(3, 135).mask() == line135);
+		assert(StructuringElement::line(4, 0).mask() == FilterKernel(1, 4, 1.0));
+		assert(StructuringElement::line(4, 270).mask() == FilterKernel(4, 1, 1.0));
+		assert(FilterType::OPEN(3, 5)() == FilterKernel(5, 9, 1.0));
+		assert(FilterType::CLOSE(StructuringElement::line(2, 135))() == line135);
+		thrown = false;
+		try {
+			StructuringElement::line(5, 30);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		Channel<uint8_t> noise(23, 37);
+		uint32_t state = 54321;
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				state = state * 1664525 + 1013904223;
+				noise(i, j) = state >> 24;
+			}
+		}
+
+		// The minima (maxima) under the mask in the windows of the padded channel
+		auto extremum = [](const Channel<uint8_t> &padded, const FilterKernel &mask, bool minimum) {
+			Channel<uint8_t> result(padded.rows() - mask.rows() + 1, padded.columns() - mask.columns() + 1);
+			for (size_t i = 0; i < result.rows(); ++i) {
+				for (size_t j = 0; j < result.columns(); ++j) {
+					uint8_t value = minimum ? 255 : 0;
+					for (size_t a = 0; a < mask.rows(); ++a) {
+						for (size_t b = 0; b < mask.columns(); ++b) {
+							if (mask(a, b) != 0) {
+								uint8_t v = padded(i + a, j + b);
+								value = minimum ? std::min(value, v) : std::max(value, v);
+							}
+						}
+					}
+
+					result(i, j) = value;
+				}
+			}
+
+			return result;
+		};
+
+		// The full result is the valid one cut or padded by 0 as in imgcov2
+		auto fit = [](const Channel<uint8_t> &valid, const Channel<uint8_t> &full) {
+			Channel<uint8_t> expected(full.rows(), full.columns(), 0);
+			for (size_t i = 0; i < std::min(valid.rows(), full.rows()); ++i) {
+				for (size_t j = 0; j < std::min(valid.columns(), full.columns()); ++j) {
+					expected(i, j) = valid(i, j);
+				}
+			}
+
+			return expected;
+		};
+
+		for (auto element : {StructuringElement::rectangle(3, 3), StructuringElement::rectangle(4, 6),
+							 StructuringElement::rectangle(1, 7), StructuringElement::rectangle(9, 1),
+							 StructuringElement::rectangle(15, 11), StructuringElement::line(7, 45),
+							 StructuringElement::line(6, 135)}) {
+			FilterKernel mask = element.mask();
+			for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+				for (auto padDir : {PadDirection::BOTH, PadDirection::PRE, PadDirection::POST}) {
+					// The init value isn't used, CONST pads by the element which never wins the first operation
+					PadModel<uint8_t> model(padDir, padType, 100);
+					PadModel<uint8_t> maxModel(padDir, padType, 255);
+					PadModel<uint8_t> minModel(padDir, padType, 0);
+					Shape padShape{mask.rows() - 1, mask.columns() - 1};
+					Shape windowShape{2 * padShape[0], 2 * padShape[1]};
+
+					auto eroded = filter(noise, FilterType::ERODE(element), model, FilterShape::FULL, tiledSettings);
+					assert(eroded == fit(extremum(maxModel.pad(padShape, noise).first, mask, true), eroded));
+					auto dilated = filter(noise, FilterType::DILATE(element), model);
+					assert(dilated == fit(extremum(minModel.pad(padShape, noise).first, mask, false), dilated));
+
+					auto opened = filter(noise, FilterType::OPEN(element), model, FilterShape::FULL, tiledSettings);
+					auto openedPadded = maxModel.pad(windowShape, noise).first;
+					assert(opened == fit(extremum(extremum(openedPadded, mask, true), mask, false), opened));
+					auto closed = filter(noise, FilterType::CLOSE(element), model);
+					auto closedPadded = minModel.pad(windowShape, noise).first;
+					assert(closed == fit(extremum(extremum(closedPadded, mask, false), mask, true), closed));
+
+					// Floating-point channels pad by the infinities
+					Channel<float> noiseFloat = noise;
+					PadModel<float> modelFloat(padDir, padType, 100);
+					Channel<uint8_t> closedFloat = filter(noiseFloat, FilterType::CLOSE(element), modelFloat);
+					assert(closedFloat == closed);
+				}
+			}
+
+			// The opening is under the image and the closing is over it
+			PadModel<uint8_t> replicate(PadDirection::BOTH, PadType::REPLICATE);
+			auto opened = filter(noise, FilterType::OPEN(element), replicate, FilterShape::SAME);
+			auto closed = filter(noise, FilterType::CLOSE(element), replicate, FilterShape::SAME);
+			for (size_t i = 0; i < noise.rows(); ++i) {
+				for (size_t j = 0; j < noise.columns(); ++j) {
+					assert(opened(i, j) <= noise(i, j) && noise(i, j) <= closed(i, j));
+				}
+			}
+		}
+
+		// The bright details smaller than the element are removed by the opening
+		Channel<uint8_t> spots(20, 20, 50);
+		for (size_t i = 4; i < 7; ++i) {
+			for (size_t j = 12; j < 15; ++j) {
+				spots(i, j) = 200;
+			}
+		}
+
+		imfilter<uint8_t, 1, FilterType::OPEN, PadDirection::BOTH, PadType::REPLICATE> background(5, 5);
+		background.shape() = FilterShape::SAME;
+		assert(background(spots) == Channel<uint8_t>(20, 20, 50));
+
+		// Interleaved images have an element per channel, the streams and the batches use the same engine
+		imfilter<uint8_t, 3, FilterType::DILATE, PadDirection::BOTH, PadType::CONST> dilate(
+				StructuringElement::line(5, 45));
+		dilate.shape() = FilterShape::SAME;
+		auto planarDilated = dilate(rgb);
+		assert(deinterleave(dilate(interleaved)) == planarDilated);
+
+		Channel<uint8_t> streamed(rgb[2].rows(), rgb[2].columns());
+		imfilter<uint8_t, 1, FilterType::DILATE, PadDirection::BOTH, PadType::CONST> dilate1(
+				StructuringElement::line(5, 45));
+		size_t columns = rgb[2].columns();
+		dilate1.stream(rgb[2].rows(), columns, [&](size_t row, size_t count, uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(rgb[2].data(i), rgb[2].data(i) + columns, data + (i - row) * columns);
+			}
+		}, [&](size_t row, size_t count, const uint8_t *data) {
+			for (size_t i = row; i < row + count; ++i) {
+				std::copy(data + (i - row) * columns, data + (i - row + 1) * columns, streamed.data(i));
+			}
+		}, 3, FilterShape::SAME);
+		assert(streamed == planarDilated[2]);
+
+		Channel<uint8_t> inverted(noise.rows(), noise.columns());
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				inverted(i, j) = 255 - noise(i, j);
+			}
+		}
+
+		std::vector<Channel<uint8_t>> frames{noise, inverted};
+		std::vector<Channel<uint8_t>> results;
+		PadModel<uint8_t> symmetric(PadDirection::BOTH, PadType::SYMMETRIC);
+		filter(frames, results, FilterType::CLOSE(7, 3), symmetric);
+		for (size_t k = 0; k < frames.size(); ++k) {
+			assert(results[k] == filter(frames[k], FilterType::CLOSE(7, 3), symmetric));
+		}
+	}
+
+	// TEST bilateral
+	{
+		assert(FilterType::BILATERAL(1.5, 10)() == FilterType::GAUSSIAN(7, 7, 1.5)());
+		thrown = false;
+		try {
+			FilterType::BILATERAL(2, 0);
+		} catch (const std::invalid_argument &) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		Channel<uint8_t> noise(71, 43);
+		uint32_t state = 24680;
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				state = state * 1664525 + 1013904223;
+				noise(i, j) = (j < 20 ? 60 : 180) + (state >> 27);
+			}
+		}
+
+		// The weighted mean of the windows of the padded channel
+		auto reference = [](const Channel<double> &padded, double spatialSigma, double rangeSigma) {
+			size_t radius = static_cast<size_t>(std::ceil(2 * spatialSigma));
+			Channel<double> result(padded.rows() - 2 * radius, padded.columns() - 2 * radius);
+			for (size_t i = 0; i < result.rows(); ++i) {
+				for (size_t j = 0; j < result.columns(); ++j) {
+					double centre = padded(i + radius, j + radius);
+					double sum = 0;
+					double weights = 0;
+					for (size_t a = 0; a <= 2 * radius; ++a) {
+						for (size_t b = 0; b <= 2 * radius; ++b) {
+							double dy = static_cast<double>(a) - radius;
+							double dx = static_cast<double>(b) - radius;
+							double d = padded(i + a, j + b) - centre;
+							double weight = std::exp(-(dy * dy + dx * dx) / (2 * spatialSigma * spatialSigma)
+													 - d * d / (2 * rangeSigma * rangeSigma));
+							sum += weight * padded(i + a, j + b);
+							weights += weight;
+						}
+					}
+
+					result(i, j) = sum / weights;
+				}
+			}
+
+			return result;
+		};
+
+		ConvolutionSettings exact = tiledSettings;
+		exact.engine = ConvolutionEngine::DIRECT;
+		ConvolutionSettings grid = tiledSettings;
+		grid.engine = ConvolutionEngine::GRID;
+		ConvolutionSettings oneBand = grid;
+		oneBand.tileRows = noise.rows();
+		Channel<double> noiseDouble = noise;
+		for (double spatialSigma : {1.0, 2.5}) {
+			for (auto padType : {PadType::CONST, PadType::REPLICATE, PadType::SYMMETRIC, PadType::CIRCULAR}) {
+				PadModel<double> model(PadDirection::BOTH, padType, 100);
+				PadModel<uint8_t> model8(PadDirection::BOTH, padType, 100);
+				FilterType::BILATERAL impl(spatialSigma, 15);
+				size_t radius = static_cast<size_t>(std::ceil(2 * spatialSigma));
+				auto padded = model.pad(Shape{radius, radius}, noiseDouble).first;
+				auto expected = reference(padded, spatialSigma, 15);
+
+				auto result = filter(noiseDouble, impl, model, FilterShape::SAME, exact);
+				assert(result.rows() == noise.rows() && result.columns() == noise.columns());
+				auto result8 = filter(noise, impl, model8, FilterShape::SAME, exact);
+				auto approximate = filter(noise, impl, model8, FilterShape::SAME, grid);
+				double difference = 0;
+				for (size_t i = 0; i < noise.rows(); ++i) {
+					for (size_t j = 0; j < noise.columns(); ++j) {
+						assert(std::abs(result(i, j) - expected(i, j)) < 1e-9);
+						assert(std::abs(result8(i, j) - expected(i, j)) <= 0.5 + 1e-3);
+						difference += std::abs(approximate(i, j) - expected(i, j));
+					}
+				}
+
+				// The grid is close to the exact filter and keeps the edge
+				assert(difference / (noise.rows() * noise.columns()) < 2);
+				for (size_t i = 0; i < noise.rows(); ++i) {
+					assert(approximate(i, 16) < 100 && approximate(i, 23) > 160);
+				}
+
+				// The bands of the grid give the result of one grid
+				assert(filter(noise, impl, model8, FilterShape::SAME, oneBand) == approximate);
+			}
+		}
+
+		// Interleaved images filter each channel, the streams and the batches use the same engine
+		imfilter<uint8_t, 3, FilterType::BILATERAL, PadDirection::BOTH, PadType::REPLICATE> bilateral(3.0, 20.0);
+		bilateral.shape() = FilterShape::SAME;
+		auto planarBilateral = bilateral(rgb);
+		assert(deinterleave(bilateral(interleaved)) == planarBilateral);
+
+		// The exact filter of a stream is the planar one, the grids of the bands are aligned on them
+		imfilter<uint8_t, 1, FilterType::BILATERAL, PadDirection::BOTH, PadType::REPLICATE> bilateral1(3.0, 20.0);
+		for (auto engine : {ConvolutionEngine::DIRECT, ConvolutionEngine::GRID}) {
+			bilateral1.settings().engine = engine;
+			bilateral1.shape() = FilterShape::SAME;
+			auto planar = bilateral1(rgb[0]);
+			Channel<uint8_t> streamed(rgb[0].rows(), rgb[0].columns());
+			size_t columns = rgb[0].columns();
+			bilateral1.stream(rgb[0].rows(), columns, [&](size_t row, size_t count, uint8_t *data) {
+				for (size_t i = row; i < row + count; ++i) {
+					std::copy(rgb[0].data(i), rgb[0].data(i) + columns, data + (i - row) * columns);
+				}
+			}, [&](size_t row, size_t count, const uint8_t *data) {
+				for (size_t i = row; i < row + count; ++i) {
+					std::copy(data + (i - row) * columns, data + (i - row + 1) * columns, streamed.data(i));
+				}
+			}, 5, FilterShape::SAME);
+			for (size_t i = 0; i < planar.rows(); ++i) {
+				for (size_t j = 0; j < planar.columns(); ++j) {
+					assert(engine == ConvolutionEngine::GRID ? std::abs(streamed(i, j) - planar(i, j)) <= 3
+															 : streamed(i, j) == planar(i, j));
+				}
+			}
+		}
+
+		Channel<uint8_t> inverted(noise.rows(), noise.columns());
+		for (size_t i = 0; i < noise.rows(); ++i) {
+			for (size_t j = 0; j < noise.columns(); ++j) {
+				inverted(i, j) = 255 - noise(i, j);
+			}
+		}
+
+		std::vector<Channel<uint8_t>> frames{noise, inverted};
+		std::vector<Channel<uint8_t>> results;
+		PadModel<uint8_t> symmetric(PadDirection::BOTH, PadType::SYMMETRIC);
+		filter(frames, results, FilterType::BILATERAL(4, 25), symmetric);
+		for (size_t k = 0; k < frames.size(); ++k) {
+			assert(results[k] == filter(frames[k], FilterType::BILATERAL(4, 25), symmetric));
+		}
+	}
+
 	imfilter<double, 1, FilterType::AVERAGE, PadDirection::BOTH, PadType::CONST> f(3, 3);
 	Channel<double> out = f(ch1);
 	chprint("out", out);